@@ -0,0 +1,295 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Compares memory use and throughput of the ID set implementations used
+ * for the index of referenced nodes in odad-find-orphans.
+ *
+ * The node IDs referenced from ways are generated the same way for all
+ * set types. In "planet" mode they are spread over the whole ID space
+ * (like on the planet where most nodes are referenced). In "extract" mode
+ * they come from a number of small clusters scattered over the ID space
+ * (like in a regional extract where the objects are from all eras of OSM
+ * history). Way nodes are mostly runs of consecutive IDs.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/index/id_set.hpp>
+
+#include "concurrent_id_set.hpp"
+#include "id_set_compressed.hpp"
+
+static const char* const program_name = "odad-bench-id-sets";
+
+using id_type = uint64_t;
+
+// A run of consecutive node IDs in a way.
+using run_type = std::pair<id_type, id_type>;
+
+struct options_type {
+    uint64_t nodes = 100000000;
+    uint64_t max_id = 10000000000;
+    uint64_t lookups = 10000000;
+    uint64_t seed = 1;
+    std::size_t clusters = 200;
+    std::string mode{"planet"};
+};
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS]\n\n"
+              << "Compare memory use and throughput of ID set implementations.\n"
+              << "\nOptions:\n"
+              << "  -c, --clusters=NUM  Number of ID clusters in extract mode (default: 200)\n"
+              << "  -h, --help          This help message\n"
+              << "  -l, --lookups=NUM   Number of lookups (default: 10000000)\n"
+              << "  -m, --mode=MODE     'planet' (default) or 'extract'\n"
+              << "  -M, --max-id=ID     Largest node ID (default: 10000000000)\n"
+              << "  -n, --nodes=NUM     Number of referenced nodes (default: 100000000)\n"
+              << "  -s, --seed=NUM      Seed for random number generator (default: 1)\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"clusters", required_argument, nullptr, 'c'},
+        {"help",           no_argument, nullptr, 'h'},
+        {"lookups",  required_argument, nullptr, 'l'},
+        {"mode",     required_argument, nullptr, 'm'},
+        {"max-id",   required_argument, nullptr, 'M'},
+        {"nodes",    required_argument, nullptr, 'n'},
+        {"seed",     required_argument, nullptr, 's'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "c:hl:m:M:n:s:", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'c':
+                options.clusters = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'l':
+                options.lookups = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'm':
+                options.mode = optarg;
+                if (options.mode != "planet" && options.mode != "extract") {
+                    std::cerr << "Unknown mode '" << optarg << "'. Use 'planet' or 'extract'.\n";
+                    std::exit(2);
+                }
+                break;
+            case 'M':
+                options.max_id = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'n':
+                options.nodes = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 's':
+                options.seed = std::strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    if (optind != argc) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS]\n";
+        std::exit(2);
+    }
+
+    if (options.clusters == 0 || options.nodes == 0 || options.max_id < options.nodes) {
+        std::cerr << "Need at least one cluster and node and max-id >= nodes.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+/**
+ * Create runs of consecutive node IDs as they appear in ways. Most runs
+ * are short and there are gaps between them for nodes that are not
+ * referenced (POIs, deleted nodes).
+ */
+static std::vector<run_type> generate_runs(const options_type& options) {
+    std::mt19937_64 gen{options.seed};
+    std::uniform_int_distribution<id_type> run_length{1, 16};
+    std::geometric_distribution<id_type> gap{0.3};
+
+    const bool extract = options.mode == "extract";
+    const id_type nodes_per_cluster = options.nodes / options.clusters + 1;
+    const id_type cluster_distance = options.max_id / options.clusters;
+    std::uniform_int_distribution<id_type> cluster_offset{0, cluster_distance > nodes_per_cluster * 2 ? cluster_distance - nodes_per_cluster * 2 : 0};
+
+    std::vector<run_type> runs;
+    id_type count = 0;
+    id_type id = 1;
+    id_type cluster_end = 0;
+    std::size_t cluster = 0;
+
+    while (count < options.nodes) {
+        if (extract && id >= cluster_end) {
+            id = cluster * cluster_distance + cluster_offset(gen) + 1;
+            cluster_end = id + nodes_per_cluster * 2;
+            ++cluster;
+        }
+
+        const id_type length = run_length(gen);
+        runs.emplace_back(id, id + length - 1);
+        count += length;
+
+        // Planet mode spreads the nodes over the whole ID space.
+        id += length + (extract ? gap(gen) : gap(gen) * (options.max_id / options.nodes));
+    }
+
+    // Ways reference nodes in somewhat random order
+    std::shuffle(runs.begin(), runs.end(), gen);
+
+    return runs;
+}
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start) {
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static void print_result(const char* name, double fill_time, double lookup_time, std::size_t memory, uint64_t ids, uint64_t lookups, uint64_t found) {
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::fixed << std::setprecision(3)
+              << std::setw(10) << fill_time
+              << std::setw(12) << static_cast<uint64_t>(static_cast<double>(ids) / fill_time)
+              << std::setw(10) << lookup_time
+              << std::setw(12) << static_cast<uint64_t>(static_cast<double>(lookups) / lookup_time)
+              << std::setw(10) << memory / (1024 * 1024)
+              << std::setw(10) << std::setprecision(2) << static_cast<double>(memory) * 8 / static_cast<double>(ids)
+              << std::setw(12) << found << '\n';
+}
+
+template <typename TIdSet>
+static uint64_t lookup_all(const TIdSet& set, const std::vector<id_type>& ids) {
+    uint64_t found = 0;
+    for (const auto id : ids) {
+        if (set.get(id)) {
+            ++found;
+        }
+    }
+    return found;
+}
+
+static void bench_osmium_dense(const std::vector<run_type>& runs, const std::vector<id_type>& lookups, uint64_t ids) {
+    osmium::index::IdSetDense<id_type> set;
+
+    const auto start = clock_type::now();
+    for (const auto& run : runs) {
+        for (id_type id = run.first; id <= run.second; ++id) {
+            set.set(id);
+        }
+    }
+    const double fill_time = seconds_since(start);
+
+    const auto lookup_start = clock_type::now();
+    const uint64_t found = lookup_all(set, lookups);
+    const double lookup_time = seconds_since(lookup_start);
+
+    print_result("IdSetDense", fill_time, lookup_time, set.used_memory(), ids, lookups.size(), found);
+}
+
+template <typename TIdSet>
+static void bench_with_ranges(const char* name, const std::vector<run_type>& runs, const std::vector<id_type>& lookups, uint64_t ids) {
+    TIdSet set;
+
+    const auto start = clock_type::now();
+    for (const auto& run : runs) {
+        set.set_range(run.first, run.second);
+    }
+    set.optimize();
+    const double fill_time = seconds_since(start);
+
+    const auto lookup_start = clock_type::now();
+    const uint64_t found = lookup_all(set, lookups);
+    const double lookup_time = seconds_since(lookup_start);
+
+    print_result(name, fill_time, lookup_time, set.used_memory(), ids, lookups.size(), found);
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    std::cerr << "Generating " << options.nodes << " node IDs in " << options.mode << " mode...\n";
+    const auto runs = generate_runs(options);
+
+    uint64_t ids = 0;
+    id_type max_id = 0;
+    for (const auto& run : runs) {
+        ids += run.second - run.first + 1;
+        max_id = std::max(max_id, run.second);
+    }
+
+    // Half of the lookups are for IDs in the set (like when checking
+    // nodes in the second pass), half are random.
+    std::mt19937_64 gen{options.seed + 1};
+    std::uniform_int_distribution<std::size_t> pick_run{0, runs.size() - 1};
+    std::uniform_int_distribution<id_type> pick_id{1, max_id};
+    std::vector<id_type> lookups;
+    lookups.reserve(options.lookups);
+    for (uint64_t i = 0; i < options.lookups; ++i) {
+        lookups.push_back(i % 2 ? runs[pick_run(gen)].first : pick_id(gen));
+    }
+    std::sort(lookups.begin(), lookups.end());
+
+    std::cout << "mode=" << options.mode << " ids=" << ids << " runs=" << runs.size() << " max_id=" << max_id << '\n';
+    std::cout << std::left << std::setw(24) << "set type" << std::right
+              << std::setw(10) << "fill s"
+              << std::setw(12) << "ids/s"
+              << std::setw(10) << "lookup s"
+              << std::setw(12) << "lookups/s"
+              << std::setw(10) << "MBytes"
+              << std::setw(10) << "bits/id"
+              << std::setw(12) << "found" << '\n';
+
+    bench_osmium_dense(runs, lookups, ids);
+    bench_with_ranges<ConcurrentIdSetDense<id_type>>("ConcurrentIdSetDense", runs, lookups, ids);
+    bench_with_ranges<IdSetCompressed<id_type>>("IdSetCompressed", runs, lookups, ids);
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
@@ -0,0 +1,704 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Generates deterministic synthetic OSM data for benchmarking. The same
+ * options (including the seed) always result in the same data.
+ *
+ * The data is shaped roughly like the planet: most objects are nodes, ways
+ * are made from runs of consecutive node IDs (like real data mostly is),
+ * neighbouring ways share end nodes, and there are a few long ways. Node
+ * locations are clustered around "cities" to get a skewed distribution. A
+ * configurable fraction of objects have one of the anomalies the odad-*
+ * programs are looking for.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+static const char* const program_name = "odad-generate-data";
+
+struct options_type {
+    uint64_t objects = 1000000;
+    uint64_t seed = 1;
+    double anomaly_rate = 0.01;
+    double long_way_rate = 0.001;
+    double skew = 0.7;
+    bool locations_on_ways = true;
+    bool overwrite = false;
+    bool verbose = true;
+};
+
+// Number of consecutive node IDs laid out along one "street".
+constexpr const uint64_t block_size = 4096;
+
+// Number of nodes in a block going in the same direction.
+constexpr const uint64_t segment_size = 256;
+
+constexpr const std::size_t num_cities = 64;
+
+// Average number of nodes in a way (without long ways).
+constexpr const double average_way_length = 7.0;
+
+constexpr const double pi = 3.14159265358979323846;
+
+constexpr const std::size_t buffer_size = 10UL * 1024UL * 1024UL;
+
+static uint64_t splitmix64(uint64_t x) noexcept {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27U)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31U);
+}
+
+// Deterministic random number in [0, 1) derived from seed and n.
+static double unit(uint64_t seed, uint64_t n) noexcept {
+    return static_cast<double>(splitmix64(seed ^ splitmix64(n)) >> 11U) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Sequence of random numbers derived from a seed. The distributions from
+ * <random> are not used, because their results differ between standard
+ * library implementations.
+ */
+class RandomSequence {
+
+    uint64_t m_seed;
+    uint64_t m_n = 0;
+
+public:
+
+    explicit RandomSequence(uint64_t seed) noexcept :
+        m_seed(splitmix64(seed)) {
+    }
+
+    /// Random number in [0, 1).
+    double uniform() noexcept {
+        return unit(m_seed, m_n++);
+    }
+
+    /// Random number in [0, max).
+    uint64_t below(uint64_t max) noexcept {
+        return splitmix64(m_seed ^ splitmix64(m_n++)) % max;
+    }
+
+    /// Number of failures before the first success with probability p.
+    uint64_t geometric(double p) noexcept {
+        return static_cast<uint64_t>(std::floor(std::log(1.0 - uniform()) / std::log(1.0 - p)));
+    }
+
+}; // class RandomSequence
+
+/**
+ * Calculates node locations from the node ID alone, so that the ways and
+ * relations can be generated without keeping the locations in memory.
+ */
+class LocationGenerator {
+
+    uint64_t m_seed;
+    double m_skew;
+    double m_anomaly_rate;
+    std::vector<std::pair<double, double>> m_cities;
+
+    static double clamp_lat(double lat) noexcept {
+        return lat < -85.0 ? -85.0 : (lat > 85.0 ? 85.0 : lat);
+    }
+
+    static double wrap_lon(double lon) noexcept {
+        while (lon < -180.0) {
+            lon += 360.0;
+        }
+        while (lon > 180.0) {
+            lon -= 360.0;
+        }
+        return lon;
+    }
+
+    std::pair<double, double> block_origin(uint64_t block) const noexcept {
+        const uint64_t s = m_seed + 1;
+        if (unit(s, block * 4) < m_skew) {
+            // Box-Muller for a normal distribution around a city
+            const auto& city = m_cities[splitmix64(s ^ (block * 4 + 1)) % num_cities];
+            const double r = std::sqrt(-2.0 * std::log(1.0 - unit(s, block * 4 + 2)));
+            const double phi = 2.0 * pi * unit(s, block * 4 + 3);
+            return std::make_pair(wrap_lon(city.first + r * std::cos(phi)), clamp_lat(city.second + r * std::sin(phi)));
+        }
+        return std::make_pair(unit(s, block * 4 + 1) * 360.0 - 180.0, unit(s, block * 4 + 2) * 135.0 - 60.0);
+    }
+
+    std::pair<double, double> segment_direction(uint64_t segment) const noexcept {
+        // about 10 to 40m between nodes
+        const double angle = 2.0 * pi * unit(m_seed + 2, segment);
+        const double dist = 0.0001 + 0.0003 * unit(m_seed + 3, segment);
+        return std::make_pair(dist * std::cos(angle), dist * std::sin(angle));
+    }
+
+    osmium::Location base_location(uint64_t id) const noexcept {
+        const uint64_t block = id / block_size;
+        auto pos = block_origin(block);
+
+        const uint64_t offset = id % block_size;
+        const uint64_t first_segment = block * (block_size / segment_size);
+        for (uint64_t s = 0; s <= offset / segment_size; ++s) {
+            const auto dir = segment_direction(first_segment + s);
+            const auto steps = static_cast<double>(s == offset / segment_size ? offset % segment_size : segment_size);
+            pos.first += dir.first * steps;
+            pos.second += dir.second * steps;
+        }
+
+        // small jitter so that the ways are not completely straight
+        pos.first += (unit(m_seed + 4, id) - 0.5) * 0.00005;
+        pos.second += (unit(m_seed + 5, id) - 0.5) * 0.00005;
+
+        return osmium::Location{wrap_lon(pos.first), clamp_lat(pos.second)};
+    }
+
+public:
+
+    LocationGenerator(uint64_t seed, double skew, double anomaly_rate) :
+        m_seed(splitmix64(seed)),
+        m_skew(skew),
+        m_anomaly_rate(anomaly_rate) {
+        m_cities.reserve(num_cities);
+        for (std::size_t i = 0; i < num_cities; ++i) {
+            m_cities.emplace_back(unit(m_seed, i * 2) * 360.0 - 180.0, unit(m_seed, i * 2 + 1) * 120.0 - 50.0);
+        }
+    }
+
+    // Some nodes get the same location as the node before (colocated nodes)
+    osmium::Location operator()(uint64_t id) const noexcept {
+        if (id > 1 && unit(m_seed + 6, id) < m_anomaly_rate) {
+            return base_location(id - 1);
+        }
+        return base_location(id);
+    }
+
+}; // class LocationGenerator
+
+/**
+ * Decides which node IDs are used by which way. This is run twice with the
+ * same seed, once to find out which nodes are used in ways before the nodes
+ * are written and once to actually write the ways.
+ */
+class WayLayout {
+
+    RandomSequence m_random;
+    double m_way_length;
+    double m_gap;
+    uint64_t m_num_nodes;
+    double m_long_way_rate;
+    uint64_t m_cursor = 1;
+    uint64_t m_last_node = 0;
+
+public:
+
+    WayLayout(uint64_t seed, uint64_t num_nodes, uint64_t num_ways, double long_way_rate) :
+        m_random(seed),
+        m_way_length(1.0 / (average_way_length - 1.0)),
+        m_gap(1.0 / (1.0 + std::max(static_cast<double>(num_nodes) / static_cast<double>(num_ways) - (average_way_length - 0.3), 0.1))),
+        m_num_nodes(num_nodes),
+        m_long_way_rate(long_way_rate) {
+    }
+
+    // Returns first node ID and number of nodes of the next way.
+    std::pair<uint64_t, uint64_t> next() {
+        uint64_t length = 2 + m_random.geometric(m_way_length);
+        if (m_random.uniform() < m_long_way_rate) {
+            length = 1000 + m_random.below(1001);
+        }
+        length = std::min(length, m_num_nodes);
+
+        uint64_t first = m_cursor + m_random.geometric(m_gap);
+        if (m_last_node != 0 && m_random.uniform() < 0.3) {
+            // share end node with previous way
+            first = m_last_node;
+        }
+
+        if (first + length > m_num_nodes + 1) {
+            // out of nodes, start again from the beginning
+            first = 1 + m_random.below(m_num_nodes - length + 1);
+        } else {
+            m_cursor = first + length;
+        }
+
+        m_last_node = first + length - 1;
+        return std::make_pair(first, length);
+    }
+
+}; // class WayLayout
+
+class DataGenerator {
+
+    options_type m_options;
+    uint64_t m_num_nodes;
+    uint64_t m_num_ways;
+    uint64_t m_num_relations;
+
+    osmium::io::Writer& m_writer;
+    osmium::memory::Buffer m_buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+
+    RandomSequence m_random;
+
+    LocationGenerator m_locations;
+
+    // nodes used in at least one way
+    std::vector<bool> m_used_nodes;
+
+    bool chance(double p) {
+        return m_random.uniform() < p;
+    }
+
+    uint64_t random(uint64_t max) {
+        return m_random.below(max);
+    }
+
+    template <typename TBuilder>
+    void set_attributes(TBuilder& builder, uint64_t id) {
+        // timestamps between 2008 and 2022
+        builder.set_id(static_cast<osmium::object_id_type>(id))
+               .set_version(static_cast<osmium::object_version_type>(1 + random(5)))
+               .set_changeset(static_cast<osmium::changeset_id_type>(1 + random(100000000)))
+               .set_timestamp(osmium::Timestamp{static_cast<uint32_t>(1199145600 + random(441763200))})
+               .set_uid(static_cast<osmium::user_id_type>(1 + random(10000000)));
+    }
+
+    void add_anomalous_tag(osmium::builder::TagListBuilder& builder) {
+        switch (random(8)) {
+            case 0:
+                builder.add_tag("", "empty key");
+                break;
+            case 1:
+                builder.add_tag("x", "short key");
+                break;
+            case 2:
+                builder.add_tag("role", "outer");
+                break;
+            case 3:
+                builder.add_tag("bad key", "yes");
+                break;
+            case 4:
+                builder.add_tag("name:\xc3\xa9", "unusual key");
+                break;
+            case 5:
+                builder.add_tag("note", "");
+                break;
+            case 6:
+                builder.add_tag("name", " Main Street");
+                break;
+            default:
+                builder.add_tag("type", "multipolygon");
+                break;
+        }
+    }
+
+    void flush_buffer(bool force = false) {
+        if (force || m_buffer.committed() > buffer_size - 1024 * 1024) {
+            m_writer(std::move(m_buffer));
+            m_buffer = osmium::memory::Buffer{buffer_size, osmium::memory::Buffer::auto_grow::yes};
+        }
+    }
+
+    void add_node(uint64_t id) {
+        {
+            osmium::builder::NodeBuilder builder{m_buffer};
+            set_attributes(builder, id);
+            builder.set_location(m_locations(id));
+
+            const bool used = m_used_nodes[id - 1];
+            // unused nodes are POIs and need tags, otherwise they are orphans
+            if ((!used && !chance(m_options.anomaly_rate)) || (used && chance(0.03))) {
+                osmium::builder::TagListBuilder tl_builder{builder};
+                if (used) {
+                    tl_builder.add_tag("highway", chance(0.5) ? "traffic_signals" : "crossing");
+                } else {
+                    tl_builder.add_tag("amenity", chance(0.5) ? "bench" : "restaurant");
+                    if (chance(0.3)) {
+                        tl_builder.add_tag("name", "Somewhere");
+                    }
+                }
+                if (chance(m_options.anomaly_rate)) {
+                    add_anomalous_tag(tl_builder);
+                }
+            }
+        }
+        m_buffer.commit();
+        flush_buffer();
+    }
+
+    void add_way(uint64_t id, uint64_t first, uint64_t length) {
+        static const char* const highway_types[] = {
+            "residential", "service", "track", "footway", "primary", "secondary"
+        };
+
+        // anomalies: single node, repeated node, spike, untagged (orphan)
+        const bool anomaly = chance(m_options.anomaly_rate);
+        const auto kind = anomaly ? random(5) : 5;
+
+        {
+            osmium::builder::WayBuilder builder{m_buffer};
+            set_attributes(builder, id);
+
+            {
+                osmium::builder::WayNodeListBuilder wnl_builder{builder};
+                const auto add = [&](uint64_t node_id) {
+                    if (m_options.locations_on_ways) {
+                        wnl_builder.add_node_ref(osmium::NodeRef{static_cast<osmium::object_id_type>(node_id), m_locations(node_id)});
+                    } else {
+                        wnl_builder.add_node_ref(osmium::NodeRef{static_cast<osmium::object_id_type>(node_id)});
+                    }
+                };
+
+                if (kind == 0) {
+                    add(first);
+                } else {
+                    for (uint64_t n = first; n < first + length; ++n) {
+                        add(n);
+                        if (kind == 1 && n == first) {
+                            add(n);
+                        } else if (kind == 2 && n == first + 1) {
+                            add(n - 1);
+                        }
+                    }
+                }
+            }
+
+            if (kind != 3) {
+                osmium::builder::TagListBuilder tl_builder{builder};
+                if (length >= 1000) {
+                    tl_builder.add_tag("natural", "coastline");
+                } else if (chance(0.15)) {
+                    tl_builder.add_tag("building", "yes");
+                } else {
+                    tl_builder.add_tag("highway", highway_types[random(sizeof(highway_types) / sizeof(highway_types[0]))]);
+                }
+                if (kind == 4) {
+                    add_anomalous_tag(tl_builder);
+                }
+            }
+        }
+        m_buffer.commit();
+        flush_buffer();
+    }
+
+    void add_relation(uint64_t id) {
+        const bool anomaly = chance(m_options.anomaly_rate);
+        const auto kind = anomaly ? random(5) : 5;
+        const auto type = random(10);
+
+        {
+            osmium::builder::RelationBuilder builder{m_buffer};
+            set_attributes(builder, id);
+
+            // anomaly: relation without members
+            if (kind != 0) {
+                osmium::builder::RelationMemberListBuilder rml_builder{builder};
+                if (type < 5) { // multipolygon
+                    const uint64_t num = 1 + random(5);
+                    const uint64_t way = 1 + random(m_num_ways);
+                    for (uint64_t n = 0; n < num && way + n <= m_num_ways; ++n) {
+                        rml_builder.add_member(osmium::item_type::way, static_cast<osmium::object_id_type>(way + n), n == 0 ? "outer" : "inner");
+                    }
+                } else if (type < 8) { // route
+                    const uint64_t num = 5 + random(46);
+                    const uint64_t way = 1 + random(m_num_ways);
+                    for (uint64_t n = 0; n < num && way + n <= m_num_ways; ++n) {
+                        rml_builder.add_member(osmium::item_type::way, static_cast<osmium::object_id_type>(way + n), "");
+                    }
+                    rml_builder.add_member(osmium::item_type::node, static_cast<osmium::object_id_type>(1 + random(m_num_nodes)), "stop");
+                } else { // site or super relation
+                    if (id > 1) {
+                        rml_builder.add_member(osmium::item_type::relation, static_cast<osmium::object_id_type>(1 + random(id - 1)), "");
+                    }
+                    rml_builder.add_member(osmium::item_type::node, static_cast<osmium::object_id_type>(1 + random(m_num_nodes)), "");
+                }
+                if (kind == 1) {
+                    // anomaly: member that doesn't exist
+                    rml_builder.add_member(osmium::item_type::way, static_cast<osmium::object_id_type>(m_num_ways + 1 + random(1000)), "outer");
+                }
+            }
+
+            // anomaly: relation without tags
+            if (kind != 2) {
+                osmium::builder::TagListBuilder tl_builder{builder};
+                if (type < 5) {
+                    tl_builder.add_tag("type", "multipolygon");
+                    if (kind == 3) {
+                        tl_builder.add_tag("boundary", "administrative");
+                    } else if (kind == 4) {
+                        tl_builder.add_tag("natural", "coastline");
+                    } else {
+                        tl_builder.add_tag("landuse", "forest");
+                    }
+                } else if (type < 8) {
+                    tl_builder.add_tag("type", "route");
+                    tl_builder.add_tag("route", "bus");
+                } else {
+                    tl_builder.add_tag("type", "site");
+                }
+            }
+        }
+        m_buffer.commit();
+        flush_buffer();
+    }
+
+public:
+
+    DataGenerator(const options_type& options, osmium::io::Writer& writer) :
+        m_options(options),
+        m_num_nodes(std::max<uint64_t>(options.objects * 880 / 1000, 2)),
+        m_num_ways(std::max<uint64_t>(options.objects * 115 / 1000, 1)),
+        m_num_relations(std::max<uint64_t>(options.objects - m_num_nodes - m_num_ways, 1)),
+        m_writer(writer),
+        m_random(options.seed),
+        m_locations(options.seed, options.skew, options.anomaly_rate),
+        m_used_nodes(m_num_nodes) {
+    }
+
+    uint64_t num_nodes() const noexcept {
+        return m_num_nodes;
+    }
+
+    uint64_t num_ways() const noexcept {
+        return m_num_ways;
+    }
+
+    uint64_t num_relations() const noexcept {
+        return m_num_relations;
+    }
+
+    void run(osmium::util::VerboseOutput& vout) {
+        vout << "Laying out ways...\n";
+        {
+            WayLayout layout{m_options.seed, m_num_nodes, m_num_ways, m_options.long_way_rate};
+            for (uint64_t id = 1; id <= m_num_ways; ++id) {
+                const auto way = layout.next();
+                for (uint64_t n = way.first; n < way.first + way.second; ++n) {
+                    m_used_nodes[n - 1] = true;
+                }
+            }
+        }
+
+        vout << "Generating " << m_num_nodes << " nodes...\n";
+        for (uint64_t id = 1; id <= m_num_nodes; ++id) {
+            add_node(id);
+        }
+
+        vout << "Generating " << m_num_ways << " ways...\n";
+        WayLayout layout{m_options.seed, m_num_nodes, m_num_ways, m_options.long_way_rate};
+        for (uint64_t id = 1; id <= m_num_ways; ++id) {
+            const auto way = layout.next();
+            add_way(id, way.first, way.second);
+        }
+
+        vout << "Generating " << m_num_relations << " relations...\n";
+        for (uint64_t id = 1; id <= m_num_relations; ++id) {
+            add_relation(id);
+        }
+
+        flush_buffer(true);
+    }
+
+}; // class DataGenerator
+
+static uint64_t parse_count(const char* str) {
+    char* end = nullptr;
+    errno = 0;
+    uint64_t value = std::strtoull(str, &end, 10);
+    if (errno != 0 || end == str || value == 0) {
+        throw std::runtime_error{std::string{"Not a valid number: "} + str};
+    }
+    switch (*end) {
+        case '\0':
+            return value;
+        case 'k':
+            value *= 1000ULL;
+            break;
+        case 'M':
+            value *= 1000ULL * 1000ULL;
+            break;
+        case 'G':
+            value *= 1000ULL * 1000ULL * 1000ULL;
+            break;
+        default:
+            throw std::runtime_error{std::string{"Not a valid number: "} + str};
+    }
+    if (end[1] != '\0') {
+        throw std::runtime_error{std::string{"Not a valid number: "} + str};
+    }
+    return value;
+}
+
+static double parse_rate(const char* str) {
+    char* end = nullptr;
+    const double value = std::strtod(str, &end);
+    if (end == str || *end != '\0' || value < 0.0 || value > 1.0) {
+        throw std::runtime_error{std::string{"Rate must be between 0 and 1: "} + str};
+    }
+    return value;
+}
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] OUTPUT-FILE\n\n"
+              << "Generate synthetic OSM data for benchmarking.\n"
+              << "\nOptions:\n"
+              << "  -A, --anomaly-rate=RATE       Fraction of objects with anomalies (default: 0.01)\n"
+              << "  -f, --overwrite               Allow overwriting of existing output file\n"
+              << "  -h, --help                    This help message\n"
+              << "  -l, --long-way-rate=RATE      Fraction of ways with 1000-2000 nodes (default: 0.001)\n"
+              << "  -n, --objects=NUM             Number of objects to generate, suffixes k, M, G\n"
+              << "                                are allowed (default: 1M)\n"
+              << "      --no-locations-on-ways    Do not add node locations to ways\n"
+              << "  -q, --quiet                   Work quietly\n"
+              << "  -s, --seed=NUM                Seed for random number generator (default: 1)\n"
+              << "  -k, --skew=RATE               Fraction of nodes clustered around cities (default: 0.7)\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"anomaly-rate",        required_argument, nullptr, 'A'},
+        {"overwrite",                 no_argument, nullptr, 'f'},
+        {"help",                      no_argument, nullptr, 'h'},
+        {"long-way-rate",       required_argument, nullptr, 'l'},
+        {"objects",             required_argument, nullptr, 'n'},
+        {"no-locations-on-ways",      no_argument, nullptr, 'L'},
+        {"quiet",                     no_argument, nullptr, 'q'},
+        {"seed",                required_argument, nullptr, 's'},
+        {"skew",                required_argument, nullptr, 'k'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "A:fhl:n:qs:k:", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'A':
+                options.anomaly_rate = parse_rate(optarg);
+                break;
+            case 'f':
+                options.overwrite = true;
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'l':
+                options.long_way_rate = parse_rate(optarg);
+                break;
+            case 'n':
+                options.objects = parse_count(optarg);
+                break;
+            case 'L':
+                options.locations_on_ways = false;
+                break;
+            case 'q':
+                options.verbose = false;
+                break;
+            case 's':
+                options.seed = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'k':
+                options.skew = parse_rate(optarg);
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args != 1) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS] OUTPUT-FILE\n"
+                  << "Call '" << program_name << " --help' for usage information.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string output_filename{argv[optind]};
+
+    vout << "Command line options:\n";
+    vout << "  Writing to file '" << output_filename << "'\n";
+    vout << "  Objects: " << options.objects << "\n";
+    vout << "  Seed: " << options.seed << "\n";
+    vout << "  Anomaly rate: " << options.anomaly_rate << "\n";
+    vout << "  Long way rate: " << options.long_way_rate << "\n";
+    vout << "  Skew: " << options.skew << "\n";
+    vout << "  Locations on ways: " << (options.locations_on_ways ? "yes" : "no") << "\n";
+
+    osmium::io::File output_file{output_filename};
+    if (options.locations_on_ways) {
+        output_file.set("locations_on_ways");
+    }
+
+    osmium::io::Header header;
+    header.set("generator", program_name);
+    header.set("odad_generator_seed", std::to_string(options.seed));
+
+    osmium::io::Writer writer{output_file, header, options.overwrite ? osmium::io::overwrite::allow : osmium::io::overwrite::no};
+
+    DataGenerator generator{options, writer};
+    generator.run(vout);
+
+    writer.close();
+
+    osmium::MemoryUsage memory_usage;
+    if (memory_usage.peak() != 0) {
+        vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
+    }
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+#  run-benchmarks.py [OPTIONS] BUILD-DIR WORK-DIR
+#
+#  Generates synthetic data files with odad-generate-data (if they are not
+#  there already), runs all odad-* programs on them and records wall time,
+#  peak RSS and throughput in a JSON file. If a baseline file is given, the
+#  results are compared against it and the script exits with return code 1
+#  if any program got slower or used more memory than allowed. A baseline
+#  file that doesn't exist is an error.
+#
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+# Programs taking the arguments OSM-FILE OUTPUT-DIR.
+PROGRAMS = [
+    'odad-find-colocated-nodes',
+    'odad-find-multipolygon-problems',
+    'odad-find-orphans',
+    'odad-find-relation-problems',
+    'odad-find-unusual-tags',
+    'odad-find-way-problems',
+    'odad-run-all',
+]
+
+# Variants of programs run with extra options. The name is used in the
+# results instead of the program name.
+VARIANTS = {
+    'odad-find-orphans-compressed': ['odad-find-orphans', '--index-type=compressed'],
+    'odad-find-unusual-tags-mmap': ['odad-find-unusual-tags', '--mmap-input'],
+    'odad-run-all-mmap': ['odad-run-all', '--mmap-input'],
+}
+
+SIZES = {
+    '1M': 1000000,
+    '10M': 10000000,
+    '100M': 100000000,
+}
+
+
+def find_program(build_dir, name):
+    for subdir in ('src', 'benchmarks', '.'):
+        path = os.path.join(build_dir, subdir, name)
+        if os.access(path, os.X_OK):
+            return path
+    sys.exit("Can not find program '{}' in build directory '{}'".format(name, build_dir))
+
+
+def run(command):
+    """Run command and return wall time in seconds and peak RSS in KBytes."""
+    start = time.monotonic()
+    with subprocess.Popen(command, stdout=subprocess.DEVNULL) as proc:
+        _, status, rusage = os.wait4(proc.pid, 0)
+        proc.returncode = os.waitstatus_to_exitcode(status)
+    elapsed = time.monotonic() - start
+    if proc.returncode != 0:
+        sys.exit("Command failed with return code {}: {}".format(proc.returncode, ' '.join(command)))
+    return elapsed, rusage.ru_maxrss
+
+
+def generate_data(args, size):
+    filename = os.path.join(args.work_dir, 'data-{}-{}.osm.pbf'.format(size, args.seed))
+    if not os.path.exists(filename):
+        print("Generating {} objects into '{}'...".format(size, filename), flush=True)
+        subprocess.run([find_program(args.build_dir, 'odad-generate-data'),
+                        '--quiet', '--seed', str(args.seed), '--objects', size,
+                        filename], check=True)
+    return filename
+
+
+def run_benchmarks(args):
+    results = []
+
+    for size in args.sizes:
+        input_file = generate_data(args, size)
+        for program in args.programs:
+            output_dir = os.path.join(args.work_dir, 'out-{}-{}'.format(program, size))
+            shutil.rmtree(output_dir, ignore_errors=True)
+            os.makedirs(output_dir)
+
+            print("Running {} on {} objects...".format(program, size), flush=True)
+            best = None
+            for _ in range(args.repeat):
+                command = VARIANTS.get(program, [program])
+                elapsed, peak_rss = run([find_program(args.build_dir, command[0])] + command[1:] +
+                                        ['--quiet', input_file, output_dir])
+                if best is None or elapsed < best[0]:
+                    best = (elapsed, peak_rss)
+
+            results.append({
+                'program': program,
+                'size': size,
+                'objects': SIZES[size],
+                'wall_time_s': round(best[0], 3),
+                'peak_rss_kb': best[1],
+                'objects_per_sec': int(SIZES[size] / best[0]) if best[0] > 0 else 0,
+            })
+            print("  {:.3f}s, {} KBytes peak RSS".format(best[0], best[1]), flush=True)
+
+    return {
+        'host': platform.node(),
+        'cpus': os.cpu_count(),
+        'date': time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime()),
+        'seed': args.seed,
+        'results': results,
+    }
+
+
+def compare(baseline, current, tolerance):
+    """Compare results against baseline, return number of regressions."""
+    base = {(r['program'], r['size']): r for r in baseline['results']}
+    regressions = 0
+
+    print("\n{:35} {:>5} {:>10} {:>10} {:>8} {:>12} {:>12} {:>8}".format(
+        'program', 'size', 'base s', 'now s', 'change', 'base KB', 'now KB', 'change'))
+    for result in current['results']:
+        key = (result['program'], result['size'])
+        if key not in base:
+            continue
+        old = base[key]
+        time_change = result['wall_time_s'] / old['wall_time_s'] - 1.0 if old['wall_time_s'] > 0 else 0.0
+        rss_change = result['peak_rss_kb'] / old['peak_rss_kb'] - 1.0 if old['peak_rss_kb'] > 0 else 0.0
+        marker = ''
+        if time_change > tolerance or rss_change > tolerance:
+            regressions += 1
+            marker = '  <-- REGRESSION'
+        print("{:35} {:>5} {:>10.3f} {:>10.3f} {:>+7.1f}% {:>12} {:>12} {:>+7.1f}%{}".format(
+            result['program'], result['size'],
+            old['wall_time_s'], result['wall_time_s'], time_change * 100,
+            old['peak_rss_kb'], result['peak_rss_kb'], rss_change * 100, marker))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run benchmarks for the odad-* programs.')
+    parser.add_argument('build_dir', metavar='BUILD-DIR', help='CMake build directory')
+    parser.add_argument('work_dir', metavar='WORK-DIR', help='directory for data files and program output')
+    parser.add_argument('-s', '--sizes', default='1M,10M',
+                        help='comma-separated list of input sizes out of {} (default: 1M,10M)'.format(','.join(SIZES)))
+    parser.add_argument('-p', '--programs', default=','.join(PROGRAMS + list(VARIANTS)),
+                        help='comma-separated list of programs to run, may include the variants {} (default: all programs and variants)'.format(','.join(VARIANTS)))
+    parser.add_argument('-r', '--repeat', type=int, default=1,
+                        help='run each program this many times and use the fastest run (default: 1)')
+    parser.add_argument('--seed', type=int, default=1, help='seed for the data generator (default: 1)')
+    parser.add_argument('-o', '--output', default='benchmark-results.json',
+                        help='write results to this file (default: benchmark-results.json)')
+    parser.add_argument('-b', '--baseline', help='compare results against this baseline file')
+    parser.add_argument('-t', '--tolerance', type=float, default=0.10,
+                        help='allowed relative increase in time and memory (default: 0.10)')
+    args = parser.parse_args()
+
+    args.sizes = args.sizes.split(',')
+    for size in args.sizes:
+        if size not in SIZES:
+            parser.error("unknown size '{}'".format(size))
+    args.programs = args.programs.split(',')
+
+    if args.baseline and not os.path.exists(args.baseline):
+        sys.exit("Baseline file '{}' not found. Run the benchmarks without --baseline and "
+                 "copy the results file there to create it.".format(args.baseline))
+
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    results = run_benchmarks(args)
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2)
+        f.write('\n')
+    print("Results written to '{}'.".format(args.output))
+
+    if not args.baseline:
+        print("\nWARNING: No baseline given, results were not compared.")
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    regressions = compare(baseline, results, args.tolerance)
+    if regressions:
+        print("\n{} regression(s) found.".format(regressions))
+        return 1
+    print("\nNo regressions found.")
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
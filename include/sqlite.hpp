@@ -217,6 +217,13 @@ namespace Sqlite {
             return sqlite3_column_int(m_statement, column);
         }
 
+        int64_t get_int64(int column) {
+            if (column >= column_count()) {
+                throw Sqlite::Exception{"Column larger than max columns", m_db.errmsg()};
+            }
+            return sqlite3_column_int64(m_statement, column);
+        }
+
     private:
 
         Database& m_db;
@@ -0,0 +1,280 @@
+#ifndef AREA_ASSEMBLY_HPP
+#define AREA_ASSEMBLY_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <osmium/area/assembler.hpp>
+#include <osmium/area/problem_reporter.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include "trace.hpp"
+
+/// Kinds of problems found by the area assembler we are interested in.
+enum class area_problem_type {
+    ring_not_closed,
+    self_intersection,
+    touching_ring,
+    wrong_role,
+    way_in_multiple_rings
+};
+
+struct area_problem {
+    area_problem_type type;
+    osmium::NodeRef location;
+};
+
+struct assemble_result {
+    std::vector<area_problem> problems;
+    bool success = false;
+};
+
+/**
+ * Problem reporter for the area assembler which collects the problems in
+ * a vector. Problems already found by other checks (duplicate nodes and
+ * ways, inner rings with the same tags as the relation) are ignored.
+ */
+class AreaProblemCollector : public osmium::area::ProblemReporter {
+
+    std::vector<area_problem>& m_problems;
+
+    void add(area_problem_type type, const osmium::NodeRef& location) {
+        m_problems.push_back(area_problem{type, location});
+    }
+
+public:
+
+    explicit AreaProblemCollector(std::vector<area_problem>& problems) :
+        m_problems(problems) {
+    }
+
+    void report_ring_not_closed(const osmium::NodeRef& nr, const osmium::Way* /*way*/) override {
+        add(area_problem_type::ring_not_closed, nr);
+    }
+
+    void report_intersection(osmium::object_id_type /*way1_id*/, osmium::Location /*way1_seg_start*/, osmium::Location /*way1_seg_end*/,
+                             osmium::object_id_type /*way2_id*/, osmium::Location /*way2_seg_start*/, osmium::Location /*way2_seg_end*/,
+                             osmium::Location intersection) override {
+        add(area_problem_type::self_intersection, osmium::NodeRef{0, intersection});
+    }
+
+    void report_duplicate_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& /*nr2*/) override {
+        add(area_problem_type::self_intersection, nr1);
+    }
+
+    void report_overlapping_segment(const osmium::NodeRef& nr1, const osmium::NodeRef& /*nr2*/) override {
+        add(area_problem_type::self_intersection, nr1);
+    }
+
+    void report_touching_ring(osmium::object_id_type node_id, osmium::Location location) override {
+        add(area_problem_type::touching_ring, osmium::NodeRef{node_id, location});
+    }
+
+    void report_role_should_be_outer(osmium::object_id_type /*way_id*/, osmium::Location seg_start, osmium::Location /*seg_end*/) override {
+        add(area_problem_type::wrong_role, osmium::NodeRef{0, seg_start});
+    }
+
+    void report_role_should_be_inner(osmium::object_id_type /*way_id*/, osmium::Location seg_start, osmium::Location /*seg_end*/) override {
+        add(area_problem_type::wrong_role, osmium::NodeRef{0, seg_start});
+    }
+
+    void report_way_in_multiple_rings(const osmium::Way& way) override {
+        if (!way.nodes().empty()) {
+            add(area_problem_type::way_in_multiple_rings, way.nodes().front());
+        }
+    }
+
+}; // class AreaProblemCollector
+
+/**
+ * Task for the thread pool running the area assembler on one relation.
+ * The buffer contains the relation followed by its member ways in the
+ * order of the way members in the relation. All members which are not
+ * ways must have their ref set to 0.
+ */
+class AssembleTask {
+
+    std::shared_ptr<osmium::memory::Buffer> m_buffer;
+
+public:
+
+    explicit AssembleTask(std::shared_ptr<osmium::memory::Buffer> buffer) :
+        m_buffer(std::move(buffer)) {
+    }
+
+    assemble_result operator()() const {
+        trace::Span span{"AssembleTask"};
+
+        assemble_result result;
+        AreaProblemCollector collector{result.problems};
+
+        osmium::area::AssemblerConfig config;
+        config.problem_reporter = &collector;
+        config.check_roles = true;
+        osmium::area::Assembler assembler{config};
+
+        auto it = m_buffer->begin();
+        const auto& relation = static_cast<const osmium::Relation&>(*it);
+        std::vector<const osmium::Way*> ways;
+        for (++it; it != m_buffer->end(); ++it) {
+            ways.push_back(static_cast<const osmium::Way*>(&*it));
+        }
+
+        osmium::memory::Buffer out_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+        result.success = assembler(relation, ways, out_buffer);
+
+        return result;
+    }
+
+}; // class AssembleTask
+
+/**
+ * Hands relations to the osmium thread pool where the areas are assembled
+ * and hands the results back to the callback in the calling thread. The
+ * results arrive in the order the tasks finish, not in order of the IDs.
+ *
+ * Only a few tasks are handed to the pool at any time, the others wait in
+ * a queue ordered by the number of nodes, so the largest relations (like
+ * big boundaries) are always started first and don't hold up the end of
+ * the program run. If the waiting relations use too much memory, submit()
+ * blocks until some tasks are done.
+ */
+class AssembleDispatcher {
+
+    // The largest amount of memory used by relations waiting for the pool.
+    constexpr static const std::size_t max_pending_bytes = 256UL * 1024UL * 1024UL;
+
+    using callback_type = std::function<void(const osmium::Relation&, const assemble_result&)>;
+
+    struct job {
+        std::shared_ptr<osmium::memory::Buffer> buffer;
+        std::size_t nodes;
+
+        friend bool operator<(const job& a, const job& b) noexcept {
+            return a.nodes < b.nodes;
+        }
+    };
+
+    struct running_job {
+        std::shared_ptr<osmium::memory::Buffer> buffer;
+        std::future<assemble_result> future;
+    };
+
+    callback_type m_callback;
+    osmium::thread::Pool& m_pool;
+    std::size_t m_max_in_flight;
+
+    // Heap of waiting jobs, largest first.
+    std::vector<job> m_pending;
+    std::size_t m_pending_bytes = 0;
+
+    std::deque<running_job> m_in_flight;
+
+    void finish(running_job& rj) {
+        const auto result = rj.future.get();
+        m_callback(rj.buffer->get<osmium::Relation>(0), result);
+    }
+
+    // Hand results of all finished tasks to the callback.
+    void collect_finished() {
+        auto it = m_in_flight.begin();
+        while (it != m_in_flight.end()) {
+            if (it->future.wait_for(std::chrono::seconds{0}) == std::future_status::ready) {
+                finish(*it);
+                it = m_in_flight.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void wait_for_oldest() {
+        trace::Span span{"wait_for_task"};
+        finish(m_in_flight.front());
+        m_in_flight.pop_front();
+    }
+
+    void start_pending() {
+        while (m_in_flight.size() < m_max_in_flight && !m_pending.empty()) {
+            std::pop_heap(m_pending.begin(), m_pending.end());
+            auto buffer = std::move(m_pending.back().buffer);
+            m_pending.pop_back();
+            m_pending_bytes -= buffer->committed();
+
+            auto future = m_pool.submit(AssembleTask{buffer});
+            m_in_flight.push_back(running_job{std::move(buffer), std::move(future)});
+        }
+    }
+
+public:
+
+    explicit AssembleDispatcher(callback_type callback) :
+        m_callback(std::move(callback)),
+        m_pool(osmium::thread::Pool::default_instance()),
+        m_max_in_flight(static_cast<std::size_t>(m_pool.num_threads()) * 2) {
+    }
+
+    /**
+     * Submit a relation (with its member ways, see AssembleTask) for
+     * assembly. The callback may be called from here for this or other
+     * relations.
+     */
+    void submit(std::shared_ptr<osmium::memory::Buffer> buffer, std::size_t nodes) {
+        m_pending_bytes += buffer->committed();
+        m_pending.push_back(job{std::move(buffer), nodes});
+        std::push_heap(m_pending.begin(), m_pending.end());
+
+        collect_finished();
+        start_pending();
+
+        while (m_pending_bytes > max_pending_bytes && !m_in_flight.empty()) {
+            wait_for_oldest();
+            start_pending();
+        }
+    }
+
+    /// Wait for all relations to be assembled.
+    void wait() {
+        start_pending();
+        while (!m_in_flight.empty()) {
+            wait_for_oldest();
+            start_pending();
+        }
+    }
+
+}; // class AssembleDispatcher
+
+#endif // AREA_ASSEMBLY_HPP
@@ -0,0 +1,355 @@
+#ifndef COLOCATED_NODES_HPP
+#define COLOCATED_NODES_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <osmium/handler.hpp>
+#include <osmium/index/id_set.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/memory_mapping.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include <gdalcpp.hpp>
+
+#include "utils.hpp"
+
+namespace colocated_nodes {
+
+static const char* const program_name = "odad-find-colocated-nodes";
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    Shard shard;
+    std::string exchange_dirname;
+    unsigned int exchange_timeout = shard::default_exchange_timeout_s;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t locations_with_colocated_nodes = 0;
+    uint64_t colocated_nodes = 0;
+    uint64_t ways_referencing_colocated_nodes = 0;
+    uint64_t relations_referencing_colocated_nodes = 0;
+};
+
+// must be a power of 2
+// must change build_filename() function if you change this
+constexpr const unsigned int num_buckets = 1U << 8U;
+
+inline std::string build_filename(const std::string& dirname, unsigned int n) {
+    static const char* lookup_hex = "0123456789abcdef";
+
+    std::string filename = dirname;
+    filename += "/locations_";
+    filename += lookup_hex[(n >> 4U) & 0xfU];
+    filename += lookup_hex[n & 0xfU];
+    filename += ".dat";
+
+    return filename;
+}
+
+class Bucket {
+
+    // maximum size of bucket before it gets flushed
+    constexpr static const int max_bucket_size = 512 * 1024;
+
+    std::vector<osmium::Location> m_data;
+
+    std::string m_filename;
+
+    int m_fd;
+
+public:
+
+    Bucket(const std::string& dirname, unsigned int n) :
+        m_filename(build_filename(dirname, n)),
+        m_fd(::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) { // NOLINT(hicpp-signed-bitwise)
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + m_filename + "'"};
+        }
+        m_data.reserve(max_bucket_size);
+    }
+
+    Bucket(const Bucket&) = delete;
+    Bucket& operator=(const Bucket&) = delete;
+
+    Bucket(Bucket&&) = default;
+    Bucket& operator=(Bucket&&) = default;
+
+    ~Bucket() {
+        try {
+            flush();
+        } catch (...) {
+            // ignore exceptions
+        }
+        ::close(m_fd);
+    }
+
+    void set(const osmium::Location& location) {
+        m_data.push_back(location);
+        if (m_data.size() == max_bucket_size) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (m_data.empty()) {
+            return;
+        }
+
+        trace::Span span{"Bucket::flush"};
+        const auto bytes = m_data.size() * sizeof(osmium::Location);
+        const auto length = ::write(m_fd, m_data.data(), bytes);
+        if (length != long(bytes)) { // NOLINT(google-runtime-int)
+            throw std::system_error{errno, std::system_category(), std::string{"can't write to file '"} + m_filename + "'"};
+        }
+
+        m_data.clear();
+    }
+
+}; // class Bucket
+
+/**
+ * Handler writing the locations of all nodes into the bucket files. With
+ * several shards only locations in this shard are written.
+ */
+class LocationExtractor : public osmium::handler::Handler {
+
+    std::vector<Bucket> m_buckets;
+    options_type m_options;
+
+public:
+
+    LocationExtractor(const std::string& directory, const options_type& options) :
+        m_options(options) {
+        m_buckets.reserve(num_buckets);
+        for (unsigned int i = 0; i < num_buckets; ++i) {
+            m_buckets.emplace_back(directory, i);
+        }
+    }
+
+    void node(const osmium::Node& node) {
+        if (node.timestamp() < m_options.before_time && m_options.shard.contains(node.location())) {
+            const auto bucket_num = static_cast<uint32_t>(node.location().x()) & (num_buckets - 1);
+            m_buckets[bucket_num].set(node.location());
+        }
+    }
+
+    void flush() {
+        for (auto& bucket : m_buckets) {
+            bucket.flush();
+        }
+    }
+
+}; // class LocationExtractor
+
+inline void extract_locations(const osmium::io::File& input_file, const std::string& directory, const options_type& options, PhaseTimer& timer) {
+    LocationExtractor extractor{directory, options};
+
+    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::node};
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
+        progress_bar.update(reader.offset());
+        timer.count(buffer);
+        osmium::apply(buffer, extractor);
+    }
+    progress_bar.done();
+    reader.close();
+
+    extractor.flush();
+}
+
+inline std::vector<osmium::Location> find_locations(const std::string& directory, PhaseTimer& timer) {
+    std::vector<osmium::Location> locations;
+
+    for (unsigned int i = 0; i < num_buckets; ++i) {
+        const auto filename = build_filename(directory, i);
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + filename + "'"};
+        }
+        const auto file_size = osmium::util::file_size(fd);
+
+        if (file_size > 0) {
+            osmium::util::TypedMemoryMapping<osmium::Location> m_mapping{file_size / sizeof(osmium::Location), osmium::util::MemoryMapping::mapping_mode::write_private, fd };
+            timer.add_objects(m_mapping.size());
+
+            std::sort(m_mapping.begin(), m_mapping.end());
+
+            auto it = m_mapping.begin();
+            while ((it = std::adjacent_find(it, m_mapping.end())) != m_mapping.end()) {
+                locations.push_back(*it);
+                ++it;
+                ++it;
+            }
+        }
+
+        ::close(fd);
+        ::unlink(filename.c_str());
+    }
+
+    std::sort(locations.begin(), locations.end());
+    const auto last = std::unique(locations.begin(), locations.end());
+    locations.erase(last, locations.end());
+
+    return locations;
+}
+
+/**
+ * Run ID for the exchange of the locations between shards. The locations
+ * found only depend on the --age/--before option.
+ */
+inline uint64_t exchange_run_id(const osmium::Timestamp& before_time) noexcept {
+    return static_cast<uint64_t>(before_time.seconds_since_epoch());
+}
+
+/**
+ * With several shards every shard only finds the locations in its shard.
+ * Exchange them with the other shards, so that every shard has all of
+ * them. The ways and relations are checked by ID, so they need to know
+ * about colocated nodes in all shards.
+ */
+inline std::vector<osmium::Location> exchange_locations(const std::vector<osmium::Location>& locations, const ShardExchange& exchange, osmium::util::VerboseOutput& vout) {
+    exchange.publish("colocated-locations", locations);
+
+    auto all_locations = exchange.collect<osmium::Location>("colocated-locations", vout);
+    std::sort(all_locations.begin(), all_locations.end());
+
+    return all_locations;
+}
+
+/**
+ * Handler writing out the colocated nodes and the ways and relations
+ * referencing them. Nodes are in the shard of their location, ways and
+ * relations in the shard of their ID.
+ */
+class CheckHandler : public HandlerWithDB {
+
+    stats_type m_stats;
+    gdalcpp::Layer m_layer_colocated_nodes;
+    osmium::io::Writer& m_writer;
+    const std::vector<osmium::Location>& m_locations;
+    Shard m_shard;
+    osmium::index::IdSetSmall<osmium::unsigned_object_id_type> m_node_ids;
+    bool m_nodes_done = false;
+
+public:
+
+    CheckHandler(const std::string& output_dirname, osmium::io::Writer& writer, const std::vector<osmium::Location>& locations, const Shard& shard = Shard{}) :
+        HandlerWithDB(output_dirname + "/geoms-colocated-nodes.db"),
+        m_layer_colocated_nodes(m_dataset, "colocated_nodes", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_writer(writer),
+        m_locations(locations),
+        m_shard(shard) {
+        m_layer_colocated_nodes.add_field("node_id", OFTReal, 12);
+        m_layer_colocated_nodes.add_field("timestamp", OFTString, 20);
+        m_stats.locations_with_colocated_nodes = std::count_if(locations.begin(), locations.end(), [&](const osmium::Location& location) {
+            return shard.contains(location);
+        });
+    }
+
+    void node(const osmium::Node& node) {
+        const auto r = std::equal_range(m_locations.begin(),
+                                        m_locations.end(), node.location());
+
+        if (r.first != r.second) {
+            m_node_ids.set(node.positive_id());
+            if (!m_shard.contains(node.location())) {
+                return;
+            }
+            ++m_stats.colocated_nodes;
+            m_writer(node);
+            gdalcpp::Feature feature{m_layer_colocated_nodes, m_factory.create_point(node.location())};
+            feature.set_field("node_id", static_cast<double>(node.id()));
+            const auto ts = node.timestamp().to_iso();
+            feature.set_field("timestamp", ts.c_str());
+            add_to_layer(feature);
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (!m_nodes_done) {
+            m_nodes_done = true;
+            m_node_ids.sort_unique();
+        }
+
+        if (!m_shard.contains(way)) {
+            return;
+        }
+
+        for (const auto& node_ref : way.nodes()) {
+            if (m_node_ids.get_binary_search(node_ref.positive_ref())) {
+                ++m_stats.ways_referencing_colocated_nodes;
+                m_writer(way);
+                break;
+            }
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        if (!m_shard.contains(relation)) {
+            return;
+        }
+
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::node && m_node_ids.get_binary_search(member.positive_ref())) {
+                ++m_stats.relations_referencing_colocated_nodes;
+                m_writer(relation);
+                break;
+            }
+        }
+    }
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class CheckHandler
+
+inline void add_stats(const stats_type& stats, std::function<void(const char*, uint64_t)>& add) {
+    add("locations_with_colocated_nodes", stats.locations_with_colocated_nodes);
+    add("colocated_nodes", stats.colocated_nodes);
+    add("ways_referencing_colocated_nodes", stats.ways_referencing_colocated_nodes);
+    add("relations_referencing_colocated_nodes", stats.relations_referencing_colocated_nodes);
+}
+
+} // namespace colocated_nodes
+
+#endif // COLOCATED_NODES_HPP
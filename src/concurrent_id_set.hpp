@@ -0,0 +1,197 @@
+#ifndef CONCURRENT_ID_SET_HPP
+#define CONCURRENT_ID_SET_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+/**
+ * Set of IDs stored as a bitmap, which can be filled from several threads
+ * at the same time. Like osmium::index::IdSetDense the bitmap is split into
+ * chunks which are only allocated when an ID in their range is set.
+ *
+ * Chunks are allocated lock-free (the loser of a race deletes its chunk)
+ * and bits are set with an atomic OR. Because most IDs are set many times
+ * (nodes shared between ways), the bit is checked first with a plain load,
+ * so the expensive atomic operation is only done when the bit changes.
+ *
+ * All set() calls must have finished (and the threads joined or their
+ * futures waited for) before get() is called from another thread.
+ */
+template <typename T>
+class ConcurrentIdSetDense {
+
+    // 2^22 IDs per chunk, 512 kBytes
+    constexpr static const std::size_t chunk_bits = 22;
+    constexpr static const std::size_t words_per_chunk = (std::size_t(1) << chunk_bits) / 64;
+
+    // Enough for IDs up to 2^40, the directory needs 2 MBytes.
+    constexpr static const std::size_t max_chunks = std::size_t(1) << 18U;
+
+    using word_type = std::atomic<uint64_t>;
+
+    std::unique_ptr<std::atomic<word_type*>[]> m_chunks;
+
+    static std::size_t chunk_id(T id) noexcept {
+        return static_cast<std::size_t>(id >> chunk_bits);
+    }
+
+    static std::size_t word_offset(T id) noexcept {
+        return static_cast<std::size_t>(id >> 6U) & (words_per_chunk - 1);
+    }
+
+    static uint64_t bit(T id) noexcept {
+        return uint64_t(1) << (id & 0x3fU);
+    }
+
+    word_type* get_or_create_chunk(std::size_t cid) {
+        word_type* chunk = m_chunks[cid].load(std::memory_order_acquire);
+        if (chunk) {
+            return chunk;
+        }
+
+        // value-initialization sets all words to zero
+        std::unique_ptr<word_type[]> new_chunk{new word_type[words_per_chunk]()};
+        if (m_chunks[cid].compare_exchange_strong(chunk, new_chunk.get(), std::memory_order_acq_rel)) {
+            return new_chunk.release();
+        }
+
+        // some other thread was faster, chunk now contains its pointer
+        return chunk;
+    }
+
+public:
+
+    // Can be filled from several threads at the same time.
+    constexpr static const bool concurrent = true;
+
+    ConcurrentIdSetDense() :
+        m_chunks(new std::atomic<word_type*>[max_chunks]()) {
+    }
+
+    ConcurrentIdSetDense(const ConcurrentIdSetDense&) = delete;
+    ConcurrentIdSetDense& operator=(const ConcurrentIdSetDense&) = delete;
+
+    ConcurrentIdSetDense(ConcurrentIdSetDense&&) noexcept = default;
+
+    ConcurrentIdSetDense& operator=(ConcurrentIdSetDense&& other) noexcept {
+        clear();
+        m_chunks = std::move(other.m_chunks);
+        return *this;
+    }
+
+    ~ConcurrentIdSetDense() {
+        clear();
+    }
+
+    /// Add the ID to the set. Can be called from several threads.
+    void set(T id) {
+        const auto cid = chunk_id(id);
+        if (cid >= max_chunks) {
+            throw std::out_of_range{"ID " + std::to_string(id) + " too large for index"};
+        }
+
+        word_type& word = get_or_create_chunk(cid)[word_offset(id)];
+        const auto b = bit(id);
+        if ((word.load(std::memory_order_relaxed) & b) == 0) {
+            word.fetch_or(b, std::memory_order_relaxed);
+        }
+    }
+
+    /// Add all IDs from first to last (inclusive). Can be called from several threads.
+    void set_range(T first, T last) {
+        for (; first <= last; ++first) {
+            set(first);
+        }
+    }
+
+    /// Nothing to do here, exists for compatibility with IdSetCompressed.
+    void optimize() noexcept {
+    }
+
+    /// Is the ID in the set?
+    bool get(T id) const noexcept {
+        const auto cid = chunk_id(id);
+        if (cid >= max_chunks) {
+            return false;
+        }
+
+        const word_type* chunk = m_chunks[cid].load(std::memory_order_acquire);
+        if (!chunk) {
+            return false;
+        }
+
+        return (chunk[word_offset(id)].load(std::memory_order_relaxed) & bit(id)) != 0;
+    }
+
+    /// The number of bytes used by this index.
+    std::size_t used_memory() const noexcept {
+        std::size_t size = max_chunks * sizeof(std::atomic<word_type*>);
+        if (m_chunks) {
+            for (std::size_t cid = 0; cid < max_chunks; ++cid) {
+                if (m_chunks[cid].load(std::memory_order_relaxed)) {
+                    size += words_per_chunk * sizeof(word_type);
+                }
+            }
+        }
+        return size;
+    }
+
+    /// The number of IDs in each chunk is 2^chunk_id_bits().
+    constexpr static std::size_t chunk_id_bits() noexcept {
+        return chunk_bits;
+    }
+
+    /**
+     * Call func(chunk_id, words) for all allocated chunks in order of
+     * their IDs. words points to the 2^chunk_id_bits()/64 words of the chunk.
+     * Not thread-safe.
+     */
+    template <typename TFunc>
+    void for_each_chunk(TFunc&& func) const {
+        for (std::size_t cid = 0; cid < max_chunks; ++cid) {
+            const word_type* chunk = m_chunks[cid].load(std::memory_order_acquire);
+            if (chunk) {
+                std::forward<TFunc>(func)(cid, chunk);
+            }
+        }
+    }
+
+    /// Remove all IDs from the set and free the memory. Not thread-safe.
+    void clear() noexcept {
+        if (!m_chunks) {
+            return;
+        }
+        for (std::size_t cid = 0; cid < max_chunks; ++cid) {
+            delete[] m_chunks[cid].exchange(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+}; // class ConcurrentIdSetDense
+
+#endif // CONCURRENT_ID_SET_HPP
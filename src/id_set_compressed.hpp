@@ -0,0 +1,582 @@
+#ifndef ID_SET_COMPRESSED_HPP
+#define ID_SET_COMPRESSED_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Compressed set of IDs in the style of "Roaring Bitmaps"
+ * (https://roaringbitmap.org/). The ID space is divided into blocks of
+ * 2^16 IDs. Each block that has at least one ID set gets a container
+ * which is either
+ *
+ * - an array of the sorted low 16 bits of the IDs (up to 4096 IDs),
+ * - a bitmap with 2^16 bits, or
+ * - a list of runs of consecutive IDs.
+ *
+ * While the set is filled, array containers are kept unsorted and only
+ * sorted when they get too large, so random inserts are cheap. Ranges of
+ * IDs (from set_range()) are added as runs, so a block filled with the
+ * consecutive node IDs of ways doesn't need a bitmap. Call
+ * optimize() after all IDs are set, it sorts all arrays and converts each
+ * container into its smallest representation. Lookups work before that,
+ * but they are slower.
+ *
+ * Unlike osmium::index::IdSetDense this doesn't allocate large chunks for
+ * sparse ID ranges, so it needs much less memory on extracts, and runs of
+ * IDs (which are common because way nodes are often numbered
+ * consecutively) are stored compactly.
+ *
+ * This class is not thread-safe. Fill several sets in different threads
+ * and merge() them.
+ */
+template <typename T>
+class IdSetCompressed {
+
+    class Container {
+
+    public:
+
+        enum class kind : uint8_t {
+            array  = 0,
+            bitmap = 1,
+            run    = 2
+        };
+
+        // Maximum number of entries in an array container. At this size
+        // array and bitmap containers use the same amount of memory.
+        constexpr static const std::size_t max_array_size = 4096;
+
+        constexpr static const std::size_t bitmap_words = (1U << 16U) / 64;
+
+        // Maximum number of runs in a run container. At this size run and
+        // bitmap containers use the same amount of memory.
+        constexpr static const std::size_t max_runs = bitmap_words * sizeof(uint64_t) / sizeof(std::pair<uint16_t, uint16_t>);
+
+    private:
+
+        kind m_kind = kind::array;
+        bool m_sorted = true;
+
+        // sorted (if m_sorted) low 16 bits of IDs in array containers
+        std::vector<uint16_t> m_array;
+
+        std::vector<uint64_t> m_bitmap;
+
+        // pairs of first and last value of each run
+        std::vector<std::pair<uint16_t, uint16_t>> m_runs;
+
+        static std::size_t count_bits(const uint64_t* words, std::size_t num) noexcept {
+            // Simple loop, the compiler vectorizes this where possible
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < num; ++i) {
+                count += static_cast<std::size_t>(__builtin_popcountll(words[i]));
+            }
+            return count;
+        }
+
+        void set_bitmap_range(uint32_t first, uint32_t last) noexcept {
+            const uint32_t first_word = first >> 6U;
+            const uint32_t last_word = last >> 6U;
+            const uint64_t first_mask = ~uint64_t(0) << (first & 63U);
+            const uint64_t last_mask = ~uint64_t(0) >> (63U - (last & 63U));
+
+            if (first_word == last_word) {
+                m_bitmap[first_word] |= first_mask & last_mask;
+                return;
+            }
+
+            m_bitmap[first_word] |= first_mask;
+            for (uint32_t w = first_word + 1; w < last_word; ++w) {
+                m_bitmap[w] = ~uint64_t(0);
+            }
+            m_bitmap[last_word] |= last_mask;
+        }
+
+        void normalize() {
+            if (!m_sorted) {
+                std::sort(m_array.begin(), m_array.end());
+                m_array.erase(std::unique(m_array.begin(), m_array.end()), m_array.end());
+                m_sorted = true;
+            }
+        }
+
+        // Add range to a run container, merging it with overlapping and
+        // adjacent runs.
+        void insert_run(uint16_t first, uint16_t last) {
+            // First run that ends at or after first - 1.
+            const auto it = std::lower_bound(m_runs.begin(), m_runs.end(), first, [](const std::pair<uint16_t, uint16_t>& run, uint16_t value) {
+                return uint32_t(run.second) + 1 < value;
+            });
+
+            auto end = it;
+            uint16_t new_first = first;
+            uint16_t new_last = last;
+            while (end != m_runs.end() && uint32_t(end->first) <= uint32_t(last) + 1) {
+                new_first = std::min(new_first, end->first);
+                new_last = std::max(new_last, end->second);
+                ++end;
+            }
+
+            if (it == end) {
+                m_runs.emplace(it, first, last);
+                if (m_runs.size() > max_runs) {
+                    to_bitmap();
+                }
+                return;
+            }
+
+            it->first = new_first;
+            it->second = new_last;
+            m_runs.erase(std::next(it), end);
+        }
+
+        std::size_t count_runs() const noexcept {
+            switch (m_kind) {
+                case kind::array: {
+                    std::size_t runs = m_array.empty() ? 0 : 1;
+                    for (std::size_t i = 1; i < m_array.size(); ++i) {
+                        if (m_array[i] != m_array[i - 1] + 1) {
+                            ++runs;
+                        }
+                    }
+                    return runs;
+                }
+                case kind::bitmap: {
+                    // A run starts at each bit that is set while the bit
+                    // before it is not set.
+                    std::size_t runs = 0;
+                    uint64_t carry = 0;
+                    for (const uint64_t word : m_bitmap) {
+                        runs += static_cast<std::size_t>(__builtin_popcountll(word & ~((word << 1U) | carry)));
+                        carry = word >> 63U;
+                    }
+                    return runs;
+                }
+                case kind::run:
+                    break;
+            }
+            return m_runs.size();
+        }
+
+        template <typename TFunc>
+        void for_each(TFunc&& func) const {
+            switch (m_kind) {
+                case kind::array:
+                    for (const auto value : m_array) {
+                        func(value);
+                    }
+                    break;
+                case kind::bitmap:
+                    for (std::size_t w = 0; w < bitmap_words; ++w) {
+                        uint64_t word = m_bitmap[w];
+                        while (word) {
+                            func(static_cast<uint16_t>(w * 64 + static_cast<std::size_t>(__builtin_ctzll(word))));
+                            word &= word - 1;
+                        }
+                    }
+                    break;
+                case kind::run:
+                    for (const auto& run : m_runs) {
+                        for (uint32_t value = run.first; value <= run.second; ++value) {
+                            func(static_cast<uint16_t>(value));
+                        }
+                    }
+                    break;
+            }
+        }
+
+        void to_bitmap() {
+            if (m_kind == kind::bitmap) {
+                return;
+            }
+
+            m_bitmap.assign(bitmap_words, 0);
+            if (m_kind == kind::array) {
+                for (const auto value : m_array) {
+                    m_bitmap[value >> 6U] |= uint64_t(1) << (value & 63U);
+                }
+                std::vector<uint16_t>{}.swap(m_array);
+                m_sorted = true;
+            } else {
+                for (const auto& run : m_runs) {
+                    set_bitmap_range(run.first, run.second);
+                }
+                std::vector<std::pair<uint16_t, uint16_t>>{}.swap(m_runs);
+            }
+            m_kind = kind::bitmap;
+        }
+
+        void to_array() {
+            std::vector<uint16_t> values;
+            values.reserve(cardinality());
+            for_each([&values](uint16_t value) {
+                values.push_back(value);
+            });
+            std::vector<uint64_t>{}.swap(m_bitmap);
+            std::vector<std::pair<uint16_t, uint16_t>>{}.swap(m_runs);
+            m_array = std::move(values);
+            m_sorted = true;
+            m_kind = kind::array;
+        }
+
+        void to_runs() {
+            std::vector<std::pair<uint16_t, uint16_t>> runs;
+            runs.reserve(count_runs());
+            for_each([&runs](uint16_t value) {
+                if (!runs.empty() && runs.back().second + 1 == value) {
+                    runs.back().second = value;
+                } else {
+                    runs.emplace_back(value, value);
+                }
+            });
+            std::vector<uint16_t>{}.swap(m_array);
+            std::vector<uint64_t>{}.swap(m_bitmap);
+            m_runs = std::move(runs);
+            m_sorted = true;
+            m_kind = kind::run;
+            if (m_runs.size() > max_runs) {
+                to_bitmap();
+            }
+        }
+
+    public:
+
+        kind get_kind() const noexcept {
+            return m_kind;
+        }
+
+        bool contains(uint16_t value) const noexcept {
+            switch (m_kind) {
+                case kind::array:
+                    if (m_sorted) {
+                        return std::binary_search(m_array.begin(), m_array.end(), value);
+                    }
+                    return std::find(m_array.begin(), m_array.end(), value) != m_array.end();
+                case kind::bitmap:
+                    return (m_bitmap[value >> 6U] >> (value & 63U)) & 1U;
+                case kind::run:
+                    break;
+            }
+
+            const auto it = std::upper_bound(m_runs.begin(), m_runs.end(), value, [](uint16_t v, const std::pair<uint16_t, uint16_t>& run) {
+                return v < run.first;
+            });
+            return it != m_runs.begin() && value <= std::prev(it)->second;
+        }
+
+        void add(uint16_t value) {
+            switch (m_kind) {
+                case kind::array:
+                    if (!m_array.empty() && value <= m_array.back()) {
+                        if (value == m_array.back()) {
+                            return;
+                        }
+                        m_sorted = false;
+                    }
+                    m_array.push_back(value);
+                    // Allow unsorted arrays to grow larger than the
+                    // maximum, because they can contain duplicates.
+                    if (m_array.size() > (m_sorted ? max_array_size : max_array_size * 2)) {
+                        normalize();
+                        if (m_array.size() > max_array_size) {
+                            to_bitmap();
+                        }
+                    }
+                    return;
+                case kind::bitmap:
+                    m_bitmap[value >> 6U] |= uint64_t(1) << (value & 63U);
+                    return;
+                case kind::run:
+                    break;
+            }
+
+            insert_run(value, value);
+        }
+
+        /**
+         * Add all values from first to last (inclusive). Longer ranges are
+         * added as runs unless the container is already a bitmap.
+         */
+        void add_range(uint16_t first, uint16_t last) {
+            switch (m_kind) {
+                case kind::array:
+                    if (last - first < 16) {
+                        for (uint32_t value = first; value <= last; ++value) {
+                            add(static_cast<uint16_t>(value));
+                        }
+                        return;
+                    }
+                    normalize();
+                    to_runs();
+                    if (m_kind != kind::run) {
+                        break;
+                    }
+                    insert_run(first, last);
+                    return;
+                case kind::bitmap:
+                    break;
+                case kind::run:
+                    insert_run(first, last);
+                    return;
+            }
+
+            set_bitmap_range(first, last);
+        }
+
+        /// Add all values from the other container.
+        void merge(const Container& other) {
+            if (m_kind == kind::bitmap && other.m_kind == kind::bitmap) {
+                // Simple loop, the compiler vectorizes this
+                uint64_t* __restrict__ dest = m_bitmap.data();
+                const uint64_t* __restrict__ src = other.m_bitmap.data();
+                for (std::size_t i = 0; i < bitmap_words; ++i) {
+                    dest[i] |= src[i];
+                }
+                return;
+            }
+
+            if (other.m_kind == kind::run) {
+                for (const auto& run : other.m_runs) {
+                    add_range(run.first, run.second);
+                }
+                return;
+            }
+
+            if (m_kind == kind::array && other.m_kind == kind::array && m_sorted && other.m_sorted) {
+                std::vector<uint16_t> values;
+                values.reserve(m_array.size() + other.m_array.size());
+                std::set_union(m_array.begin(), m_array.end(), other.m_array.begin(), other.m_array.end(), std::back_inserter(values));
+                m_array = std::move(values);
+                if (m_array.size() > max_array_size) {
+                    to_bitmap();
+                }
+                return;
+            }
+
+            if (other.m_kind == kind::bitmap) {
+                to_bitmap();
+                merge(other);
+                return;
+            }
+
+            for (const auto value : other.m_array) {
+                add(value);
+            }
+        }
+
+        std::size_t cardinality() const {
+            switch (m_kind) {
+                case kind::array:
+                    if (!m_sorted) {
+                        // Unsorted arrays can contain duplicates.
+                        std::vector<uint16_t> values{m_array};
+                        std::sort(values.begin(), values.end());
+                        return static_cast<std::size_t>(std::unique(values.begin(), values.end()) - values.begin());
+                    }
+                    return m_array.size();
+                case kind::bitmap:
+                    return count_bits(m_bitmap.data(), bitmap_words);
+                case kind::run:
+                    break;
+            }
+
+            std::size_t count = 0;
+            for (const auto& run : m_runs) {
+                count += static_cast<std::size_t>(run.second - run.first) + 1;
+            }
+            return count;
+        }
+
+        /// Convert into the representation that uses the least memory.
+        void optimize() {
+            normalize();
+
+            const std::size_t card = cardinality();
+            const std::size_t array_bytes = card <= max_array_size ? card * sizeof(uint16_t) : bitmap_words * sizeof(uint64_t) + 1;
+            const std::size_t bitmap_bytes = bitmap_words * sizeof(uint64_t);
+            const std::size_t run_bytes = count_runs() * sizeof(std::pair<uint16_t, uint16_t>);
+
+            if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+                if (m_kind != kind::run) {
+                    to_runs();
+                }
+            } else if (array_bytes <= bitmap_bytes) {
+                if (m_kind != kind::array) {
+                    to_array();
+                }
+            } else {
+                to_bitmap();
+            }
+
+            m_array.shrink_to_fit();
+            m_runs.shrink_to_fit();
+        }
+
+        std::size_t used_memory() const noexcept {
+            return sizeof(Container) +
+                   m_array.capacity() * sizeof(uint16_t) +
+                   m_bitmap.capacity() * sizeof(uint64_t) +
+                   m_runs.capacity() * sizeof(std::pair<uint16_t, uint16_t>);
+        }
+
+    }; // class Container
+
+    // One entry for each block of 2^16 IDs, nullptr if the block is empty.
+    std::vector<std::unique_ptr<Container>> m_containers;
+
+    static std::size_t block(T id) noexcept {
+        return static_cast<std::size_t>(id >> 16U);
+    }
+
+    static uint16_t low(T id) noexcept {
+        return static_cast<uint16_t>(id & 0xffffU);
+    }
+
+    Container& get_or_create(std::size_t b) {
+        if (b >= m_containers.size()) {
+            m_containers.resize(std::max(b + 1, m_containers.size() * 2));
+        }
+        if (!m_containers[b]) {
+            m_containers[b].reset(new Container{});
+        }
+        return *m_containers[b];
+    }
+
+public:
+
+    // Can not be filled from several threads at the same time.
+    constexpr static const bool concurrent = false;
+
+    IdSetCompressed() = default;
+
+    IdSetCompressed(const IdSetCompressed&) = delete;
+    IdSetCompressed& operator=(const IdSetCompressed&) = delete;
+
+    IdSetCompressed(IdSetCompressed&&) noexcept = default;
+    IdSetCompressed& operator=(IdSetCompressed&&) noexcept = default;
+
+    ~IdSetCompressed() noexcept = default;
+
+    /// Add the ID to the set.
+    void set(T id) {
+        get_or_create(block(id)).add(low(id));
+    }
+
+    /// Add all IDs from first to last (inclusive) to the set.
+    void set_range(T first, T last) {
+        while (block(first) != block(last)) {
+            const T block_last = first | 0xffffU;
+            get_or_create(block(first)).add_range(low(first), 0xffffU);
+            first = block_last + 1;
+        }
+        get_or_create(block(first)).add_range(low(first), low(last));
+    }
+
+    /// Is the ID in the set?
+    bool get(T id) const noexcept {
+        const auto b = block(id);
+        if (b >= m_containers.size() || !m_containers[b]) {
+            return false;
+        }
+        return m_containers[b]->contains(low(id));
+    }
+
+    /// Add all IDs from the other set to this set.
+    void merge(const IdSetCompressed& other) {
+        for (std::size_t b = 0; b < other.m_containers.size(); ++b) {
+            if (other.m_containers[b]) {
+                get_or_create(b).merge(*other.m_containers[b]);
+            }
+        }
+    }
+
+    /**
+     * Convert all containers into their most compact representation.
+     * Call this after all IDs are set for best lookup performance.
+     */
+    void optimize() {
+        for (auto& container : m_containers) {
+            if (container) {
+                container->optimize();
+            }
+        }
+    }
+
+    /**
+     * The number of IDs in the set. This is faster after optimize(),
+     * because it has to sort unsorted arrays otherwise.
+     */
+    std::size_t size() const {
+        std::size_t count = 0;
+        for (const auto& container : m_containers) {
+            if (container) {
+                count += container->cardinality();
+            }
+        }
+        return count;
+    }
+
+    bool empty() const noexcept {
+        // Containers are only created when an ID is added.
+        return std::none_of(m_containers.begin(), m_containers.end(), [](const std::unique_ptr<Container>& container) {
+            return bool(container);
+        });
+    }
+
+    /// The number of bytes used by this index.
+    std::size_t used_memory() const noexcept {
+        std::size_t size = m_containers.capacity() * sizeof(std::unique_ptr<Container>);
+        for (const auto& container : m_containers) {
+            if (container) {
+                size += container->used_memory();
+            }
+        }
+        return size;
+    }
+
+    /// Number of containers of each kind (array, bitmap, run).
+    std::vector<std::size_t> container_counts() const {
+        std::vector<std::size_t> counts(3);
+        for (const auto& container : m_containers) {
+            if (container) {
+                ++counts[static_cast<std::size_t>(container->get_kind())];
+            }
+        }
+        return counts;
+    }
+
+    /// Remove all IDs from the set and free the memory.
+    void clear() {
+        std::vector<std::unique_ptr<Container>>{}.swap(m_containers);
+    }
+
+}; // class IdSetCompressed
+
+#endif // ID_SET_COMPRESSED_HPP
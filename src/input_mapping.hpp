@@ -0,0 +1,147 @@
+#ifndef INPUT_MAPPING_HPP
+#define INPUT_MAPPING_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include "trace.hpp"
+
+/**
+ * Read-ahead for the input file using a memory mapping.
+ *
+ * The osmium::io::Reader reads the input file with read() in its own
+ * thread and hands the data to the decoding threads, there is no way to
+ * hand it pointers into a memory mapping instead. But with the file
+ * mapped, we can tell the kernel which parts of the file will be needed
+ * next (madvise(MADV_WILLNEED)), so they are read from disk in the
+ * background and the read() calls are served from the page cache. This
+ * keeps a window ahead of the current read position of the reader in the
+ * page cache.
+ *
+ * Call start() with the name of the input file. After that every
+ * read_traced() (see utils.hpp) on a reader for a file with the same size
+ * moves the window forward. If start() is not called, nothing happens.
+ */
+namespace input_mapping {
+
+    class Mapping {
+
+        // Keep this many bytes ahead of the reader...
+        constexpr static const std::size_t window_size = 128UL * 1024UL * 1024UL;
+
+        // ...and advise them in steps of this size.
+        constexpr static const std::size_t step_size = 32UL * 1024UL * 1024UL;
+
+        std::size_t m_size;
+        osmium::util::MemoryMapping m_mapping;
+        std::size_t m_advised_until = 0;
+        std::size_t m_last_offset = 0;
+
+        Mapping(std::size_t size, int fd) :
+            m_size(size),
+            m_mapping(size, osmium::util::MemoryMapping::mapping_mode::readonly, fd) {
+            ::close(fd);
+            ::madvise(m_mapping.get_addr(), m_size, MADV_SEQUENTIAL);
+        }
+
+    public:
+
+        /// Map the file and close the file descriptor.
+        explicit Mapping(int fd) :
+            Mapping(osmium::util::file_size(fd), fd) {
+        }
+
+        std::size_t size() const noexcept {
+            return m_size;
+        }
+
+        /// Called with the current read position in the file.
+        void advance(std::size_t offset) {
+            if (offset < m_last_offset) {
+                // The file is read again from the start.
+                m_advised_until = 0;
+            }
+            m_last_offset = offset;
+
+            if (m_advised_until >= m_size || m_advised_until >= offset + window_size - step_size) {
+                return;
+            }
+
+            trace::Span span{"readahead"};
+            const std::size_t page_size = osmium::util::get_pagesize();
+            const std::size_t start = std::max(m_advised_until, offset) / page_size * page_size;
+            const std::size_t end = std::min(offset + window_size, m_size);
+            ::madvise(m_mapping.get_addr<char>() + start, end - start, MADV_WILLNEED);
+            m_advised_until = end;
+        }
+
+    }; // class Mapping
+
+    namespace detail {
+
+        inline std::unique_ptr<Mapping>& mapping() {
+            static std::unique_ptr<Mapping> m;
+            return m;
+        }
+
+    } // namespace detail
+
+    /// Map the input file. Empty files are ignored.
+    inline void start(const std::string& filename) {
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open input file '"} + filename + "'"};
+        }
+        if (osmium::util::file_size(fd) == 0) {
+            ::close(fd);
+            return;
+        }
+        detail::mapping().reset(new Mapping{fd});
+    }
+
+    /**
+     * Called with the size of the file being read and the current read
+     * position. Does nothing if the file is not the one mapped.
+     */
+    inline void advance(std::size_t file_size, std::size_t offset) {
+        auto& m = detail::mapping();
+        if (m && m->size() == file_size) {
+            m->advance(offset);
+        }
+    }
+
+} // namespace input_mapping
+
+#endif // INPUT_MAPPING_HPP
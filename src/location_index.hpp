@@ -0,0 +1,285 @@
+#ifndef LOCATION_INDEX_HPP
+#define LOCATION_INDEX_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/index/map/all.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/visitor.hpp>
+
+#include "ref_index.hpp"
+#include "trace.hpp"
+
+/**
+ * Lock on the file FILE.lock next to an index file, see LocationIndex.
+ * Does nothing if there is no index file. The lock is released when this
+ * object is destroyed.
+ */
+class IndexFileLock {
+
+    std::string m_filename;
+    int m_fd = -1;
+
+    void lock(int operation) {
+        while (::flock(m_fd, operation) != 0) {
+            if (errno != EINTR) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't lock file '"} + m_filename + "'"};
+            }
+        }
+    }
+
+public:
+
+    explicit IndexFileLock(const std::string& index_filename) {
+        if (index_filename.empty()) {
+            return;
+        }
+        m_filename = index_filename + ".lock";
+        m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644); // NOLINT(hicpp-signed-bitwise)
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + m_filename + "'"};
+        }
+    }
+
+    IndexFileLock(const IndexFileLock&) = delete;
+    IndexFileLock& operator=(const IndexFileLock&) = delete;
+
+    ~IndexFileLock() {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    /// Get shared lock (waits while another program has an exclusive lock).
+    void shared() {
+        if (m_fd >= 0) {
+            lock(LOCK_SH);
+        }
+    }
+
+    /**
+     * Get exclusive lock. A shared lock held is released first, so that
+     * two programs trying this at the same time don't wait for each other.
+     */
+    void exclusive() {
+        if (m_fd >= 0) {
+            ::flock(m_fd, LOCK_UN);
+            lock(LOCK_EX);
+        }
+    }
+
+}; // class IndexFileLock
+
+/**
+ * Index of node locations used to add locations to ways when the input
+ * file doesn't have locations on ways. The index type is one of the
+ * libosmium map types, for instance "flex_mem", "dense_mmap_array", or
+ * "sparse_file_array,FILE".
+ *
+ * Index types stored in a file (dense_file_array and sparse_file_array)
+ * can be shared between programs run on the same input file: When the
+ * index is complete, the fingerprint of the input file (see ref_index.hpp)
+ * is written to FILE.source. If that file is there and matches the input
+ * file, the index is used as it is and nodes don't have to be read again.
+ * Otherwise the index file is truncated and filled again.
+ *
+ * Programs running at the same time coordinate through a lock on
+ * FILE.lock: A program filling the index holds an exclusive lock until
+ * the index is complete, programs using it hold a shared lock. So the
+ * index is never truncated while another program uses it, and a program
+ * started while the index is filled waits until it is complete.
+ *
+ * The input file must be sorted (nodes before ways) so that the index can
+ * be filled while reading the same file the ways come from.
+ */
+class LocationIndex {
+
+    using map_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+    std::string m_filename;
+    ref_index::fingerprint m_source;
+    IndexFileLock m_lock;
+    bool m_complete;
+    std::unique_ptr<map_type> m_index;
+    osmium::handler::NodeLocationsForWays<map_type> m_handler;
+
+    static std::string index_filename(const std::string& type) {
+        const auto pos = type.find(',');
+        if (pos == std::string::npos) {
+            return "";
+        }
+        return type.substr(pos + 1);
+    }
+
+    static ref_index::fingerprint read_source(const std::string& filename) {
+        ref_index::fingerprint fp;
+        std::ifstream file{filename + ".source", std::ios::binary};
+        if (!file.read(reinterpret_cast<char*>(&fp), sizeof(fp))) {
+            return ref_index::fingerprint{};
+        }
+        return fp;
+    }
+
+    /**
+     * Check whether a complete index for the input file is in the file
+     * and get a shared lock on it. If not, get an exclusive lock and
+     * truncate the file so it can be filled again.
+     */
+    static bool check_file(const std::string& filename, const ref_index::fingerprint& source, IndexFileLock& lock) {
+        if (filename.empty()) {
+            return false;
+        }
+
+        lock.shared();
+        if (read_source(filename) == source) {
+            return true;
+        }
+
+        lock.exclusive();
+
+        // Another program might have completed the index while we waited
+        // for the lock.
+        if (read_source(filename) == source) {
+            lock.shared();
+            return true;
+        }
+
+        std::remove((filename + ".source").c_str());
+        const int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open location index file '"} + filename + "'"};
+        }
+        ::close(fd);
+
+        return false;
+    }
+
+    static std::unique_ptr<map_type> create_map(const std::string& type) {
+        const auto& factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+        const std::string name{type.substr(0, type.find(','))};
+        if (!factory.has_map_type(name)) {
+            std::string message{"Unknown location index type '" + name + "'. Available types:"};
+            for (const auto& t : factory.map_types()) {
+                message += ' ';
+                message += t;
+            }
+            throw std::runtime_error{message};
+        }
+        return factory.create_map(type);
+    }
+
+public:
+
+    LocationIndex(const std::string& type, const std::string& input_filename) :
+        m_filename(index_filename(type)),
+        m_source(m_filename.empty() ? ref_index::fingerprint{} : ref_index::source_fingerprint(input_filename)),
+        m_lock(m_filename),
+        m_complete(check_file(m_filename, m_source, m_lock)),
+        m_index(create_map(type)),
+        m_handler(*m_index) {
+        m_handler.ignore_errors();
+    }
+
+    /// Was a complete index found in the index file?
+    bool complete() const noexcept {
+        return m_complete;
+    }
+
+    /**
+     * The object types that must be read from the input file if the
+     * program needs the types in bits.
+     */
+    osmium::osm_entity_bits::type entity_bits(osmium::osm_entity_bits::type bits) const noexcept {
+        if (m_complete || !(bits & osmium::osm_entity_bits::way)) {
+            return bits;
+        }
+        return bits | osmium::osm_entity_bits::node;
+    }
+
+    /**
+     * Add the locations of all nodes in the buffer to the index and add
+     * locations to all ways in the buffer. Nodes are not added if the
+     * index is complete.
+     */
+    void add_locations(osmium::memory::Buffer& buffer) {
+        trace::Span span{"add_locations"};
+        if (m_complete) {
+            for (auto& way : buffer.select<osmium::Way>()) {
+                m_handler.way(way);
+            }
+        } else {
+            osmium::apply(buffer, m_handler);
+        }
+    }
+
+    /**
+     * Call after all nodes have been read. If the index is in a file it
+     * can then be used by other programs.
+     */
+    void finish() {
+        if (m_complete) {
+            return;
+        }
+        m_complete = true;
+        m_index->sort();
+
+        if (!m_filename.empty()) {
+            const std::string source_filename{m_filename + ".source"};
+            std::ofstream file{source_filename, std::ios::binary};
+            file.write(reinterpret_cast<const char*>(&m_source), sizeof(m_source));
+            file.close();
+            if (!file) {
+                throw std::runtime_error{"Can't write file '" + source_filename + "'"};
+            }
+
+            // Let other programs waiting for the index use it.
+            m_lock.shared();
+        }
+    }
+
+    /// Memory used by the index (not counting memory mapped files).
+    std::size_t used_memory() const {
+        return m_index->used_memory();
+    }
+
+}; // class LocationIndex
+
+#endif // LOCATION_INDEX_HPP
@@ -0,0 +1,263 @@
+#ifndef MEMBER_INDEX_HPP
+#define MEMBER_INDEX_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+#include "varint.hpp"
+
+/**
+ * Entry in the index from members to the relations they are in and the
+ * outputs those relations were added to.
+ */
+class member_entry {
+
+    constexpr static const unsigned int output_shift = 48U;
+
+    osmium::unsigned_object_id_type m_member_id;
+    uint64_t m_output_and_relation;
+
+public:
+
+    member_entry(osmium::unsigned_object_id_type member_id, std::size_t output, osmium::unsigned_object_id_type relation_id) noexcept :
+        m_member_id(member_id),
+        m_output_and_relation((static_cast<uint64_t>(output) << output_shift) | relation_id) {
+    }
+
+    osmium::unsigned_object_id_type member_id() const noexcept {
+        return m_member_id;
+    }
+
+    std::size_t output() const noexcept {
+        return static_cast<std::size_t>(m_output_and_relation >> output_shift);
+    }
+
+    osmium::unsigned_object_id_type relation_id() const noexcept {
+        return m_output_and_relation & ((uint64_t(1) << output_shift) - 1);
+    }
+
+    friend bool operator<(const member_entry& a, const member_entry& b) noexcept {
+        return std::tie(a.m_member_id, a.m_output_and_relation) < std::tie(b.m_member_id, b.m_output_and_relation);
+    }
+
+}; // class member_entry
+
+/**
+ * Append-only list of (member ID, relation ID) pairs. The IDs are stored
+ * as varint encoded differences to the previous pair. Members of the same
+ * relation are added one after the other, so the relation ID difference
+ * is nearly always 0 and needs only one byte.
+ */
+class MemberList {
+
+    std::vector<unsigned char> m_data;
+    int64_t m_last_member_id = 0;
+    int64_t m_last_relation_id = 0;
+    std::size_t m_size = 0;
+
+public:
+
+    void add(osmium::unsigned_object_id_type member_id, osmium::unsigned_object_id_type relation_id) {
+        const auto mid = static_cast<int64_t>(member_id);
+        const auto rid = static_cast<int64_t>(relation_id);
+        varint::append(m_data, varint::zigzag(rid - m_last_relation_id));
+        varint::append(m_data, varint::zigzag(mid - m_last_member_id));
+        m_last_member_id = mid;
+        m_last_relation_id = rid;
+        ++m_size;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_data.capacity();
+    }
+
+    /// Call func(member_id, relation_id) for all pairs in the list.
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        const unsigned char* ptr = m_data.data();
+        const unsigned char* const end = ptr + m_data.size();
+        int64_t mid = 0;
+        int64_t rid = 0;
+        while (ptr != end) {
+            rid += varint::unzigzag(varint::decode(&ptr));
+            mid += varint::unzigzag(varint::decode(&ptr));
+            std::forward<TFunc>(func)(static_cast<osmium::unsigned_object_id_type>(mid), static_cast<osmium::unsigned_object_id_type>(rid));
+        }
+    }
+
+    void clear() {
+        std::vector<unsigned char>{}.swap(m_data);
+        m_last_member_id = 0;
+        m_last_relation_id = 0;
+        m_size = 0;
+    }
+
+}; // class MemberList
+
+/**
+ * Read-only index of member entries sorted by member ID.
+ *
+ * The entries are split into blocks of about block_entries entries. All
+ * entries of a member ID are always in the same block. For each block the
+ * first member ID and the offset of the block in the data are kept in a
+ * small skip index, the entries themselves are delta and varint encoded:
+ *
+ * - difference of the member ID to the previous entry
+ * - output
+ * - relation ID, as difference to the previous entry if member ID and
+ *   output are the same, otherwise the full ID
+ *
+ * This typically needs 4 to 6 bytes per entry instead of 16.
+ */
+class MemberIndex {
+
+    constexpr static const std::size_t block_entries = 64;
+
+    struct block_info {
+        osmium::unsigned_object_id_type first_member_id;
+        std::size_t offset;
+    };
+
+    std::vector<block_info> m_blocks;
+    std::vector<unsigned char> m_data;
+    std::size_t m_size = 0;
+    osmium::unsigned_object_id_type m_last_member_id = 0;
+
+public:
+
+    MemberIndex() = default;
+
+    /// Create index from entries which must be sorted.
+    explicit MemberIndex(const std::vector<member_entry>& entries) :
+        m_size(entries.size()) {
+        std::size_t in_block = 0;
+        osmium::unsigned_object_id_type last_member = 0;
+        std::size_t last_output = 0;
+        osmium::unsigned_object_id_type last_relation = 0;
+
+        for (const auto& entry : entries) {
+            const bool same_member = !m_blocks.empty() && entry.member_id() == last_member;
+            if (!same_member && (m_blocks.empty() || in_block >= block_entries)) {
+                m_blocks.push_back(block_info{entry.member_id(), m_data.size()});
+                in_block = 0;
+                last_member = entry.member_id();
+            }
+
+            varint::append(m_data, entry.member_id() - last_member);
+            varint::append(m_data, entry.output());
+            if (same_member && entry.output() == last_output) {
+                varint::append(m_data, entry.relation_id() - last_relation);
+            } else {
+                varint::append(m_data, entry.relation_id());
+            }
+
+            last_member = entry.member_id();
+            last_output = entry.output();
+            last_relation = entry.relation_id();
+            ++in_block;
+        }
+
+        if (!entries.empty()) {
+            m_last_member_id = entries.back().member_id();
+        }
+
+        m_blocks.shrink_to_fit();
+        m_data.shrink_to_fit();
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    /// The number of entries in the index.
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    /// The largest member ID in the index. Only valid if not empty.
+    osmium::unsigned_object_id_type last_member_id() const noexcept {
+        return m_last_member_id;
+    }
+
+    std::size_t used_memory() const noexcept {
+        return m_blocks.capacity() * sizeof(block_info) + m_data.capacity();
+    }
+
+    /**
+     * Find all entries for the member ID. They are stored in out (which is
+     * cleared first) in sorted order.
+     */
+    void find(osmium::unsigned_object_id_type member_id, std::vector<member_entry>& out) const {
+        out.clear();
+
+        auto it = std::upper_bound(m_blocks.begin(), m_blocks.end(), member_id, [](osmium::unsigned_object_id_type id, const block_info& block) {
+            return id < block.first_member_id;
+        });
+        if (it == m_blocks.begin()) {
+            return;
+        }
+        --it;
+
+        const unsigned char* ptr = m_data.data() + it->offset;
+        const unsigned char* const end = m_data.data() + (std::next(it) == m_blocks.end() ? m_data.size() : std::next(it)->offset);
+
+        osmium::unsigned_object_id_type mid = it->first_member_id;
+        std::size_t last_output = 0;
+        osmium::unsigned_object_id_type rid = 0;
+        bool first = true;
+        while (ptr != end) {
+            const auto delta = varint::decode(&ptr);
+            mid += delta;
+            if (mid > member_id) {
+                return;
+            }
+            const auto output = static_cast<std::size_t>(varint::decode(&ptr));
+            const auto relation = varint::decode(&ptr);
+            if (!first && delta == 0 && output == last_output) {
+                rid += relation;
+            } else {
+                rid = relation;
+            }
+            first = false;
+            last_output = output;
+            if (mid == member_id) {
+                out.emplace_back(mid, output, rid);
+            }
+        }
+    }
+
+}; // class MemberIndex
+
+#endif // MEMBER_INDEX_HPP
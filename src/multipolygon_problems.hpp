@@ -0,0 +1,633 @@
+#ifndef MULTIPOLYGON_PROBLEMS_HPP
+#define MULTIPOLYGON_PROBLEMS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/index/id_set.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/storage/item_stash.hpp>
+#include <osmium/tags/taglist.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include "area_assembly.hpp"
+#include "outputs.hpp"
+#include "tag_fingerprint.hpp"
+#include "tag_classifier.hpp"
+#include "utils.hpp"
+
+namespace multipolygon_problems {
+
+static const char* const program_name = "odad-find-multipolygon-problems";
+
+/// IDs of the outputs, same order as in the output_definitions table.
+enum output_id : std::size_t {
+    multipolygon_relations_with_same_tags,
+    multipolygon_open_ring,
+    boundary_open_ring,
+    area_ring_not_closed,
+    area_self_intersection,
+    area_touching_ring,
+    area_wrong_role,
+    area_way_in_multiple_rings,
+    num_outputs
+};
+
+static const output_definition output_definitions[] = {
+    {"multipolygon_relations_with_same_tags", false, true},
+    {"multipolygon_open_ring", true, true},
+    {"boundary_open_ring", true, true},
+    {"area_ring_not_closed", true, true},
+    {"area_self_intersection", true, true},
+    {"area_touching_ring", true, true},
+    {"area_wrong_role", true, true},
+    {"area_way_in_multiple_rings", true, true},
+};
+
+static_assert(sizeof(output_definitions) / sizeof(output_definition) == num_outputs, "output_definitions must have one entry for each output_id");
+
+struct options_type {
+    bool verbose = true;
+    bool assemble = false;
+    std::size_t output_memory = OutputMultiplexer::default_memory_limit_mb;
+    std::string location_index;
+    Shard shard;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t multipolygon_relations = 0;
+    uint64_t boundary_relations = 0;
+    uint64_t multipolygon_relations_without_tags = 0;
+    uint64_t multipolygon_relation_members = 0;
+    uint64_t multipolygon_relation_way_members = 0;
+    uint64_t multipolygon_relation_members_with_same_tags = 0;
+    uint64_t area_relations_assembled = 0;
+    uint64_t area_relations_not_assembled = 0;
+};
+
+/**
+ * Matches all tags except those with keys that don't say anything about
+ * what an object is. It has no state, so it is cheap to copy.
+ */
+struct MPFilter {
+
+    bool operator()(const osmium::Tag& tag) const noexcept {
+        static const KeyClassifier ignored_keys{"type", "created_by", "source", "note"};
+        return !ignored_keys.contains(tag.key());
+    }
+
+}; // struct MPFilter
+
+/**
+ * Collects multipolygon and boundary relations and their member ways and
+ * checks each relation once all its member ways are available.
+ *
+ * This works like an osmium::relations::RelationsManager, but instead of
+ * complete copies of the member ways only the data needed for the checks
+ * is kept: the first and last node of the way, a fingerprint of the
+ * filtered tags, and the filtered tags themselves if there are any. Most
+ * member ways have no tags and many nodes, so this needs only a fraction
+ * of the memory.
+ *
+ * In the first pass call relation() (for instance through osmium::apply)
+ * for all relations, then call prepare_for_lookup() and in the second pass
+ * use the handler returned from handler() for all ways. Call close() after
+ * the second pass.
+ *
+ * If the assemble option is set, complete copies of the member ways are
+ * kept, too, and all complete relations are handed to an
+ * AssembleDispatcher which runs the area assembler on them in the thread
+ * pool.
+ */
+class CheckMPManager : public osmium::handler::Handler {
+
+    constexpr static const std::size_t invalid = std::numeric_limits<std::size_t>::max();
+
+    // What we need to know about a member way.
+    struct member_way {
+        osmium::NodeRef first{};
+        osmium::NodeRef last{};
+        uint64_t fingerprint = 0;
+        osmium::ItemStash::handle_type tags{};
+
+        // Complete way, only used when assembling areas.
+        osmium::ItemStash::handle_type way{};
+
+        // The number of relation members referring to this way which are
+        // not completed yet.
+        std::size_t refs = 0;
+
+        bool has_ends = false;
+    };
+
+    // One entry for each way member of each relation.
+    struct way_member {
+        osmium::object_id_type way_id;
+        std::size_t relation;
+        std::size_t way;
+    };
+
+    struct relation_data {
+        osmium::ItemStash::handle_type handle;
+        std::size_t pending;
+    };
+
+    // Problems found by the area assembler for one relation.
+    struct area_result {
+        osmium::unsigned_object_id_type id;
+        std::size_t offset;
+        std::vector<area_problem> problems;
+    };
+
+    class SecondPassHandler : public osmium::handler::Handler {
+
+        CheckMPManager& m_manager;
+
+    public:
+
+        explicit SecondPassHandler(CheckMPManager& manager) noexcept :
+            m_manager(manager) {
+        }
+
+        void way(const osmium::Way& way) {
+            m_manager.add_way(way);
+        }
+
+    }; // class SecondPassHandler
+
+    Outputs& m_outputs;
+    options_type m_options;
+    stats_type m_stats;
+    MPFilter m_filter;
+    SecondPassHandler m_handler{*this};
+
+    // Relations and the filtered tags of member ways.
+    osmium::ItemStash m_stash;
+
+    // Used to build the list of filtered tags before it goes into the stash.
+    osmium::memory::Buffer m_tags_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+
+    std::vector<relation_data> m_relations;
+
+    // Sorted by way ID and relation after prepare_for_lookup().
+    std::vector<way_member> m_way_members;
+
+    std::vector<member_way> m_member_ways;
+
+    // Unused entries in m_member_ways.
+    std::vector<std::size_t> m_free_member_ways;
+
+    // Ends of all member ways of the relation currently checked, reused
+    // for all relations.
+    std::vector<osmium::NodeRef> m_endpoints;
+
+    std::unique_ptr<AssembleDispatcher> m_dispatcher;
+
+    // Relations with problems found by the area assembler and the
+    // problems. The results come back from the thread pool in any order,
+    // they are written out sorted by relation ID after all are done.
+    osmium::memory::Buffer m_area_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    std::vector<area_result> m_area_results;
+
+    static bool is_multipolygon(const osmium::Relation& relation) noexcept {
+        return relation.tags().has_tag("type", "multipolygon");
+    }
+
+    std::vector<way_member>::iterator find_way_members(osmium::object_id_type way_id) {
+        return std::lower_bound(m_way_members.begin(), m_way_members.end(), way_id, [](const way_member& m, osmium::object_id_type id) {
+            return m.way_id < id;
+        });
+    }
+
+    const member_way& get_member_way(osmium::object_id_type way_id, std::size_t relation) const {
+        const auto it = std::lower_bound(m_way_members.cbegin(), m_way_members.cend(), std::make_pair(way_id, relation), [](const way_member& m, const std::pair<osmium::object_id_type, std::size_t>& p) {
+            return std::make_pair(m.way_id, m.relation) < p;
+        });
+        return m_member_ways[it->way];
+    }
+
+    std::size_t new_member_way(const osmium::Way& way) {
+        std::size_t pos;
+        if (m_free_member_ways.empty()) {
+            pos = m_member_ways.size();
+            m_member_ways.emplace_back();
+        } else {
+            pos = m_free_member_ways.back();
+            m_free_member_ways.pop_back();
+            m_member_ways[pos] = member_way{};
+        }
+
+        auto& mw = m_member_ways[pos];
+        const auto& nodes = way.nodes();
+        if (nodes.size() >= 2) {
+            mw.first = nodes.front();
+            mw.last = nodes.back();
+            mw.has_ends = true;
+        }
+
+        mw.fingerprint = tag_fingerprint::of(way.tags(), m_filter);
+        if (osmium::tags::match_any_of(way.tags(), m_filter)) {
+            {
+                osmium::builder::TagListBuilder builder{m_tags_buffer};
+                for (const auto& tag : way.tags()) {
+                    if (m_filter(tag)) {
+                        builder.add_tag(tag);
+                    }
+                }
+            }
+            m_tags_buffer.commit();
+            mw.tags = m_stash.add_item(m_tags_buffer.get<osmium::TagList>(0));
+            m_tags_buffer.clear();
+        }
+
+        if (m_dispatcher) {
+            mw.way = m_stash.add_item(way);
+        }
+
+        return pos;
+    }
+
+    void add_way(const osmium::Way& way) {
+        auto it = find_way_members(way.id());
+        if (it == m_way_members.end() || it->way_id != way.id() || it->way != invalid) {
+            return;
+        }
+
+        const auto pos = new_member_way(way);
+        for (; it != m_way_members.end() && it->way_id == way.id(); ++it) {
+            it->way = pos;
+            ++m_member_ways[pos].refs;
+        }
+
+        it = find_way_members(way.id());
+        for (; it != m_way_members.end() && it->way_id == way.id(); ++it) {
+            auto& rel = m_relations[it->relation];
+            if (--rel.pending == 0) {
+                complete(it->relation);
+            }
+        }
+    }
+
+    // Check the relation and remove it and all member ways not needed
+    // any more.
+    void complete(std::size_t pos) {
+        const auto& relation = m_stash.get<osmium::Relation>(m_relations[pos].handle);
+
+        complete_relation(relation, pos);
+        if (m_dispatcher) {
+            assemble(relation, pos);
+        }
+
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::way) {
+                const auto it = std::lower_bound(m_way_members.cbegin(), m_way_members.cend(), std::make_pair(member.ref(), pos), [](const way_member& m, const std::pair<osmium::object_id_type, std::size_t>& p) {
+                    return std::make_pair(m.way_id, m.relation) < p;
+                });
+                auto& mw = m_member_ways[it->way];
+                if (--mw.refs == 0) {
+                    if (mw.tags.valid()) {
+                        m_stash.remove_item(mw.tags);
+                    }
+                    if (mw.way.valid()) {
+                        m_stash.remove_item(mw.way);
+                    }
+                    m_free_member_ways.push_back(it->way);
+                }
+            }
+        }
+
+        m_stash.remove_item(m_relations[pos].handle);
+    }
+
+    // Copy the relation and its member ways into a buffer and hand it to
+    // the dispatcher.
+    void assemble(const osmium::Relation& relation, std::size_t pos) {
+        auto buffer = std::make_shared<osmium::memory::Buffer>(relation.byte_size() + 1024, osmium::memory::Buffer::auto_grow::yes);
+
+        buffer->add_item(relation);
+        buffer->commit();
+        for (auto& member : buffer->get<osmium::Relation>(0).members()) {
+            if (member.type() != osmium::item_type::way) {
+                member.set_ref(0);
+            }
+        }
+
+        std::size_t nodes = 0;
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::way) {
+                const auto& way = m_stash.get<osmium::Way>(get_member_way(member.ref(), pos).way);
+                nodes += way.nodes().size();
+                buffer->add_item(way);
+                buffer->commit();
+            }
+        }
+
+        m_dispatcher->submit(std::move(buffer), nodes);
+    }
+
+    // Called with the result of the area assembler for each relation.
+    void assembled(const osmium::Relation& relation, const assemble_result& result) {
+        if (result.success) {
+            ++m_stats.area_relations_assembled;
+        } else {
+            ++m_stats.area_relations_not_assembled;
+        }
+
+        if (!result.problems.empty()) {
+            m_area_results.push_back(area_result{relation.positive_id(), m_area_buffer.committed(), result.problems});
+            m_area_buffer.add_item(relation);
+            m_area_buffer.commit();
+        }
+    }
+
+    // Add the relations with problems found by the area assembler to the
+    // outputs in order of their IDs.
+    void write_area_problems() {
+        std::sort(m_area_results.begin(), m_area_results.end(), [](const area_result& a, const area_result& b) {
+            return a.id < b.id;
+        });
+
+        static const output_id outputs[] = {
+            area_ring_not_closed,
+            area_self_intersection,
+            area_touching_ring,
+            area_wrong_role,
+            area_way_in_multiple_rings
+        };
+
+        for (const auto& result : m_area_results) {
+            const auto& relation = m_area_buffer.get<osmium::Relation>(result.offset);
+            bool added[sizeof(outputs) / sizeof(output_id)] = {false};
+            for (const auto& problem : result.problems) {
+                const auto n = static_cast<std::size_t>(problem.type);
+                auto& output = m_outputs[outputs[n]];
+                if (!added[n]) {
+                    output.add(relation);
+                    added[n] = true;
+                }
+                output.add_point(relation.positive_id(), problem.location, relation.timestamp());
+            }
+        }
+
+        std::vector<area_result>{}.swap(m_area_results);
+        m_area_buffer.clear();
+    }
+
+    /**
+     * Check that the member ways of the relation can form closed rings:
+     * At each location an even number of way ends must meet, otherwise
+     * there is a loose end. This doesn't need the area assembler and
+     * finds the most common reason why an area can't be built. Relations
+     * with missing locations are not checked.
+     */
+    void check_rings(const osmium::Relation& relation, std::size_t pos, output_id output) {
+        m_endpoints.clear();
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::way) {
+                const auto& mw = get_member_way(member.ref(), pos);
+                if (!mw.has_ends) {
+                    continue;
+                }
+                if (!mw.first.location().valid() || !mw.last.location().valid()) {
+                    return;
+                }
+                m_endpoints.push_back(mw.first);
+                m_endpoints.push_back(mw.last);
+            }
+        }
+
+        std::sort(m_endpoints.begin(), m_endpoints.end(), [](const osmium::NodeRef& a, const osmium::NodeRef& b) {
+            return a.location() < b.location();
+        });
+
+        bool added = false;
+        auto it = m_endpoints.cbegin();
+        while (it != m_endpoints.cend()) {
+            const auto location = it->location();
+            const auto end = std::find_if(it, m_endpoints.cend(), [location](const osmium::NodeRef& nr) {
+                return nr.location() != location;
+            });
+            if ((end - it) % 2 != 0) {
+                if (!added) {
+                    m_outputs[output].add(relation);
+                    added = true;
+                }
+                m_outputs[output].add_point(relation.positive_id(), *it, relation.timestamp());
+            }
+            it = end;
+        }
+    }
+
+    /**
+     * Do the way tags match the relation tags? The fingerprints are
+     * compared first, the tags themselves only if they are the same.
+     */
+    bool compare_tags(const osmium::TagList& rtags, uint64_t rfingerprint, const member_way& mw) const noexcept {
+        return mw.fingerprint == rfingerprint && mw.tags.valid() &&
+               tag_fingerprint::same_tags(rtags, m_stash.get<osmium::TagList>(mw.tags), m_filter);
+    }
+
+    bool new_relation(const osmium::Relation& relation) noexcept {
+        if (!m_options.shard.contains(relation)) {
+            return false;
+        }
+        if (is_multipolygon(relation)) {
+            ++m_stats.multipolygon_relations;
+            return true;
+        }
+        if (relation.tags().has_tag("type", "boundary")) {
+            ++m_stats.boundary_relations;
+            return true;
+        }
+        return false;
+    }
+
+    bool new_member(const osmium::Relation& relation, const osmium::RelationMember& member) noexcept {
+        const bool multipolygon = is_multipolygon(relation);
+        if (multipolygon) {
+            ++m_stats.multipolygon_relation_members;
+        }
+        if (member.type() == osmium::item_type::way) {
+            if (multipolygon) {
+                ++m_stats.multipolygon_relation_way_members;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void complete_relation(const osmium::Relation& relation, std::size_t pos) {
+        if (!is_multipolygon(relation)) {
+            check_rings(relation, pos, boundary_open_ring);
+            return;
+        }
+
+        check_rings(relation, pos, multipolygon_open_ring);
+
+        if (osmium::tags::match_none_of(relation.tags(), m_filter)) {
+            ++m_stats.multipolygon_relations_without_tags;
+            return;
+        }
+
+        const auto rfingerprint = tag_fingerprint::of(relation.tags(), m_filter);
+        std::vector<osmium::unsigned_object_id_type> marks;
+
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::way) {
+                if (compare_tags(relation.tags(), rfingerprint, get_member_way(member.ref(), pos))) {
+                    ++m_stats.multipolygon_relation_members_with_same_tags;
+                    marks.push_back(member.positive_ref());
+                }
+            }
+        }
+
+        if (!marks.empty()) {
+            m_outputs[multipolygon_relations_with_same_tags].add(relation, 1, marks);
+        }
+    }
+
+public:
+
+    CheckMPManager(Outputs& outputs, const options_type& options) :
+        m_outputs(outputs),
+        m_options(options) {
+        if (options.assemble) {
+            m_dispatcher.reset(new AssembleDispatcher{[this](const osmium::Relation& relation, const assemble_result& result) {
+                assembled(relation, result);
+            }});
+        }
+    }
+
+    CheckMPManager(const CheckMPManager&) = delete;
+    CheckMPManager& operator=(const CheckMPManager&) = delete;
+
+    CheckMPManager(CheckMPManager&&) = delete;
+    CheckMPManager& operator=(CheckMPManager&&) = delete;
+
+    ~CheckMPManager() noexcept = default;
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+    /// First pass: Remember relation if it is a multipolygon or boundary.
+    void relation(const osmium::Relation& relation) {
+        if (!new_relation(relation)) {
+            return;
+        }
+
+        const auto pos = m_relations.size();
+        std::size_t pending = 0;
+        for (const auto& member : relation.members()) {
+            if (new_member(relation, member)) {
+                m_way_members.push_back(way_member{member.ref(), pos, invalid});
+                ++pending;
+            }
+        }
+
+        if (pending > 0) {
+            m_relations.push_back(relation_data{m_stash.add_item(relation), pending});
+        }
+    }
+
+    /// Call after the first pass.
+    void prepare_for_lookup() {
+        std::sort(m_way_members.begin(), m_way_members.end(), [](const way_member& a, const way_member& b) {
+            return std::make_pair(a.way_id, a.relation) < std::make_pair(b.way_id, b.relation);
+        });
+        m_way_members.shrink_to_fit();
+    }
+
+    /// The handler for the second pass.
+    SecondPassHandler& handler() noexcept {
+        return m_handler;
+    }
+
+    /// Call after the second pass to wait for all areas to be assembled.
+    void close() {
+        if (m_dispatcher) {
+            trace::Span span{"wait_for_assembler"};
+            m_dispatcher->wait();
+            write_area_problems();
+        }
+    }
+
+    /// Memory used for relations and member ways in bytes.
+    std::size_t used_memory() const noexcept {
+        return m_stash.used_memory() +
+               m_relations.capacity() * sizeof(relation_data) +
+               m_way_members.capacity() * sizeof(way_member) +
+               m_member_ways.capacity() * sizeof(member_way) +
+               m_free_member_ways.capacity() * sizeof(std::size_t);
+    }
+
+}; // class CheckMPManager
+
+inline void add_outputs(Outputs& outputs) {
+    outputs.add_outputs(output_definitions);
+}
+
+inline void add_stats(const stats_type& stats, Outputs& outputs, std::function<void(const char*, uint64_t)>& add_stat) {
+    add_stat("multipolygon_relations",                       stats.multipolygon_relations);
+    add_stat("boundary_relations",                           stats.boundary_relations);
+    add_stat("multipolygon_relations_without_tags",          stats.multipolygon_relations_without_tags);
+    add_stat("multipolygon_relation_members",                stats.multipolygon_relation_members);
+    add_stat("multipolygon_relation_way_members",            stats.multipolygon_relation_way_members);
+    add_stat("multipolygon_relation_members_with_same_tags", stats.multipolygon_relation_members_with_same_tags);
+    add_stat("area_relations_assembled",                     stats.area_relations_assembled);
+    add_stat("area_relations_not_assembled",                 stats.area_relations_not_assembled);
+    outputs.for_all([&](Output& output){
+        add_stat(output.name(), output.counter());
+    });
+}
+
+} // namespace multipolygon_problems
+
+#endif // MULTIPOLYGON_PROBLEMS_HPP
@@ -0,0 +1,156 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+
+#include <osmium/index/nwr_array.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include "orphans.hpp"
+#include "ref_index.hpp"
+
+static const char* const program_name = "odad-build-ref-index";
+
+struct options_type {
+    bool verbose = true;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] OSM-FILE INDEX-FILE\n\n"
+              << "Create index of all objects referenced from ways and relations.\n"
+              << "\nOptions:\n"
+              << "  -h, --help              This help message\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
+              << "  -q, --quiet             Work quietly\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"help",          no_argument, nullptr, 'h'},
+        {"quiet",         no_argument, nullptr, 'q'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"trace", required_argument, nullptr, 'T'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hq", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'q':
+                options.verbose = false;
+                break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args != 2) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS] OSM-FILE INDEX-FILE\n"
+                  << "Call '" << program_name << " --help' for usage information.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string input_filename{argv[optind]};
+    const std::string index_filename{argv[optind + 1]};
+
+    vout << "Command line options:\n";
+    vout << "  Reading from file '" << input_filename << "'\n";
+    vout << "  Writing index to file '" << index_filename << "'\n";
+
+    const osmium::io::File input_file{input_filename};
+    const auto fingerprint = ref_index::source_fingerprint(input_filename);
+
+    osmium::ProgressBar progress_bar{osmium::util::file_size(input_filename), display_progress()};
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
+    vout << "Creating index of referenced objects...\n";
+    timer.start("create_index");
+    const auto index = orphans::create_index_of_referenced_objects<orphans::id_set_type>(input_file, progress_bar, timer);
+    progress_bar.done();
+
+    vout << "Writing index...\n";
+    timer.start("write_index");
+    ref_index::write(index_filename, index, fingerprint);
+    timer.stop();
+
+    timer.print(vout);
+
+    trace::finish(options.trace_filename);
+
+    osmium::MemoryUsage memory_usage;
+    if (memory_usage.peak() != 0) {
+        vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
+    }
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
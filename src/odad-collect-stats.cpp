@@ -0,0 +1,305 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+
+#include <osmium/util/verbose_output.hpp>
+
+#include <sqlite.hpp>
+
+static const char* const program_name = "odad-collect-stats";
+
+struct options_type {
+    bool verbose = true;
+    bool rebuild_rollups = false;
+};
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] DIR\n\n"
+              << "Collect the stats from all DIR/stats-*.db files into DIR/stats.db.\n"
+              << "\nOptions:\n"
+              << "  -h, --help              This help message\n"
+              << "  -q, --quiet             Work quietly\n"
+              << "      --rebuild-rollups   Rebuild daily and weekly rollups for all dates\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"help",            no_argument, nullptr, 'h'},
+        {"quiet",           no_argument, nullptr, 'q'},
+        {"rebuild-rollups", no_argument, nullptr, 'R'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hq", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'q':
+                options.verbose = false;
+                break;
+            case 'R':
+                options.rebuild_rollups = true;
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args != 1) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS] DIR\n"
+                  << "Call '" << program_name << " --help' for usage information.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+/// The names of all stats-*.db files in the directory, sorted.
+static std::vector<std::string> stats_files(const std::string& dirname) {
+    std::vector<std::string> filenames;
+
+    DIR* dir = ::opendir(dirname.c_str());
+    if (!dir) {
+        throw std::system_error{errno, std::system_category(), "Can't open directory '" + dirname + "'"};
+    }
+    while (const dirent* entry = ::readdir(dir)) {
+        const std::string name{entry->d_name};
+        if (name.size() > 9 && name.compare(0, 6, "stats-") == 0 && name.compare(name.size() - 3, 3, ".db") == 0) {
+            filenames.push_back(dirname + "/" + name);
+        }
+    }
+    ::closedir(dir);
+
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
+
+/// Is there a table (not a view) with this name in the database?
+static bool has_table(Sqlite::Database& db, const char* name) {
+    Sqlite::Statement statement{db, "SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = ?;"};
+    statement.bind_text(name);
+    return statement.read() && statement.get_int(0) > 0;
+}
+
+/**
+ * Move the data from the stats table written by older versions (by the
+ * collect-stats.sh script) into the new tables. Returns true if there was
+ * anything to migrate.
+ */
+static bool migrate_old_table(Sqlite::Database& db) {
+    if (!has_table(db, "stats")) {
+        return false;
+    }
+
+    db.exec("INSERT OR IGNORE INTO stats_keys (key) SELECT DISTINCT key FROM stats;");
+    db.exec("INSERT OR REPLACE INTO stats_values (key_id, date, value) SELECT k.key_id, s.date, s.value FROM stats s JOIN stats_keys k USING (key);");
+    db.exec("DROP TABLE stats;");
+
+    return true;
+}
+
+/**
+ * Create the tables of the stats database. Every key is only stored once
+ * in stats_keys, the values refer to it by key_id. The primary key of
+ * stats_values makes the time series of one key fast, the index on the
+ * date all stats of one run.
+ *
+ * The rollup tables contain the value of the last run on each day and the
+ * minimum, maximum, average, and last value of the days in each week
+ * (starting on Monday).
+ *
+ * The view "stats" has the same columns as the table in the databases
+ * written by the other programs, so queries written for those work here
+ * too. A stats table written by older versions is migrated first.
+ * Returns true if there was one.
+ */
+static bool create_schema(Sqlite::Database& db) {
+    db.exec("CREATE TABLE IF NOT EXISTS stats_keys (key_id INTEGER PRIMARY KEY, key TEXT NOT NULL UNIQUE);");
+    db.exec("CREATE TABLE IF NOT EXISTS stats_values (key_id INTEGER NOT NULL REFERENCES stats_keys (key_id), date TEXT NOT NULL, value INT64 DEFAULT 0, PRIMARY KEY (key_id, date)) WITHOUT ROWID;");
+    db.exec("CREATE INDEX IF NOT EXISTS stats_values_date_idx ON stats_values (date);");
+    db.exec("CREATE TABLE IF NOT EXISTS stats_daily (key_id INTEGER NOT NULL, day TEXT NOT NULL, value INT64, PRIMARY KEY (key_id, day)) WITHOUT ROWID;");
+    db.exec("CREATE TABLE IF NOT EXISTS stats_weekly (key_id INTEGER NOT NULL, week TEXT NOT NULL, min_value INT64, max_value INT64, avg_value REAL, last_value INT64, PRIMARY KEY (key_id, week)) WITHOUT ROWID;");
+
+    const bool migrated = migrate_old_table(db);
+
+    db.exec("CREATE VIEW IF NOT EXISTS stats AS SELECT v.date AS date, k.key AS key, v.value AS value FROM stats_values v JOIN stats_keys k USING (key_id);");
+
+    return migrated;
+}
+
+/**
+ * Copy the stats from all files into the temporary table new_stats. All
+ * stats get the latest date found in any of the files, like the stats of
+ * one run. Returns that date.
+ *
+ * Databases can't be attached inside a transaction, so this happens before
+ * the main transaction. The temporary table is not written to disk.
+ */
+static std::string read_new_stats(Sqlite::Database& db, const std::vector<std::string>& filenames, osmium::util::VerboseOutput& vout) {
+    db.exec("CREATE TEMP TABLE new_stats (date TEXT, key TEXT, value INT64 DEFAULT 0);");
+
+    for (const auto& filename : filenames) {
+        vout << "  Reading '" << filename << "'...\n";
+        {
+            Sqlite::Statement attach{db, "ATTACH DATABASE ? AS db;"};
+            attach.bind_text(filename).execute();
+        }
+        db.exec("INSERT INTO temp.new_stats SELECT date, key, value FROM db.stats;");
+        db.exec("DETACH DATABASE db;");
+    }
+
+    Sqlite::Statement statement{db, "SELECT coalesce(max(date), '') FROM temp.new_stats;"};
+    if (!statement.read()) {
+        return "";
+    }
+    return statement.get_text(0);
+}
+
+/// Add the new stats to the stats tables. Returns the number of stats.
+static int add_new_stats(Sqlite::Database& db, const std::string& date) {
+    db.exec("INSERT OR IGNORE INTO stats_keys (key) SELECT DISTINCT key FROM temp.new_stats;");
+
+    Sqlite::Statement insert{db, "INSERT OR REPLACE INTO stats_values (key_id, date, value) SELECT k.key_id, ?, n.value FROM temp.new_stats n JOIN stats_keys k USING (key);"};
+    insert.bind_text(date).execute();
+
+    return sqlite3_changes(db.get_sqlite3());
+}
+
+/**
+ * Recalculate the daily and weekly rollups for all days from first_day to
+ * last_day (format yyyy-mm-dd) and all weeks containing them.
+ */
+static void update_rollups(Sqlite::Database& db, const std::string& first_day, const std::string& last_day) {
+    {
+        Sqlite::Statement del{db, "DELETE FROM stats_daily WHERE day BETWEEN ?1 AND ?2;"};
+        del.bind_text(first_day).bind_text(last_day).execute();
+    }
+    {
+        Sqlite::Statement insert{db,
+            "INSERT INTO stats_daily (key_id, day, value)"
+            " SELECT v.key_id, substr(v.date, 1, 10), v.value FROM stats_values v"
+            " JOIN (SELECT key_id, max(date) AS date FROM stats_values"
+            "       WHERE date >= ?1 AND date < date(?2, '+1 day')"
+            "       GROUP BY key_id, substr(date, 1, 10)) l USING (key_id, date);"};
+        insert.bind_text(first_day).bind_text(last_day).execute();
+    }
+
+    // Weeks start on Monday: Go to the next Sunday (or stay there) and
+    // then back six days.
+    {
+        Sqlite::Statement del{db, "DELETE FROM stats_weekly WHERE week BETWEEN date(?1, 'weekday 0', '-6 days') AND date(?2, 'weekday 0', '-6 days');"};
+        del.bind_text(first_day).bind_text(last_day).execute();
+    }
+    {
+        Sqlite::Statement insert{db,
+            "INSERT INTO stats_weekly (key_id, week, min_value, max_value, avg_value, last_value)"
+            " SELECT d.key_id, date(d.day, 'weekday 0', '-6 days'), min(d.value), max(d.value), avg(d.value),"
+            "   (SELECT l.value FROM stats_daily l"
+            "    WHERE l.key_id = d.key_id AND l.day BETWEEN date(d.day, 'weekday 0', '-6 days') AND date(d.day, 'weekday 0')"
+            "    ORDER BY l.day DESC LIMIT 1)"
+            " FROM stats_daily d"
+            " WHERE d.day BETWEEN date(?1, 'weekday 0', '-6 days') AND date(?2, 'weekday 0')"
+            " GROUP BY d.key_id, date(d.day, 'weekday 0', '-6 days');"};
+        insert.bind_text(first_day).bind_text(last_day).execute();
+    }
+}
+
+/// The first and last day with stats in the database.
+static std::pair<std::string, std::string> date_range(Sqlite::Database& db) {
+    Sqlite::Statement statement{db, "SELECT coalesce(substr(min(date), 1, 10), ''), coalesce(substr(max(date), 1, 10), '') FROM stats_values;"};
+    if (!statement.read()) {
+        return {};
+    }
+    return {statement.get_text(0), statement.get_text(1)};
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string dirname{argv[optind]};
+    const std::string database_name{dirname + "/stats.db"};
+
+    vout << "Command line options:\n";
+    vout << "  Collecting stats in '" << database_name << "'\n";
+    vout << "  Rebuild rollups: " << (options.rebuild_rollups ? "yes" : "no") << " (change with --rebuild-rollups)\n";
+
+    Sqlite::Database db{database_name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE};
+
+    vout << "Reading stats files...\n";
+    const auto date = read_new_stats(db, stats_files(dirname), vout);
+
+    db.begin_transaction();
+
+    const bool migrated = create_schema(db);
+    if (migrated) {
+        vout << "Migrated stats table written by older versions.\n";
+    }
+
+    if (!date.empty()) {
+        const auto count = add_new_stats(db, date);
+        vout << "Added " << count << " stats for " << date << ".\n";
+    }
+
+    if (migrated || options.rebuild_rollups) {
+        const auto range = date_range(db);
+        if (!range.first.empty()) {
+            vout << "Rebuilding rollups from " << range.first << " to " << range.second << "...\n";
+            update_rollups(db, range.first, range.second);
+        }
+    } else if (!date.empty()) {
+        vout << "Updating rollups...\n";
+        update_rollups(db, date.substr(0, 10), date.substr(0, 10));
+    }
+
+    db.commit();
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
@@ -25,161 +25,96 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <ctime>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
-#include <boost/iterator/filter_iterator.hpp>
-
 #include <osmium/index/id_set.hpp>
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/object.hpp>
-#include <osmium/relations/manager_util.hpp>
-#include <osmium/relations/relations_manager.hpp>
 #include <osmium/tags/taglist.hpp>
-#include <osmium/tags/tags_filter.hpp>
 #include <osmium/util/file.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
-#include "outputs.hpp"
-#include "utils.hpp"
-
-static const char* const program_name = "odad-find-multipolygon-problems";
-
-struct options_type {
-    bool verbose = true;
-};
-
-struct stats_type {
-    uint64_t multipolygon_relations = 0;
-    uint64_t multipolygon_relations_without_tags = 0;
-    uint64_t multipolygon_relation_members = 0;
-    uint64_t multipolygon_relation_way_members = 0;
-    uint64_t multipolygon_relation_members_with_same_tags = 0;
-};
-
-struct MPFilter : public osmium::TagsFilter {
-
-    MPFilter() : osmium::TagsFilter(true) {
-        add_rule(false, "type");
-        add_rule(false, "created_by");
-        add_rule(false, "source");
-        add_rule(false, "note");
-    }
-
-}; // struct MPFilter
-
-class CheckMPManager : public osmium::relations::RelationsManager<CheckMPManager, true, true, true> {
-
-    Outputs& m_outputs;
-    options_type m_options;
-    stats_type m_stats;
-    MPFilter m_filter;
-
-    bool compare_tags(const osmium::TagList& rtags, const osmium::TagList& wtags) const noexcept {
-        const auto d = std::count_if(wtags.cbegin(), wtags.cend(), std::cref(m_filter));
-        if (d > 0) {
-            using iterator = boost::filter_iterator<MPFilter, osmium::TagList::const_iterator>;
-            iterator rfi_begin{std::cref(m_filter), rtags.cbegin(), rtags.cend()};
-            iterator rfi_end{std::cref(m_filter), rtags.cend(), rtags.cend()};
-            iterator wfi_begin{std::cref(m_filter), wtags.cbegin(), wtags.cend()};
-            iterator wfi_end{std::cref(m_filter), wtags.cend(), wtags.cend()};
-
-            if (std::equal(wfi_begin, wfi_end, rfi_begin) && d == std::distance(rfi_begin, rfi_end)) {
-                return true;
-            }
-        }
-        return false;
-    }
-
-public:
-
-    CheckMPManager(Outputs& outputs, const options_type& options) :
-        m_outputs(outputs),
-        m_options(options) {
-    }
-
-    const stats_type& stats() const noexcept {
-        return m_stats;
-    }
-
-    bool new_relation(const osmium::Relation& relation) noexcept {
-        if (relation.tags().has_tag("type", "multipolygon")) {
-            ++m_stats.multipolygon_relations;
-            return true;
-        }
-        return false;
-    }
-
-    bool new_member(const osmium::Relation& /*relation*/, const osmium::RelationMember& member, std::size_t /*n*/) noexcept {
-        ++m_stats.multipolygon_relation_members;
-        if (member.type() == osmium::item_type::way) {
-            ++m_stats.multipolygon_relation_way_members;
-            return true;
-        }
-        return false;
-    }
-
-    void complete_relation(const osmium::Relation& relation) {
-        if (osmium::tags::match_none_of(relation.tags(), m_filter)) {
-            ++m_stats.multipolygon_relations_without_tags;
-            return;
-        }
-
-        std::vector<osmium::unsigned_object_id_type> marks;
-
-        for (const auto& member : relation.members()) {
-            if (member.type() == osmium::item_type::way) {
-                const auto* way = this->get_member_way(member.ref());
-                if (compare_tags(relation.tags(), way->tags())) {
-                    ++m_stats.multipolygon_relation_members_with_same_tags;
-                    marks.push_back(way->positive_id());
-                }
-            }
-        }
-
-        if (!marks.empty()) {
-            m_outputs["multipolygon_relations_with_same_tags"].add(relation, 1, marks);
-        }
-    }
+#include "location_index.hpp"
+#include "multipolygon_problems.hpp"
 
-}; // CheckMPManager
+using namespace multipolygon_problems;
 
 static void print_help() {
     std::cout << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n\n"
               << "Find multipolygons with problems.\n"
               << "\nOptions:\n"
+              << "  -A, --assemble          Also assemble areas and report problems found\n"
               << "  -h, --help              This help message\n"
+              << "  -l, --location-index=TYPE\n"
+              << "                          Add locations to ways using a node location index\n"
+              << "                          of this type (for input without locations on ways)\n"
+              << "  -M, --output-memory=MB  Memory for buffering output files in MBytes\n"
+              << "                          (default: 1024)\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --shard=K/N         Only check objects in shard K of N shards\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
               << "  -q, --quiet             Work quietly\n"
               ;
 }
 
 static options_type parse_command_line(int argc, char* argv[]) {
     static struct option long_options[] = {
+        {"assemble", no_argument, nullptr, 'A'},
+        {"location-index", required_argument, nullptr, 'l'},
         {"help",  no_argument, nullptr, 'h'},
         {"quiet", no_argument, nullptr, 'q'},
+        {"output-memory", required_argument, nullptr, 'M'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"shard", required_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
         {nullptr, 0, nullptr, 0}
     };
 
     options_type options;
 
     while (true) {
-        const int c = getopt_long(argc, argv, "hq", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "Ahl:M:q", long_options, nullptr);
         if (c == -1) {
             break;
         }
 
         switch (c) {
+            case 'A':
+                options.assemble = true;
+                break;
             case 'h':
                 print_help();
                 std::exit(0);
+            case 'l':
+                options.location_index = optarg;
+                break;
+            case 'M':
+                options.output_memory = OutputMultiplexer::parse_memory_limit(optarg);
+                break;
             case 'q':
                 options.verbose = false;
                 break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'S':
+                options.shard = Shard{optarg};
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
             default:
                 std::exit(2);
         }
@@ -195,27 +130,6 @@ static options_type parse_command_line(int argc, char* argv[]) {
     return options;
 }
 
-static void write_data_files(const std::string& input_filename, Outputs& outputs) {
-    osmium::io::Reader reader{input_filename};
-    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-        for (const auto& object : buffer.select<osmium::OSMObject>()) {
-            outputs.for_all([&](Output& output) {
-                output.write_to_all(object);
-            });
-        }
-    }
-
-    progress_bar.done();
-    reader.close();
-
-    outputs.for_all([](Output& output) {
-        output.close_writer_all();
-    });
-}
-
 int main(int argc, char* argv[]) try {
     const auto options = parse_command_line(argc, argv);
 
@@ -228,60 +142,109 @@ int main(int argc, char* argv[]) try {
     vout << "Command line options:\n";
     vout << "  Reading from file '" << input_filename << "'\n";
     vout << "  Writing to directory '" << output_dirname << "'\n";
+    vout << "  Shard: " << options.shard.to_string() << " (change with --shard)\n";
+    vout << "  Assembling areas: " << (options.assemble ? "yes" : "no") << " (change with --assemble, -A)\n";
+    if (options.location_index.empty()) {
+        vout << "  Input must have locations on ways (change with --location-index, -l)\n";
+    } else {
+        vout << "  Node location index: " << options.location_index << " (change with --location-index, -l)\n";
+    }
+    vout << "  Memory for buffering output files: " << options.output_memory << " MBytes (change with --output-memory, -M)\n";
 
     osmium::io::Header header;
     header.set("generator", program_name);
 
-    Outputs outputs{output_dirname, "geoms-multipolygon-problems", header};
-    outputs.add_output("multipolygon_relations_with_same_tags", false, true);
+    OutputMultiplexer multiplexer{options.output_memory};
+    Outputs outputs{multiplexer, output_dirname, "geoms-multipolygon-problems", header};
+    add_outputs(outputs);
 
     LastTimestampHandler last_timestamp_handler;
 
+    shard::write_info(output_dirname, options.shard);
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
     vout << "Reading relations and checking for problems...\n";
+    timer.start("read_relations");
     const auto file_size = osmium::util::file_size(input_filename);
     osmium::ProgressBar progress_bar{file_size * 2, display_progress()};
 
     CheckMPManager manager{outputs, options};
 
+    std::unique_ptr<LocationIndex> locations;
+    if (!options.location_index.empty()) {
+        locations.reset(new LocationIndex{options.location_index, input_filename});
+    }
+
     osmium::io::File file{input_filename};
-    osmium::relations::read_relations(file, manager);
+    {
+        osmium::io::Reader reader{file, osmium::osm_entity_bits::relation};
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            trace::Span span{"process_buffer"};
+            timer.count(buffer);
+            osmium::apply(buffer, manager);
+        }
+        reader.close();
+    }
+    manager.prepare_for_lookup();
 
     vout << "Reading ways and checking for problems...\n";
-    osmium::io::Reader reader{file, osmium::osm_entity_bits::way};
-    if (file.format() == osmium::io::file_format::pbf && !has_locations_on_ways(reader.header())) {
-        std::cerr << "Input file must have locations on ways.\n";
+    timer.start("check_ways");
+    osmium::io::Reader reader{file, locations ? locations->entity_bits(osmium::osm_entity_bits::way) : osmium::osm_entity_bits::way};
+    if (file.format() == osmium::io::file_format::pbf && !locations && !has_locations_on_ways(reader.header())) {
+        std::cerr << "Input file must have locations on ways or use --location-index, -l.\n";
         return 2;
     }
 
-    while (osmium::memory::Buffer buffer = reader.read()) {
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
         progress_bar.update(reader.offset());
+        timer.count(buffer);
+        if (locations) {
+            locations->add_locations(buffer);
+        }
         osmium::apply(buffer, last_timestamp_handler, manager.handler());
     }
     progress_bar.file_done(file_size);
     progress_bar.done();
     reader.close();
+    if (locations) {
+        locations->finish();
+    }
+
+    if (options.assemble) {
+        vout << "Waiting for area assembler...\n";
+        timer.start("assemble_areas");
+    }
+    manager.close();
 
     outputs.for_all([&](Output& output){
         output.close_writer_rel(); // XXX
-        output.prepare();
     });
+    outputs.prepare();
+    outputs.print_index_stats(vout);
 
     vout << "Writing out data files...\n";
-    write_data_files(input_filename, outputs);
+    timer.start("write_data_files");
+    write_data_files(input_filename, outputs, timer, locations.get());
+    timer.stop();
 
     vout << "Writing out stats...\n";
     const auto last_time{last_timestamp_handler.get_timestamp()};
     write_stats(output_dirname + "/stats-multipolygon-problems.db", last_time, [&](std::function<void(const char*, uint64_t)>& add_stat){
-        add_stat("multipolygon_relations",                       manager.stats().multipolygon_relations);
-        add_stat("multipolygon_relations_without_tags",          manager.stats().multipolygon_relations_without_tags);
-        add_stat("multipolygon_relation_members",                manager.stats().multipolygon_relation_members);
-        add_stat("multipolygon_relation_way_members",            manager.stats().multipolygon_relation_way_members);
-        add_stat("multipolygon_relation_members_with_same_tags", manager.stats().multipolygon_relation_members_with_same_tags);
-        outputs.for_all([&](Output& output){
-            add_stat(output.name(), output.counter());
-        });
+        add_stats(manager.stats(), outputs, add_stat);
+        timer.add_stats(add_stat);
     });
 
+    timer.print(vout);
+    multiplexer.print(vout);
+
+    trace::finish(options.trace_filename);
+
     osmium::MemoryUsage memory_usage;
     if (memory_usage.peak() != 0) {
         vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
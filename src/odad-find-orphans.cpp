@@ -19,6 +19,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <functional>
@@ -26,175 +28,24 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <iostream>
 #include <memory>
 #include <string>
+#include <system_error>
+#include <utility>
 
 #include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/any_output.hpp>
 #include <osmium/osm/timestamp.hpp>
-#include <osmium/tags/taglist.hpp>
-#include <osmium/tags/tags_filter.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <gdalcpp.hpp>
 
-#include "utils.hpp"
+#include "orphans.hpp"
+#include "ref_index.hpp"
 
-static const char* const program_name = "odad-find-orphans";
-
-struct options_type {
-    osmium::Timestamp before_time{osmium::end_of_time()};
-    bool verbose = true;
-    bool untagged = true;
-    bool tagged = true;
-};
-
-struct stats_type {
-    uint64_t orphan_nodes = 0;
-    uint64_t orphan_ways = 0;
-    uint64_t orphan_relations = 0;
-};
-
-using id_set_type = osmium::index::IdSetDense<osmium::unsigned_object_id_type>;
-
-static osmium::nwr_array<id_set_type> create_index_of_referenced_objects(const osmium::io::File& input_file, osmium::ProgressBar& progress_bar) {
-    osmium::nwr_array<id_set_type> index;
-
-    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation};
-
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-
-        for (const auto& object : buffer.select<osmium::OSMObject>()) {
-            if (object.type() == osmium::item_type::way) {
-                for (const auto& node_ref : static_cast<const osmium::Way&>(object).nodes()) {
-                    index(osmium::item_type::node).set(node_ref.positive_ref());
-                }
-            } else if (object.type() == osmium::item_type::relation) {
-                for (const auto& member : static_cast<const osmium::Relation&>(object).members()) {
-                    index(member.type()).set(member.positive_ref());
-                }
-            }
-        }
-    }
-
-    reader.close();
-
-    return index;
-}
-
-class CheckHandler : public HandlerWithDB {
-
-    options_type m_options;
-    stats_type m_stats;
-
-    gdalcpp::Layer m_layer_orphan_nodes;
-    gdalcpp::Layer m_layer_orphan_ways;
-
-    osmium::TagsFilter m_filter{false};
-
-    osmium::nwr_array<id_set_type>& m_index;
-    osmium::nwr_array<std::unique_ptr<osmium::io::Writer>> m_writers;
-
-public:
-
-    CheckHandler(const std::string& output_dirname, const options_type& options, osmium::nwr_array<id_set_type>& index) :
-        HandlerWithDB(output_dirname + "/geoms-orphans.db"),
-        m_options(options),
-        m_layer_orphan_nodes(m_dataset, "orphan_nodes", wkbPoint, {"SPATIAL_INDEX=NO"}),
-        m_layer_orphan_ways(m_dataset, "orphan_ways", wkbLineString, {"SPATIAL_INDEX=NO"}),
-        m_index(index) {
-        m_layer_orphan_nodes.add_field("node_id", OFTReal, 12);
-        m_layer_orphan_nodes.add_field("timestamp", OFTString, 20);
-
-        m_layer_orphan_ways.add_field("way_id", OFTInteger, 10);
-        m_layer_orphan_ways.add_field("timestamp", OFTString, 20);
-
-        m_filter.add_rule(true, "created_by");
-        m_filter.add_rule(true, "source");
-
-        osmium::io::Header header;
-        header.set("generator", program_name);
-        m_writers(osmium::item_type::node).reset(new osmium::io::Writer{output_dirname + "/n-orphans.osm.pbf", header, osmium::io::overwrite::allow});
-        m_writers(osmium::item_type::way).reset(new osmium::io::Writer{output_dirname + "/w-orphans.osm.pbf", header, osmium::io::overwrite::allow});
-        m_writers(osmium::item_type::relation).reset(new osmium::io::Writer{output_dirname + "/r-orphans.osm.pbf", header, osmium::io::overwrite::allow});
-    }
-
-    void node(const osmium::Node& node) {
-        if (node.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        if (m_index(osmium::item_type::node).get(node.positive_id())) {
-            return;
-        }
-
-        if ((m_options.untagged && node.tags().empty()) ||
-                (m_options.tagged && !node.tags().empty() && osmium::tags::match_all_of(node.tags(), std::cref(m_filter)))) {
-            (*m_writers(osmium::item_type::node))(node);
-            ++m_stats.orphan_nodes;
-            gdalcpp::Feature feature{m_layer_orphan_nodes, m_factory.create_point(node)};
-            feature.set_field("node_id", static_cast<double>(node.id()));
-            const auto ts = node.timestamp().to_iso();
-            feature.set_field("timestamp", ts.c_str());
-            feature.add_to_layer();
-        }
-    }
-
-    void way(const osmium::Way& way) {
-        if (way.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        if (m_index(osmium::item_type::way).get(way.positive_id())) {
-            return;
-        }
-
-        if ((m_options.untagged && way.tags().empty()) ||
-                (m_options.tagged && !way.tags().empty() && osmium::tags::match_all_of(way.tags(), std::cref(m_filter)))) {
-            (*m_writers(osmium::item_type::way))(way);
-            ++m_stats.orphan_ways;
-            try {
-                gdalcpp::Feature feature{m_layer_orphan_ways, m_factory.create_linestring(way)};
-                feature.set_field("way_id", static_cast<double>(way.id()));
-                const auto ts = way.timestamp().to_iso();
-                feature.set_field("timestamp", ts.c_str());
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                // ignore geometry errors
-            }
-        }
-    }
-
-    void relation(const osmium::Relation& relation) {
-        if (relation.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        if (m_index(osmium::item_type::relation).get(relation.positive_id())) {
-            return;
-        }
-
-        if ((m_options.untagged && relation.tags().empty()) ||
-                (m_options.tagged && !relation.tags().empty() && osmium::tags::match_all_of(relation.tags(), std::cref(m_filter)))) {
-            (*m_writers(osmium::item_type::relation))(relation);
-            ++m_stats.orphan_relations;
-        }
-    }
-
-    void close() {
-        m_writers(osmium::item_type::node)->close();
-        m_writers(osmium::item_type::way)->close();
-        m_writers(osmium::item_type::relation)->close();
-    }
-
-    const stats_type& stats() const noexcept {
-        return m_stats;
-    }
-
-}; // class CheckHandler
+using namespace orphans;
 
 static void print_help() {
     std::cout << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n\n"
@@ -204,7 +55,20 @@ static void print_help() {
               << "  -b, --before=TIMESTAMP  Only include objects changed last before\n"
               << "                          this time (format: yyyy-mm-ddThh:mm:ssZ)\n"
               << "  -h, --help              This help message\n"
+              << "  -I, --ignore-keys=FILE  Also treat tags with keys from FILE (one per line)\n"
+              << "                          like created_by and source tags\n"
+              << "  -i, --index-type=TYPE   Type of index for referenced objects: 'dense'\n"
+              << "                          (default, fastest on the planet) or 'compressed'\n"
+              << "                          (less memory, especially on extracts)\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --shard=K/N         Only check objects in shard K of N shards\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
               << "  -q, --quiet             Work quietly\n"
+              << "  -r, --ref-index=FILE    Use index of referenced objects created by\n"
+              << "                          odad-build-ref-index instead of a first pass\n"
+              << "  -s, --single-pass       Read input file only once (needs space in OUTPUT-DIR\n"
+              << "                          for a temporary file with all candidates)\n"
               << "  -u, --untagged-only     Untagged objects only\n"
               << "  -U, --no-untagged       No untagged objects\n"
               ;
@@ -215,16 +79,24 @@ static options_type parse_command_line(int argc, char* argv[]) {
         {"age",     required_argument, nullptr, 'a'},
         {"before",  required_argument, nullptr, 'b'},
         {"help",          no_argument, nullptr, 'h'},
+        {"ignore-keys", required_argument, nullptr, 'I'},
+        {"index-type", required_argument, nullptr, 'i'},
         {"quiet",         no_argument, nullptr, 'q'},
+        {"ref-index", required_argument, nullptr, 'r'},
+        {"single-pass",   no_argument, nullptr, 's'},
         {"untagged-only", no_argument, nullptr, 'u'},
         {"no-untagged",   no_argument, nullptr, 'U'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"shard", required_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
         {nullptr, 0, nullptr, 0}
     };
 
     options_type options;
 
     while (true) {
-        const int c = getopt_long(argc, argv, "a:b:hquU", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "a:b:hI:i:qr:suU", long_options, nullptr);
         if (c == -1) {
             break;
         }
@@ -247,15 +119,43 @@ static options_type parse_command_line(int argc, char* argv[]) {
             case 'h':
                 print_help();
                 std::exit(0);
+            case 'I':
+                options.ignore_keys_filename = optarg;
+                break;
+            case 'i':
+                options.index_type = optarg;
+                if (options.index_type != "dense" && options.index_type != "compressed") {
+                    std::cerr << "Unknown index type '" << optarg << "'. Use 'dense' or 'compressed'.\n";
+                    std::exit(2);
+                }
+                break;
             case 'q':
                 options.verbose = false;
                 break;
+            case 'r':
+                options.ref_index_filename = optarg;
+                break;
+            case 's':
+                options.single_pass = true;
+                break;
             case 'u':
                 options.tagged = false;
                 break;
             case 'U':
                 options.untagged = false;
                 break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'S':
+                options.shard = Shard{optarg};
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
             default:
                 std::exit(2);
         }
@@ -266,6 +166,11 @@ static options_type parse_command_line(int argc, char* argv[]) {
         std::exit(2);
     }
 
+    if (options.single_pass && !options.ref_index_filename.empty()) {
+        std::cerr << "Can not use -s,--single-pass and -r,--ref-index together.\n";
+        std::exit(2);
+    }
+
     const int remaining_args = argc - optind;
     if (remaining_args != 2) {
         std::cerr << "Usage: " << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n"
@@ -276,60 +181,206 @@ static options_type parse_command_line(int argc, char* argv[]) {
     return options;
 }
 
-int main(int argc, char* argv[]) try {
-    const auto options = parse_command_line(argc, argv);
+/**
+ * A temporary file which is removed when this object goes out of scope,
+ * so it isn't left behind if there is an error.
+ */
+class TemporaryFile {
 
-    osmium::util::VerboseOutput vout{options.verbose};
-    vout << "Starting " << program_name << "...\n";
+    std::string m_filename;
 
-    const std::string input_filename{argv[optind]};
-    const std::string output_dirname{argv[optind + 1]};
+public:
 
-    vout << "Command line options:\n";
-    vout << "  Reading from file '" << input_filename << "'\n";
-    vout << "  Writing to directory '" << output_dirname << "'\n";
-    if (options.before_time == osmium::end_of_time()) {
-        vout << "  Get all objects independent of change timestamp (change with --age, -a or --before, -b)\n";
-    } else {
-        vout << "  Get only objects last changed before: " << options.before_time << " (change with --age, -a or --before, -b)\n";
+    explicit TemporaryFile(std::string filename) :
+        m_filename(std::move(filename)) {
     }
-    vout << "  Finding untagged objects: " << (options.untagged ? "yes" : "no") << " (change with --untagged, -u)\n";
-    vout << "  Finding tagged objects: " << (options.tagged ? "yes" : "no") << " (change with --no-untagged, -U)\n";
 
-    const osmium::io::File input_file{input_filename};
+    TemporaryFile(const TemporaryFile&) = delete;
+    TemporaryFile& operator=(const TemporaryFile&) = delete;
 
-    const auto file_size = osmium::util::file_size(input_filename);
-    osmium::ProgressBar progress_bar{file_size * 2, display_progress()};
+    ~TemporaryFile() {
+        if (!m_filename.empty()) {
+            std::remove(m_filename.c_str());
+        }
+    }
 
-    vout << "First pass: Creating index of referenced objects...\n";
-    auto index = create_index_of_referenced_objects(input_file, progress_bar);
-    progress_bar.file_done(file_size);
+    const std::string& filename() const noexcept {
+        return m_filename;
+    }
 
-    progress_bar.remove();
-    vout << "Second pass: Writing out non-referenced and untagged objects...\n";
+    /// Remove the file now, throws if that doesn't work.
+    void remove() {
+        if (std::remove(m_filename.c_str()) != 0) {
+            throw std::system_error{errno, std::system_category(), "Can't remove temporary file '" + m_filename + "'"};
+        }
+        m_filename.clear();
+    }
 
-    LastTimestampHandler last_timestamp_handler;
-    CheckHandler handler{output_dirname, options, index};
+}; // class TemporaryFile
+
+/**
+ * Second pass (or filtering of candidates in single-pass mode): Check all
+ * objects in check_file against the index and write out the orphans.
+ */
+template <typename TIdSet>
+static void check_objects(const options_type& options, const std::string& output_dirname, const osmium::io::File& check_file, osmium::nwr_array<TIdSet>& index, osmium::ProgressBar& progress_bar, PhaseTimer& timer, LastTimestampHandler& last_timestamp_handler, osmium::util::VerboseOutput& vout) {
+    vout << "Index of referenced objects uses "
+         << (index(osmium::item_type::node).used_memory() +
+             index(osmium::item_type::way).used_memory() +
+             index(osmium::item_type::relation).used_memory()) / (1024 * 1024)
+         << " MBytes.\n";
 
-    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nwr};
+    CheckHandler<TIdSet> handler{output_dirname, options, index};
 
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
+    osmium::io::Reader reader{check_file, osmium::osm_entity_bits::nwr};
+
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
+        if (!options.single_pass) {
+            progress_bar.update(reader.offset());
+        }
+        timer.count(buffer);
         osmium::apply(buffer, last_timestamp_handler, handler);
     }
     progress_bar.done();
 
     handler.close();
     reader.close();
+    timer.stop();
 
     vout << "Writing out stats...\n";
     const auto last_time{last_timestamp_handler.get_timestamp()};
     write_stats(output_dirname + "/stats-orphans.db", last_time, [&](std::function<void(const char*, uint64_t)>& add){
-        add("orphan_nodes", handler.stats().orphan_nodes);
-        add("orphan_ways", handler.stats().orphan_ways);
-        add("orphan_relations", handler.stats().orphan_relations);
+        add_stats(handler.stats(), add);
+        timer.add_stats(add);
     });
 
+    timer.print(vout);
+
+    trace::finish(options.trace_filename);
+}
+
+template <typename TIdSet>
+static void find_orphans(const options_type& options, const std::string& input_filename, const std::string& output_dirname, osmium::util::VerboseOutput& vout) {
+    const osmium::io::File input_file{input_filename};
+
+    const auto file_size = osmium::util::file_size(input_filename);
+    osmium::ProgressBar progress_bar{options.single_pass ? file_size : file_size * 2, display_progress()};
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
+    LastTimestampHandler last_timestamp_handler;
+    osmium::nwr_array<TIdSet> index;
+    osmium::io::File check_file{input_file};
+
+    // Hidden name, so the file is never mistaken for an output file (for
+    // instance by odad-merge-shards).
+    TemporaryFile candidates_file{options.single_pass ? output_dirname + "/.orphan-candidates.tmp" : std::string{}};
+
+    if (options.single_pass) {
+        const std::string& candidates_filename = candidates_file.filename();
+
+        vout << "Single pass: Creating index of referenced objects and writing out candidates...\n";
+        timer.start("single_pass");
+        CandidatesHandler candidates_handler{candidates_filename, options};
+        index = collect_candidates_and_references<TIdSet>(input_file, candidates_handler, progress_bar, timer, last_timestamp_handler);
+        progress_bar.file_done(file_size);
+
+        progress_bar.remove();
+        vout << "Found " << candidates_handler.count() << " candidates.\n";
+
+        vout << "Filtering candidates: Writing out non-referenced and untagged objects...\n";
+        timer.start("filter_candidates");
+        check_file = osmium::io::File{candidates_filename, "pbf"};
+    } else {
+        vout << "First pass: Creating index of referenced objects...\n";
+        timer.start("first_pass");
+        index = create_index_of_referenced_objects<TIdSet>(input_file, progress_bar, timer);
+        progress_bar.file_done(file_size);
+
+        progress_bar.remove();
+        vout << "Second pass: Writing out non-referenced and untagged objects...\n";
+        timer.start("second_pass");
+    }
+
+    check_objects(options, output_dirname, check_file, index, progress_bar, timer, last_timestamp_handler, vout);
+
+    if (options.single_pass) {
+        candidates_file.remove();
+    }
+}
+
+/**
+ * Use the index created by odad-build-ref-index instead of reading the
+ * input file twice.
+ */
+static void find_orphans_with_ref_index(const options_type& options, const std::string& input_filename, const std::string& output_dirname, osmium::util::VerboseOutput& vout) {
+    const osmium::io::File input_file{input_filename};
+
+    osmium::ProgressBar progress_bar{osmium::util::file_size(input_filename), display_progress()};
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
+    LastTimestampHandler last_timestamp_handler;
+
+    vout << "Opening index of referenced objects...\n";
+    timer.start("open_index");
+    ref_index::IndexFile index_file{options.ref_index_filename};
+    index_file.check_source(input_filename);
+
+    vout << "Writing out non-referenced and untagged objects...\n";
+    timer.start("second_pass");
+    check_objects(options, output_dirname, input_file, index_file.id_sets(), progress_bar, timer, last_timestamp_handler, vout);
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string input_filename{argv[optind]};
+    const std::string output_dirname{argv[optind + 1]};
+
+    vout << "Command line options:\n";
+    vout << "  Reading from file '" << input_filename << "'\n";
+    vout << "  Writing to directory '" << output_dirname << "'\n";
+    vout << "  Shard: " << options.shard.to_string() << " (change with --shard)\n";
+    if (options.before_time == osmium::end_of_time()) {
+        vout << "  Get all objects independent of change timestamp (change with --age, -a or --before, -b)\n";
+    } else {
+        vout << "  Get only objects last changed before: " << options.before_time << " (change with --age, -a or --before, -b)\n";
+    }
+    vout << "  Finding untagged objects: " << (options.untagged ? "yes" : "no") << " (change with --untagged, -u)\n";
+    vout << "  Finding tagged objects: " << (options.tagged ? "yes" : "no") << " (change with --no-untagged, -U)\n";
+    if (!options.ignore_keys_filename.empty()) {
+        vout << "  Reading additional keys to ignore from '" << options.ignore_keys_filename << "'\n";
+    }
+    vout << "  Reading input file only once: " << (options.single_pass ? "yes" : "no") << " (change with --single-pass, -s)\n";
+    if (options.ref_index_filename.empty()) {
+        vout << "  Index type: " << options.index_type << " (change with --index-type, -i)\n";
+    } else {
+        vout << "  Using index of referenced objects from file '" << options.ref_index_filename << "'\n";
+    }
+
+    shard::write_info(output_dirname, options.shard);
+
+    if (!options.ref_index_filename.empty()) {
+        find_orphans_with_ref_index(options, input_filename, output_dirname, vout);
+    } else if (options.index_type == "compressed") {
+        find_orphans<compressed_id_set_type>(options, input_filename, output_dirname, vout);
+    } else {
+        find_orphans<id_set_type>(options, input_filename, output_dirname, vout);
+    }
+
     osmium::MemoryUsage memory_usage;
     if (memory_usage.peak() != 0) {
         vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
@@ -25,6 +25,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <ctime>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -33,232 +34,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/io/file.hpp>
 #include <osmium/osm/entity_bits.hpp>
 #include <osmium/osm/object.hpp>
-#include <osmium/tags/tags_filter.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/progress_bar.hpp>
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
-#include "outputs.hpp"
-#include "utils.hpp"
+#include "location_index.hpp"
+#include "relation_problems.hpp"
 
-static const char* const program_name = "odad-find-relation-problems";
-static const size_t min_members_of_large_relations = 1000;
-
-struct options_type {
-    osmium::Timestamp before_time{osmium::end_of_time()};
-    bool verbose = true;
-};
-
-struct stats_type {
-    uint64_t relation_members = 0;
-};
-
-struct MPFilter : public osmium::TagsFilter {
-
-    MPFilter() : osmium::TagsFilter(true) {
-        add_rule(false, "type");
-        add_rule(false, "created_by");
-        add_rule(false, "source");
-        add_rule(false, "note");
-    }
-
-}; // struct MPFilter
-
-class CheckHandler : public osmium::handler::Handler {
-
-    Outputs& m_outputs;
-    options_type m_options;
-    stats_type m_stats;
-    MPFilter m_mp_filter;
-
-    static std::vector<osmium::unsigned_object_id_type> find_duplicate_ways(const osmium::Relation& relation) {
-        std::vector<osmium::unsigned_object_id_type> duplicate_ids;
-
-        std::vector<osmium::unsigned_object_id_type> way_ids;
-        way_ids.reserve(relation.members().size());
-        for (const auto& member : relation.members()) {
-            if (member.type() == osmium::item_type::way) {
-                way_ids.push_back(member.positive_ref());
-            }
-        }
-        std::sort(way_ids.begin(), way_ids.end());
-
-        auto it = way_ids.begin();
-        while (it != way_ids.end()) {
-            it = std::adjacent_find(it, way_ids.end());
-            if (it != way_ids.end()) {
-                duplicate_ids.push_back(*it);
-                ++it;
-            }
-        }
-
-        return duplicate_ids;
-    }
-
-    void multipolygon_relation(const osmium::Relation& relation) {
-        if (relation.members().empty()) {
-            return;
-        }
-
-        std::uint64_t node_member = 0;
-        std::uint64_t relation_member = 0;
-        std::uint64_t unknown_role = 0;
-        std::uint64_t empty_role = 0;
-
-        for (const auto& member : relation.members()) {
-            switch (member.type()) {
-                case osmium::item_type::node:
-                    ++node_member;
-                    break;
-                case osmium::item_type::way:
-                    if (member.role()[0] == '\0') {
-                        ++empty_role;
-                    } else if (std::strcmp(member.role(), "inner") &&
-                               std::strcmp(member.role(), "outer")) {
-                        ++unknown_role;
-                    }
-                    break;
-                case osmium::item_type::relation:
-                    ++relation_member;
-                    break;
-                default:
-                    break;
-            }
-        }
-
-        if (node_member != 0U) {
-            m_outputs["multipolygon_node_member"].add(relation, node_member);
-        }
-
-        if (relation_member != 0U) {
-            m_outputs["multipolygon_relation_member"].add(relation, relation_member);
-        }
-
-        if (unknown_role != 0U) {
-            m_outputs["multipolygon_unknown_role"].add(relation, unknown_role);
-        }
-
-        if (empty_role != 0U) {
-            m_outputs["multipolygon_empty_role"].add(relation, empty_role);
-        }
-
-        if (relation.members().size() == 1 && relation.members().cbegin()->type() == osmium::item_type::way) {
-            m_outputs["multipolygon_single_way"].add(relation);
-        }
-
-        const auto duplicates = find_duplicate_ways(relation);
-        if (!duplicates.empty()) {
-            m_outputs["multipolygon_duplicate_way"].add(relation, 1, duplicates);
-        }
-
-        if (relation.tags().size() == 1 || std::none_of(relation.tags().cbegin(), relation.tags().cend(), std::cref(m_mp_filter))) {
-            m_outputs["multipolygon_old_style"].add(relation);
-            return;
-        }
-
-        const char* area = relation.tags().get_value_by_key("area");
-        if (area) {
-            m_outputs["multipolygon_area_tag"].add(relation);
-        }
-
-        const char* boundary = relation.tags().get_value_by_key("boundary");
-        if (boundary) {
-            if (!std::strcmp(boundary, "administrative")) {
-                m_outputs["multipolygon_boundary_administrative_tag"].add(relation);
-            } else {
-                m_outputs["multipolygon_boundary_other_tag"].add(relation);
-            }
-        }
-    }
-
-    void boundary_relation(const osmium::Relation& relation) {
-        if (relation.members().empty()) {
-            return;
-        }
-
-        uint64_t empty_role = 0;
-        for (const auto& member : relation.members()) {
-            if (member.role()[0] == '\0') {
-                ++empty_role;
-            }
-        }
-        if (empty_role != 0U) {
-            m_outputs["boundary_empty_role"].add(relation, empty_role);
-        }
-
-        const auto duplicates = find_duplicate_ways(relation);
-        if (!duplicates.empty()) {
-            m_outputs["boundary_duplicate_way"].add(relation, 1, duplicates);
-        }
-
-        const char* area = relation.tags().get_value_by_key("area");
-        if (area) {
-            m_outputs["boundary_area_tag"].add(relation);
-        }
-
-        // is boundary:historic or historic:boundary also okay?
-        const char* boundary = relation.tags().get_value_by_key("boundary");
-        if (!boundary) {
-            m_outputs["boundary_no_boundary_tag"].add(relation);
-        }
-    }
-
-public:
-
-    CheckHandler(Outputs& outputs, const options_type& options) :
-        m_outputs(outputs),
-        m_options(options) {
-    }
-
-    void relation(const osmium::Relation& relation) {
-        if (relation.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        m_stats.relation_members += relation.members().size();
-
-        if (relation.members().empty()) {
-            m_outputs["relation_no_members"].add(relation);
-        }
-
-        if (relation.members().size() >= min_members_of_large_relations) {
-            m_outputs["relation_large"].add(relation);
-        }
-
-        if (relation.tags().empty()) {
-            m_outputs["relation_no_tag"].add(relation);
-            return;
-        }
-
-        const char* type = relation.tags().get_value_by_key("type");
-        if (!type) {
-            m_outputs["relation_no_type_tag"].add(relation);
-            return;
-        }
-
-        if (relation.tags().size() == 1) {
-            m_outputs["relation_only_type_tag"].add(relation);
-        }
-
-        if (!std::strcmp(type, "multipolygon")) {
-            multipolygon_relation(relation);
-        } else if (!std::strcmp(type, "boundary")) {
-            boundary_relation(relation);
-        }
-    }
-
-    const stats_type& stats() const noexcept {
-        return m_stats;
-    }
-
-    void close() {
-        m_outputs.for_all([](Output& output) {
-            output.close_writer_rel();
-        });
-    }
-
-}; // class CheckHandler
+using namespace relation_problems;
 
 static void print_help() {
     std::cout << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n\n"
@@ -268,6 +52,15 @@ static void print_help() {
               << "  -b, --before=TIMESTAMP  Only include objects changed last before\n"
               << "                          this time (format: yyyy-mm-ddThh:mm:ssZ)\n"
               << "  -h, --help              This help message\n"
+              << "  -l, --location-index=TYPE\n"
+              << "                          Add locations to ways using a node location index\n"
+              << "                          of this type (for input without locations on ways)\n"
+              << "  -M, --output-memory=MB  Memory for buffering output files in MBytes\n"
+              << "                          (default: 1024)\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --shard=K/N         Only check objects in shard K of N shards\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
               << "  -q, --quiet             Work quietly\n"
               ;
 }
@@ -276,15 +69,21 @@ static options_type parse_command_line(int argc, char* argv[]) {
     static struct option long_options[] = {
         {"age",     required_argument, nullptr, 'a'},
         {"before",  required_argument, nullptr, 'b'},
+        {"location-index", required_argument, nullptr, 'l'},
         {"help",          no_argument, nullptr, 'h'},
         {"quiet",         no_argument, nullptr, 'q'},
+        {"output-memory", required_argument, nullptr, 'M'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"shard", required_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
         {nullptr, 0, nullptr, 0}
     };
 
     options_type options;
 
     while (true) {
-        const int c = getopt_long(argc, argv, "a:b:hq", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "a:b:hl:M:q", long_options, nullptr);
         if (c == -1) {
             break;
         }
@@ -307,9 +106,27 @@ static options_type parse_command_line(int argc, char* argv[]) {
             case 'h':
                 print_help();
                 std::exit(0);
+            case 'l':
+                options.location_index = optarg;
+                break;
+            case 'M':
+                options.output_memory = OutputMultiplexer::parse_memory_limit(optarg);
+                break;
             case 'q':
                 options.verbose = false;
                 break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'S':
+                options.shard = Shard{optarg};
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
             default:
                 std::exit(2);
         }
@@ -325,27 +142,6 @@ static options_type parse_command_line(int argc, char* argv[]) {
     return options;
 }
 
-static void write_data_files(const std::string& input_filename, Outputs& outputs) {
-    osmium::io::Reader reader{input_filename};
-    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-
-    while (osmium::memory::Buffer buffer = reader.read()) {
-        progress_bar.update(reader.offset());
-        for (const auto& object : buffer.select<osmium::OSMObject>()) {
-            outputs.for_all([&](Output& output) {
-                output.write_to_all(object);
-            });
-        }
-    }
-
-    progress_bar.done();
-    reader.close();
-
-    outputs.for_all([](Output& output) {
-        output.close_writer_all();
-    });
-}
-
 int main(int argc, char* argv[]) try {
     const auto options = parse_command_line(argc, argv);
 
@@ -358,71 +154,85 @@ int main(int argc, char* argv[]) try {
     vout << "Command line options:\n";
     vout << "  Reading from file '" << input_filename << "'\n";
     vout << "  Writing to directory '" << output_dirname << "'\n";
+    vout << "  Shard: " << options.shard.to_string() << " (change with --shard)\n";
     if (options.before_time == osmium::end_of_time()) {
         vout << "  Get all objects independent of change timestamp (change with --age, -a or --before, -b)\n";
     } else {
         vout << "  Get only objects last changed before: " << options.before_time << " (change with --age, -a or --before, -b)\n";
     }
+    if (options.location_index.empty()) {
+        vout << "  Input must have locations on ways (change with --location-index, -l)\n";
+    } else {
+        vout << "  Node location index: " << options.location_index << " (change with --location-index, -l)\n";
+    }
+    vout << "  Memory for buffering output files: " << options.output_memory << " MBytes (change with --output-memory, -M)\n";
+
+    std::unique_ptr<LocationIndex> locations;
+    if (!options.location_index.empty()) {
+        locations.reset(new LocationIndex{options.location_index, input_filename});
+    }
 
     osmium::io::File file{input_filename};
     osmium::io::Reader reader{file, osmium::osm_entity_bits::relation};
-    if (file.format() == osmium::io::file_format::pbf && !has_locations_on_ways(reader.header())) {
-        std::cerr << "Input file must have locations on ways.\n";
+    if (file.format() == osmium::io::file_format::pbf && !locations && !has_locations_on_ways(reader.header())) {
+        std::cerr << "Input file must have locations on ways or use --location-index, -l.\n";
         return 2;
     }
 
     osmium::io::Header header;
     header.set("generator", program_name);
 
-    Outputs outputs{output_dirname, "geoms-relation-problems", header};
-    outputs.add_output("relation_no_members", false, false);
-    outputs.add_output("relation_no_tag");
-    outputs.add_output("relation_only_type_tag");
-    outputs.add_output("relation_no_type_tag");
-    outputs.add_output("relation_large");
-    outputs.add_output("multipolygon_node_member", true, false);
-    outputs.add_output("multipolygon_relation_member", false, false);
-    outputs.add_output("multipolygon_unknown_role", false, true);
-    outputs.add_output("multipolygon_empty_role", false, true);
-    outputs.add_output("multipolygon_area_tag", false, true);
-    outputs.add_output("multipolygon_boundary_administrative_tag", false, true);
-    outputs.add_output("multipolygon_boundary_other_tag", false, true);
-    outputs.add_output("multipolygon_old_style", false, false);
-    outputs.add_output("multipolygon_single_way", false, true);
-    outputs.add_output("multipolygon_duplicate_way", false, true);
-    outputs.add_output("boundary_empty_role", false, true);
-    outputs.add_output("boundary_duplicate_way", false, true);
-    outputs.add_output("boundary_area_tag", false, true);
-    outputs.add_output("boundary_no_boundary_tag", false, true);
+    OutputMultiplexer multiplexer{options.output_memory};
+    Outputs outputs{multiplexer, output_dirname, "geoms-relation-problems", header};
+    add_outputs(outputs);
 
     LastTimestampHandler last_timestamp_handler;
     CheckHandler handler{outputs, options};
 
+    shard::write_info(output_dirname, options.shard);
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
     vout << "Reading relations and checking for problems...\n";
+    timer.start("check_relations");
     osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    while (osmium::memory::Buffer buffer = reader.read()) {
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
         progress_bar.update(reader.offset());
+        timer.count(buffer);
         osmium::apply(buffer, last_timestamp_handler, handler);
     }
     progress_bar.done();
     reader.close();
 
-    outputs.for_all([&](Output& output){
-        output.prepare();
-    });
+    vout << "Checking relation graph...\n";
+    timer.start("check_relation_graph");
+    handler.close();
+
+    outputs.prepare();
+    outputs.print_index_stats(vout);
 
     vout << "Writing out data files...\n";
-    write_data_files(input_filename, outputs);
+    timer.start("write_data_files");
+    write_data_files(input_filename, outputs, timer, locations.get());
+    timer.stop();
 
     vout << "Writing out stats...\n";
     const auto last_time{last_timestamp_handler.get_timestamp()};
     write_stats(output_dirname + "/stats-relation-problems.db", last_time, [&](std::function<void(const char*, uint64_t)>& add_stat){
-        add_stat("relation_member_count", handler.stats().relation_members);
-        outputs.for_all([&](Output& output){
-            add_stat(output.name(), output.counter());
-        });
+        add_stats(handler.stats(), outputs, add_stat);
+        timer.add_stats(add_stat);
     });
 
+    timer.print(vout);
+    multiplexer.print(vout);
+
+    trace::finish(options.trace_filename);
+
     osmium::MemoryUsage memory_usage;
     if (memory_usage.peak() != 0) {
         vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
@@ -37,219 +37,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
-#include "utils.hpp"
-
-static const char* const program_name = "odad-find-unusual-tags";
-
-struct options_type {
-    osmium::Timestamp before_time{osmium::end_of_time()};
-    bool verbose = true;
-};
-
-struct stats_type {
-    uint64_t nodes = 0;
-    uint64_t ways = 0;
-    uint64_t relations = 0;
-    uint64_t nwr_key_empty = 0;
-    uint64_t nwr_key_short = 0;
-    uint64_t nwr_key_long = 0;
-    uint64_t nwr_key_role = 0;
-    uint64_t nwr_key_bad_chars = 0;
-    uint64_t nwr_key_unusual_chars = 0;
-    uint64_t nwr_value_empty = 0;
-    uint64_t nwr_value_whitespace = 0;
-    uint64_t n_tag_type_multipolygon = 0;
-    uint64_t w_tag_type_multipolygon = 0;
-    uint64_t n_tag_type_boundary = 0;
-    uint64_t w_tag_type_boundary = 0;
-    uint64_t n_tag_natural_coastline = 0;
-    uint64_t r_tag_natural_coastline = 0;
-    uint64_t r_tag_boundary_multipolygon = 0;
-};
-
-static const char* const bad_characters = "=/&<>;'\"?%#@\\,";
-static const char* const usual_characters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_:";
-
-class CheckHandler : public osmium::handler::Handler {
-
-    options_type m_options;
-    stats_type m_stats;
-
-    osmium::io::Writer m_writer_nwr_key_empty;
-    osmium::io::Writer m_writer_nwr_key_short;
-    osmium::io::Writer m_writer_nwr_key_long;
-    osmium::io::Writer m_writer_nwr_key_role;
-    osmium::io::Writer m_writer_nwr_key_bad_chars;
-    osmium::io::Writer m_writer_nwr_key_unusual_chars;
-
-    osmium::io::Writer m_writer_nwr_value_empty;
-    osmium::io::Writer m_writer_nwr_value_whitespace;
-
-    osmium::io::Writer m_writer_nw_tag_type_multipolygon;
-    osmium::io::Writer m_writer_nw_tag_type_boundary;
-
-    osmium::io::Writer m_writer_nr_tag_natural_coastline;
-
-    osmium::io::Writer m_writer_r_tag_boundary_multipolygon;
-
-public:
-
-    CheckHandler(const std::string& directory, const options_type& options, const osmium::io::Header& header) :
-        m_options(options),
-        m_writer_nwr_key_empty(directory + "/nwr-key-empty.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_key_short(directory + "/nwr-key-short.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_key_long(directory + "/nwr-key-long.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_key_role(directory + "/nwr-key-role.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_key_bad_chars(directory + "/nwr-key-bad-chars.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_key_unusual_chars(directory + "/nwr-key-unusual-chars.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_value_empty(directory + "/nwr-value-empty.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nwr_value_whitespace(directory + "/nwr-value-whitespace.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nw_tag_type_multipolygon(directory + "/nw-tag-type-multipolygon.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nw_tag_type_boundary(directory + "/nw-tag-type-boundary.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_nr_tag_natural_coastline(directory + "/nr-tag-natural-coastline.osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_r_tag_boundary_multipolygon(directory + "/r-tag-boundary-multipolygon.osm.pbf", header, osmium::io::overwrite::allow) {
-    }
-
-    void osm_object(const osmium::OSMObject& object) {
-        if (object.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        for (const auto& tag : object.tags()) {
-            const auto key_len = std::strlen(tag.key());
-            if (key_len == 0) {
-                ++m_stats.nwr_key_empty;
-                m_writer_nwr_key_empty(object);
-            } else if (key_len == 1) {
-                ++m_stats.nwr_key_short;
-                m_writer_nwr_key_short(object);
-            } else if (key_len > 80) {
-                ++m_stats.nwr_key_long;
-                m_writer_nwr_key_long(object);
-            } else if (!std::strcmp(tag.key(), "role")) {
-                ++m_stats.nwr_key_role;
-                m_writer_nwr_key_role(object);
-            }
-
-            const auto key_len_bad_chars = std::strcspn(tag.key(), bad_characters);
-            if (key_len != key_len_bad_chars) {
-                ++m_stats.nwr_key_bad_chars;
-                m_writer_nwr_key_bad_chars(object);
-            } else {
-                const auto key_len_common_chars = std::strspn(tag.key(), usual_characters);
-                if (key_len != key_len_common_chars) {
-                    ++m_stats.nwr_key_unusual_chars;
-                    m_writer_nwr_key_unusual_chars(object);
-                }
-            }
-
-            if (tag.value()[0] == '\0') {
-                ++m_stats.nwr_value_empty;
-                m_writer_nwr_value_empty(object);
-                continue;
-            }
-
-            const auto value_len = std::strlen(tag.value());
-            if (isspace(tag.value()[0]) || isspace(tag.value()[value_len - 1])) {
-                ++m_stats.nwr_value_whitespace;
-                m_writer_nwr_value_whitespace(object);
-            }
-        }
-    }
-
-    void node(const osmium::Node& node) {
-        if (node.timestamp() >= m_options.before_time) {
-            return;
-        }
+#include "unusual_tags.hpp"
 
-        ++m_stats.nodes;
-
-        const char* type = node.tags().get_value_by_key("type");
-        if (type) {
-            if (!std::strcmp(type, "multipolygon")) {
-                ++m_stats.n_tag_type_multipolygon;
-                m_writer_nw_tag_type_multipolygon(node);
-            }
-            if (!std::strcmp(type, "boundary")) {
-                ++m_stats.n_tag_type_boundary;
-                m_writer_nw_tag_type_boundary(node);
-            }
-        }
-
-        const char* natural = node.tags().get_value_by_key("natural");
-        if (natural && !std::strcmp(natural, "coastline")) {
-            ++m_stats.n_tag_natural_coastline;
-            m_writer_nr_tag_natural_coastline(node);
-        }
-    }
-
-    void way(const osmium::Way& way) {
-        if (way.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        ++m_stats.ways;
-
-        const char* type = way.tags().get_value_by_key("type");
-        if (type) {
-            if (!std::strcmp(type, "multipolygon")) {
-                ++m_stats.w_tag_type_multipolygon;
-                m_writer_nw_tag_type_multipolygon(way);
-            }
-            if (!std::strcmp(type, "boundary")) {
-                ++m_stats.w_tag_type_boundary;
-                m_writer_nw_tag_type_boundary(way);
-            }
-        }
-    }
-
-    void relation(const osmium::Relation& relation) {
-        if (relation.timestamp() >= m_options.before_time) {
-            return;
-        }
-
-        ++m_stats.relations;
-
-        const char* natural = relation.tags().get_value_by_key("natural");
-        if (natural && !std::strcmp(natural, "coastline")) {
-            ++m_stats.r_tag_natural_coastline;
-            m_writer_nr_tag_natural_coastline(relation);
-        }
-
-        const char* type = relation.tags().get_value_by_key("type");
-        if (type && !std::strcmp(type, "multipolygon")) {
-            const char* boundary = relation.tags().get_value_by_key("boundary");
-            if (boundary && !std::strcmp(boundary, "administrative")) {
-                ++m_stats.r_tag_boundary_multipolygon;
-                m_writer_r_tag_boundary_multipolygon(relation);
-            }
-        }
-    }
-
-    void close() {
-        m_writer_nwr_key_empty.close();
-        m_writer_nwr_key_short.close();
-        m_writer_nwr_key_long.close();
-        m_writer_nwr_key_role.close();
-        m_writer_nwr_key_bad_chars.close();
-        m_writer_nwr_key_unusual_chars.close();
-
-        m_writer_nwr_value_empty.close();
-        m_writer_nwr_value_whitespace.close();
-
-        m_writer_nw_tag_type_multipolygon.close();
-        m_writer_nw_tag_type_boundary.close();
-
-        m_writer_nr_tag_natural_coastline.close();
-
-        m_writer_r_tag_boundary_multipolygon.close();
-    }
-
-    const stats_type& stats() const noexcept {
-        return m_stats;
-    }
-
-}; // class CheckHandler
+using namespace unusual_tags;
 
 static void print_help() {
     std::cout << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n\n"
@@ -259,6 +49,12 @@ static void print_help() {
               << "  -b, --before=TIMESTAMP  Only include objects changed last before\n"
               << "                          this time (format: yyyy-mm-ddThh:mm:ssZ)\n"
               << "  -h, --help              This help message\n"
+              << "  -M, --output-memory=MB  Memory for buffering output files in MBytes\n"
+              << "                          (default: 1024)\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --shard=K/N         Only check objects in shard K of N shards\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
               << "  -q, --quiet             Work quietly\n"
               ;
 }
@@ -269,13 +65,18 @@ static options_type parse_command_line(int argc, char* argv[]) {
         {"before",  required_argument, nullptr, 'b'},
         {"help",          no_argument, nullptr, 'h'},
         {"quiet",         no_argument, nullptr, 'q'},
+        {"output-memory", required_argument, nullptr, 'M'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"shard", required_argument, nullptr, 'S'},
+        {"trace", required_argument, nullptr, 'T'},
         {nullptr, 0, nullptr, 0}
     };
 
     options_type options;
 
     while (true) {
-        const int c = getopt_long(argc, argv, "a:b:hq", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "a:b:hM:q", long_options, nullptr);
         if (c == -1) {
             break;
         }
@@ -298,9 +99,24 @@ static options_type parse_command_line(int argc, char* argv[]) {
             case 'h':
                 print_help();
                 std::exit(0);
+            case 'M':
+                options.output_memory = OutputMultiplexer::parse_memory_limit(optarg);
+                break;
             case 'q':
                 options.verbose = false;
                 break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'S':
+                options.shard = Shard{optarg};
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
             default:
                 std::exit(2);
         }
@@ -328,11 +144,13 @@ int main(int argc, char* argv[]) try {
     vout << "Command line options:\n";
     vout << "  Reading from file '" << input_filename << "'\n";
     vout << "  Writing to directory '" << output_dirname << "'\n";
+    vout << "  Shard: " << options.shard.to_string() << " (change with --shard)\n";
     if (options.before_time == osmium::end_of_time()) {
         vout << "  Get all objects independent of change timestamp (change with --age, -a or --before, -b)\n";
     } else {
         vout << "  Get only objects last changed before: " << options.before_time << " (change with --age, -a or --before, -b)\n";
     }
+    vout << "  Memory for buffering output files: " << options.output_memory << " MBytes (change with --output-memory, -M)\n";
 
     osmium::io::Reader reader{input_filename, osmium::osm_entity_bits::nwr};
 
@@ -340,42 +158,44 @@ int main(int argc, char* argv[]) try {
     header.set("generator", program_name);
 
     LastTimestampHandler last_timestamp_handler;
-    CheckHandler handler{output_dirname, options, header};
+    OutputMultiplexer multiplexer{options.output_memory};
+    CheckHandler handler{multiplexer, output_dirname, options, header};
+
+    shard::write_info(output_dirname, options.shard);
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
 
     vout << "Reading data and checking tags...\n";
+    timer.start("check_tags");
     osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
-    while (osmium::memory::Buffer buffer = reader.read()) {
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
         progress_bar.update(reader.offset());
+        timer.count(buffer);
         osmium::apply(buffer, last_timestamp_handler, handler);
     }
     progress_bar.done();
 
     handler.close();
     reader.close();
+    timer.stop();
 
     vout << "Writing out stats...\n";
     const auto last_time{last_timestamp_handler.get_timestamp()};
     write_stats(output_dirname + "/stats-unusual-tags.db", last_time, [&](std::function<void(const char*, uint64_t)>& add){
-        add("nodes", handler.stats().nodes);
-        add("ways", handler.stats().ways);
-        add("relations", handler.stats().relations);
-        add("nwr_key_empty", handler.stats().nwr_key_empty);
-        add("nwr_key_short", handler.stats().nwr_key_short);
-        add("nwr_key_long", handler.stats().nwr_key_long);
-        add("nwr_key_role", handler.stats().nwr_key_role);
-        add("nwr_key_bad_chars", handler.stats().nwr_key_bad_chars);
-        add("nwr_key_unusual_chars", handler.stats().nwr_key_unusual_chars);
-        add("nwr_value_empty", handler.stats().nwr_value_empty);
-        add("nwr_value_whitespace", handler.stats().nwr_value_whitespace);
-        add("n_tag_type_multipolygon", handler.stats().n_tag_type_multipolygon);
-        add("w_tag_type_multipolygon", handler.stats().w_tag_type_multipolygon);
-        add("n_tag_type_boundary", handler.stats().n_tag_type_boundary);
-        add("w_tag_type_boundary", handler.stats().w_tag_type_boundary);
-        add("n_tag_natural_coastline", handler.stats().n_tag_natural_coastline);
-        add("r_tag_natural_coastline", handler.stats().r_tag_natural_coastline);
-        add("r_tag_boundary_multipolygon", handler.stats().r_tag_boundary_multipolygon);
+        add_stats(handler.stats(), add);
+        timer.add_stats(add);
     });
 
+    timer.print(vout);
+    multiplexer.print(vout);
+
+    trace::finish(options.trace_filename);
+
     osmium::MemoryUsage memory_usage;
     if (memory_usage.peak() != 0) {
         vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
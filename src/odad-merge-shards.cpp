@@ -0,0 +1,511 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <osmium/geom/ogr.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <gdalcpp.hpp>
+#include <sqlite.hpp>
+
+#include "shard.hpp"
+#include "utils.hpp"
+
+static const char* const program_name = "odad-merge-shards";
+
+struct options_type {
+    bool verbose = true;
+};
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] OUTPUT-DIR SHARD-DIR...\n\n"
+              << "Merge the output directories of runs with --shard=K/N into the\n"
+              << "output of a single run.\n"
+              << "\nOptions:\n"
+              << "  -h, --help              This help message\n"
+              << "  -q, --quiet             Work quietly\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"help",  no_argument, nullptr, 'h'},
+        {"quiet", no_argument, nullptr, 'q'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hq", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'q':
+                options.verbose = false;
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args < 2) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS] OUTPUT-DIR SHARD-DIR...\n"
+                  << "Call '" << program_name << " --help' for usage information.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+static bool ends_with(const std::string& str, const char* suffix) {
+    const std::string s{suffix};
+    return str.size() >= s.size() && str.compare(str.size() - s.size(), s.size(), s) == 0;
+}
+
+/**
+ * Check that the directories contain the results of all shards of one
+ * run and return them in the order of the shards.
+ */
+static std::vector<std::string> order_shards(const std::vector<std::string>& dirnames) {
+    std::vector<std::string> ordered(dirnames.size());
+
+    for (const auto& dirname : dirnames) {
+        const auto dir_shard = shard::read_info(dirname);
+        if (dir_shard.count() != dirnames.size()) {
+            throw std::runtime_error{"Directory '" + dirname + "' contains shard " + dir_shard.to_string() + ", but " + std::to_string(dirnames.size()) + " directories were given"};
+        }
+        if (!ordered[dir_shard.index()].empty()) {
+            throw std::runtime_error{"Directories '" + ordered[dir_shard.index()] + "' and '" + dirname + "' both contain shard " + dir_shard.to_string()};
+        }
+        ordered[dir_shard.index()] = dirname;
+    }
+
+    return ordered;
+}
+
+/// The names of all output files in the directory, sorted.
+static std::vector<std::string> output_files(const std::string& dirname) {
+    std::vector<std::string> filenames;
+
+    DIR* dir = ::opendir(dirname.c_str());
+    if (!dir) {
+        throw std::system_error{errno, std::system_category(), "Can't open directory '" + dirname + "'"};
+    }
+    while (const dirent* entry = ::readdir(dir)) {
+        const std::string name{entry->d_name};
+        if (ends_with(name, ".osm.pbf") || ends_with(name, ".db")) {
+            filenames.push_back(name);
+        }
+    }
+    ::closedir(dir);
+
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+}
+
+/**
+ * The order of objects in OSM files: by type, then negative IDs before
+ * positive IDs (like in libosmium), then by ID and version. Objects with
+ * the same key from different shards are the same object.
+ */
+class object_key {
+
+    osmium::item_type m_type;
+    bool m_positive;
+    osmium::unsigned_object_id_type m_id;
+    osmium::object_version_type m_version;
+
+public:
+
+    explicit object_key(const osmium::OSMObject& object) noexcept :
+        m_type(object.type()),
+        m_positive(object.id() > 0),
+        m_id(object.positive_id()),
+        m_version(object.version()) {
+    }
+
+    friend bool operator<(const object_key& a, const object_key& b) noexcept {
+        return std::tie(a.m_type, a.m_positive, a.m_id, a.m_version) < std::tie(b.m_type, b.m_positive, b.m_id, b.m_version);
+    }
+
+    friend bool operator==(const object_key& a, const object_key& b) noexcept {
+        return a.m_type == b.m_type && a.m_positive == b.m_positive && a.m_id == b.m_id && a.m_version == b.m_version;
+    }
+
+}; // class object_key
+
+/// Thrown by SortedInput if the input file is not sorted.
+struct unsorted_input : public std::runtime_error {
+
+    unsorted_input() :
+        std::runtime_error("input file is not sorted") {
+    }
+
+}; // struct unsorted_input
+
+/**
+ * Reads the objects from an OSM file one after the other and checks that
+ * they are sorted.
+ */
+class SortedInput {
+
+    osmium::io::Reader m_reader;
+    osmium::memory::Buffer m_buffer;
+    osmium::memory::Buffer::t_iterator<osmium::OSMObject> m_it;
+    osmium::memory::Buffer::t_iterator<osmium::OSMObject> m_end;
+
+    void read_until_object() {
+        while (m_it == m_end) {
+            m_buffer = read_traced(m_reader);
+            if (!m_buffer) {
+                return;
+            }
+            m_it = m_buffer.begin<osmium::OSMObject>();
+            m_end = m_buffer.end<osmium::OSMObject>();
+        }
+    }
+
+public:
+
+    explicit SortedInput(const std::string& filename) :
+        m_reader(filename, osmium::osm_entity_bits::nwr) {
+        read_until_object();
+    }
+
+    /// The current object or nullptr at the end of the file.
+    const osmium::OSMObject* get() const noexcept {
+        if (!m_buffer) {
+            return nullptr;
+        }
+        return &*m_it;
+    }
+
+    void next() {
+        const object_key last{*m_it};
+        ++m_it;
+        read_until_object();
+        if (m_buffer && object_key{*m_it} < last) {
+            throw unsorted_input{};
+        }
+    }
+
+}; // class SortedInput
+
+/**
+ * Merge sorted files. Objects found in several files (for instance ways
+ * which are members of relations in different shards) are only written
+ * once.
+ */
+static uint64_t merge_sorted(const std::vector<std::string>& filenames, osmium::io::Writer& writer) {
+    std::vector<std::unique_ptr<SortedInput>> inputs;
+    for (const auto& filename : filenames) {
+        inputs.emplace_back(new SortedInput{filename});
+    }
+
+    uint64_t count = 0;
+    while (true) {
+        SortedInput* smallest = nullptr;
+        for (const auto& input : inputs) {
+            if (input->get() && (!smallest || object_key{*input->get()} < object_key{*smallest->get()})) {
+                smallest = input.get();
+            }
+        }
+        if (!smallest) {
+            break;
+        }
+
+        const object_key key{*smallest->get()};
+        writer(*smallest->get());
+        ++count;
+
+        for (const auto& input : inputs) {
+            while (input->get() && object_key{*input->get()} == key) {
+                input->next();
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Merge files which are not sorted, for instance the files with relations
+ * written in the order they were completed. All objects are read into
+ * memory and sorted. These files are usually small.
+ */
+static uint64_t merge_unsorted(const std::vector<std::string>& filenames, osmium::io::Writer& writer) {
+    std::vector<osmium::memory::Buffer> buffers;
+    std::vector<const osmium::OSMObject*> objects;
+
+    for (const auto& filename : filenames) {
+        osmium::io::Reader reader{filename, osmium::osm_entity_bits::nwr};
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                objects.push_back(&object);
+            }
+            buffers.push_back(std::move(buffer));
+        }
+        reader.close();
+    }
+
+    std::stable_sort(objects.begin(), objects.end(), [](const osmium::OSMObject* a, const osmium::OSMObject* b) {
+        return object_key{*a} < object_key{*b};
+    });
+    const auto last = std::unique(objects.begin(), objects.end(), [](const osmium::OSMObject* a, const osmium::OSMObject* b) {
+        return object_key{*a} == object_key{*b};
+    });
+
+    for (auto it = objects.begin(); it != last; ++it) {
+        writer(**it);
+    }
+
+    return static_cast<uint64_t>(last - objects.begin());
+}
+
+/**
+ * Merge the OSM files from all shards. Most files are sorted (because
+ * the input file is sorted), they are merged without reading them into
+ * memory. If that doesn't work, the file is written again sorting all
+ * objects in memory.
+ */
+static void merge_osm_files(const std::string& output_filename, const std::vector<std::string>& filenames, osmium::util::VerboseOutput& vout) {
+    osmium::io::Header header;
+    {
+        osmium::io::Reader reader{filenames.front(), osmium::osm_entity_bits::nothing};
+        header = reader.header();
+        reader.close();
+    }
+    const osmium::io::File file{output_filename, has_locations_on_ways(header) ? "pbf,locations_on_ways=true" : "pbf"};
+
+    uint64_t count = 0;
+    try {
+        osmium::io::Writer writer{file, header, osmium::io::overwrite::allow};
+        count = merge_sorted(filenames, writer);
+        writer.close();
+    } catch (const unsorted_input&) {
+        vout << "  Input files are not sorted, sorting in memory...\n";
+        osmium::io::Writer writer{file, header, osmium::io::overwrite::allow};
+        count = merge_unsorted(filenames, writer);
+        writer.close();
+    }
+
+    vout << "  Wrote " << count << " objects.\n";
+}
+
+/**
+ * Merge the stats from the last run in each of the stats databases and
+ * add them to the output database. See shard::merge_with_max() for how
+ * the values are combined.
+ */
+static void merge_stats(const std::string& output_filename, const std::vector<std::string>& filenames) {
+    std::string date;
+    std::vector<std::pair<std::string, int64_t>> stats;
+    std::map<std::string, std::size_t> positions;
+
+    for (const auto& filename : filenames) {
+        Sqlite::Database db{filename, SQLITE_OPEN_READONLY};
+        Sqlite::Statement statement{db, "SELECT date, key, value FROM stats WHERE date = (SELECT max(date) FROM stats);"};
+        while (statement.read()) {
+            date = std::max(date, statement.get_text(0));
+            const auto key = statement.get_text(1);
+            const auto value = statement.get_int64(2);
+
+            const auto it = positions.find(key);
+            if (it == positions.end()) {
+                positions.emplace(key, stats.size());
+                stats.emplace_back(key, value);
+            } else if (shard::merge_with_max(key)) {
+                stats[it->second].second = std::max(stats[it->second].second, value);
+            } else {
+                stats[it->second].second += value;
+            }
+        }
+    }
+
+    if (stats.empty()) {
+        return;
+    }
+
+    write_stats(output_filename, osmium::Timestamp{date.c_str()}, [&](std::function<void(const char*, uint64_t)>& add) {
+        for (const auto& stat : stats) {
+            add(stat.first.c_str(), static_cast<uint64_t>(stat.second));
+        }
+    });
+}
+
+struct gdal_dataset_closer {
+
+    void operator()(GDALDataset* dataset) const {
+        GDALClose(dataset);
+    }
+
+}; // struct gdal_dataset_closer
+
+struct ogr_feature_deleter {
+
+    void operator()(OGRFeature* feature) const {
+        OGRFeature::DestroyFeature(feature);
+    }
+
+}; // struct ogr_feature_deleter
+
+/**
+ * Copy all features of all layers in the Spatialite databases into one
+ * database. The layers are created like in HandlerWithDB from the
+ * definitions of the layers in the first database.
+ */
+static void merge_layers(const std::string& output_filename, const std::vector<std::string>& filenames, osmium::util::VerboseOutput& vout) {
+    std::remove(output_filename.c_str());
+
+    osmium::geom::OGRFactory<> factory;
+    gdalcpp::Dataset dataset{"SQLite", output_filename, gdalcpp::SRS{factory.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=NO" }};
+    CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
+    dataset.enable_auto_transactions();
+    dataset.exec("PRAGMA journal_mode = OFF;");
+
+    std::map<std::string, std::unique_ptr<gdalcpp::Layer>> layers;
+    uint64_t count = 0;
+
+    for (const auto& filename : filenames) {
+        std::unique_ptr<GDALDataset, gdal_dataset_closer> source{static_cast<GDALDataset*>(GDALOpenEx(filename.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, nullptr, nullptr, nullptr))}; // NOLINT(hicpp-signed-bitwise)
+        if (!source) {
+            throw std::runtime_error{"Can't open Spatialite database '" + filename + "'"};
+        }
+
+        for (int n = 0; n < source->GetLayerCount(); ++n) {
+            OGRLayer* source_layer = source->GetLayer(n);
+
+            auto& layer = layers[source_layer->GetName()];
+            if (!layer) {
+                layer.reset(new gdalcpp::Layer{dataset, source_layer->GetName(), source_layer->GetGeomType(), {"SPATIAL_INDEX=NO"}});
+                const OGRFeatureDefn* definition = source_layer->GetLayerDefn();
+                for (int f = 0; f < definition->GetFieldCount(); ++f) {
+                    const OGRFieldDefn* field = definition->GetFieldDefn(f);
+                    layer->add_field(field->GetNameRef(), field->GetType(), field->GetWidth(), field->GetPrecision());
+                }
+            }
+
+            source_layer->ResetReading();
+            while (OGRFeature* f = source_layer->GetNextFeature()) {
+                const std::unique_ptr<OGRFeature, ogr_feature_deleter> source_feature{f};
+                const std::unique_ptr<OGRFeature, ogr_feature_deleter> feature{OGRFeature::CreateFeature(layer->get().GetLayerDefn())};
+                feature->SetFrom(source_feature.get());
+                feature->SetFID(OGRNullFID);
+                trace::Span span{"gdal_insert"};
+                layer->create_feature(feature.get());
+                ++count;
+            }
+        }
+    }
+
+    vout << "  Wrote " << count << " features in " << layers.size() << " layers.\n";
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string output_dirname{argv[optind]};
+    const std::vector<std::string> shard_dirnames{argv + optind + 1, argv + argc};
+
+    vout << "Command line options:\n";
+    vout << "  Writing to directory '" << output_dirname << "'\n";
+    for (const auto& dirname : shard_dirnames) {
+        vout << "  Reading shard from directory '" << dirname << "'\n";
+        if (dirname == output_dirname) {
+            std::cerr << "Output directory can not be one of the shard directories.\n";
+            return 2;
+        }
+    }
+
+    const auto dirnames = order_shards(shard_dirnames);
+
+    for (const auto& filename : output_files(dirnames.front())) {
+        std::vector<std::string> filenames;
+        for (const auto& dirname : dirnames) {
+            filenames.push_back(dirname + "/" + filename);
+            if (::access(filenames.back().c_str(), R_OK) != 0) {
+                throw std::runtime_error{"Missing file '" + filenames.back() + "'"};
+            }
+        }
+
+        const std::string output_filename{output_dirname + "/" + filename};
+        vout << "Merging '" << filename << "'...\n";
+        if (ends_with(filename, ".osm.pbf")) {
+            merge_osm_files(output_filename, filenames, vout);
+        } else if (filename.compare(0, 6, "stats-") == 0) {
+            merge_stats(output_filename, filenames);
+        } else {
+            merge_layers(output_filename, filenames, vout);
+        }
+    }
+
+    osmium::MemoryUsage memory_usage;
+    if (memory_usage.peak() != 0) {
+        vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
+    }
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
@@ -0,0 +1,481 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include "colocated_nodes.hpp"
+#include "multipolygon_problems.hpp"
+#include "orphans.hpp"
+#include "output_multiplexer.hpp"
+#include "relation_problems.hpp"
+#include "unusual_tags.hpp"
+#include "way_problems.hpp"
+
+static const char* const program_name = "odad-run-all";
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    bool untagged = true;
+    bool tagged = true;
+    size_t max_nodes = 1800;
+    std::size_t output_memory = OutputMultiplexer::default_memory_limit_mb;
+    Shard shard;
+    std::string exchange_dirname;
+    unsigned int exchange_timeout = shard::default_exchange_timeout_s;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+/**
+ * The single tools only read some object types in some passes, so the
+ * timestamps written to the stats databases are based on those types. This
+ * handler keeps track of all the different timestamps needed to get the
+ * same results.
+ */
+class LastTimestampsHandler : public osmium::handler::Handler {
+
+    LastTimestampHandler m_all;
+    LastTimestampHandler m_ways;
+    LastTimestampHandler m_relations;
+
+public:
+
+    void node(const osmium::Node& node) noexcept {
+        m_all.osm_object(node);
+    }
+
+    void way(const osmium::Way& way) noexcept {
+        m_all.osm_object(way);
+        m_ways.osm_object(way);
+    }
+
+    void relation(const osmium::Relation& relation) noexcept {
+        m_all.osm_object(relation);
+        m_relations.osm_object(relation);
+    }
+
+    osmium::Timestamp all() const noexcept {
+        return m_all.get_timestamp();
+    }
+
+    osmium::Timestamp ways() const noexcept {
+        return m_ways.get_timestamp();
+    }
+
+    osmium::Timestamp relations() const noexcept {
+        return m_relations.get_timestamp();
+    }
+
+}; // class LastTimestampsHandler
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n\n"
+              << "Run all checks reading the input file only as often as needed.\n"
+              << "\nThe output is the same as running all the odad-find-* commands.\n"
+              << "\nOptions:\n"
+              << "  -a, --min-age=DAYS      Only include objects at least DAYS days old\n"
+              << "  -b, --before=TIMESTAMP  Only include objects changed last before\n"
+              << "                          this time (format: yyyy-mm-ddThh:mm:ssZ)\n"
+              << "      --exchange-dir=DIR  Directory shared by all shards for exchanging data\n"
+              << "      --exchange-timeout=SECONDS\n"
+              << "                          Wait at most SECONDS for the other shards\n"
+              << "                          (default: 7200, 0 = forever)\n"
+              << "  -h, --help              This help message\n"
+              << "  -m, --max-nodes=NUM     Report ways with more nodes than this (default: 1800).\n"
+              << "  -M, --output-memory=MB  Memory for buffering output files in MBytes\n"
+              << "                          (default: 1024)\n"
+              << "      --mmap-input        Map input file into memory and read ahead\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --shard=K/N         Only check objects in shard K of N shards\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
+              << "  -q, --quiet             Work quietly\n"
+              << "  -u, --untagged-only     Untagged orphan objects only\n"
+              << "  -U, --no-untagged       No untagged orphan objects\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"age",     required_argument, nullptr, 'a'},
+        {"before",  required_argument, nullptr, 'b'},
+        {"help",          no_argument, nullptr, 'h'},
+        {"max-nodes", required_argument, nullptr, 'm'},
+        {"quiet",         no_argument, nullptr, 'q'},
+        {"untagged-only", no_argument, nullptr, 'u'},
+        {"no-untagged",   no_argument, nullptr, 'U'},
+        {"output-memory", required_argument, nullptr, 'M'},
+        {"mmap-input", no_argument, nullptr, 'R'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"shard", required_argument, nullptr, 'S'},
+        {"exchange-dir", required_argument, nullptr, 'X'},
+        {"exchange-timeout", required_argument, nullptr, 'W'},
+        {"trace", required_argument, nullptr, 'T'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "a:b:hm:M:quU", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'a':
+                if (options.before_time != osmium::end_of_time()) {
+                    std::cerr << "You can not use both -a,--age and -b,--before together\n";
+                    std::exit(2);
+                }
+                options.before_time = build_timestamp(optarg);
+                break;
+            case 'b':
+                if (options.before_time != osmium::end_of_time()) {
+                    std::cerr << "You can not use both -a,--age and -b,--before together\n";
+                    std::exit(2);
+                }
+                options.before_time = osmium::Timestamp{optarg};
+                break;
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'm':
+                options.max_nodes = std::atoi(optarg);
+                break;
+            case 'M':
+                options.output_memory = OutputMultiplexer::parse_memory_limit(optarg);
+                break;
+            case 'q':
+                options.verbose = false;
+                break;
+            case 'u':
+                options.tagged = false;
+                break;
+            case 'U':
+                options.untagged = false;
+                break;
+            case 'R':
+                options.mmap_input = true;
+                break;
+            case 'P':
+                options.perf_counters = true;
+                break;
+            case 'S':
+                options.shard = Shard{optarg};
+                break;
+            case 'X':
+                options.exchange_dirname = optarg;
+                break;
+            case 'W': {
+                    char* end = nullptr;
+                    const auto timeout = std::strtoul(optarg, &end, 10);
+                    if (*optarg == '\0' || *end != '\0' || timeout > std::numeric_limits<unsigned int>::max()) {
+                        std::cerr << "Invalid value for --exchange-timeout\n";
+                        std::exit(2);
+                    }
+                    options.exchange_timeout = static_cast<unsigned int>(timeout);
+                }
+                break;
+            case 'T':
+                options.trace_filename = optarg;
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    if (!options.tagged && !options.untagged) {
+        std::cerr << "Can not use -u,--untagged-only and -U,--no-untagged together.\n";
+        std::exit(2);
+    }
+
+    if (!options.shard.all() && options.exchange_dirname.empty()) {
+        std::cerr << "Need --exchange-dir when using --shard.\n";
+        std::exit(2);
+    }
+
+    const int remaining_args = argc - optind;
+    if (remaining_args != 2) {
+        std::cerr << "Usage: " << program_name << " [OPTIONS] OSM-FILE OUTPUT-DIR\n"
+                  << "Call '" << program_name << " --help' for usage information.\n";
+        std::exit(2);
+    }
+
+    return options;
+}
+
+static osmium::io::Header make_header(const char* generator) {
+    osmium::io::Header header;
+    header.set("generator", generator);
+    return header;
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string input_filename{argv[optind]};
+    const std::string output_dirname{argv[optind + 1]};
+
+    vout << "Command line options:\n";
+    vout << "  Reading from file '" << input_filename << "'\n";
+    vout << "  Writing to directory '" << output_dirname << "'\n";
+    vout << "  Shard: " << options.shard.to_string() << " (change with --shard)\n";
+    if (options.before_time == osmium::end_of_time()) {
+        vout << "  Get all objects independent of change timestamp (change with --age, -a or --before, -b)\n";
+    } else {
+        vout << "  Get only objects last changed before: " << options.before_time << " (change with --age, -a or --before, -b)\n";
+    }
+    vout << "  Finding untagged orphans: " << (options.untagged ? "yes" : "no") << " (change with --untagged, -u)\n";
+    vout << "  Finding tagged orphans: " << (options.tagged ? "yes" : "no") << " (change with --no-untagged, -U)\n";
+    vout << "  Memory for buffering output files: " << options.output_memory << " MBytes (change with --output-memory, -M)\n";
+
+    unusual_tags::options_type unusual_tags_options;
+    unusual_tags_options.before_time = options.before_time;
+    unusual_tags_options.shard = options.shard;
+
+    way_problems::options_type way_problems_options;
+    way_problems_options.before_time = options.before_time;
+    way_problems_options.max_nodes = options.max_nodes;
+    way_problems_options.shard = options.shard;
+
+    orphans::options_type orphans_options;
+    orphans_options.before_time = options.before_time;
+    orphans_options.untagged = options.untagged;
+    orphans_options.tagged = options.tagged;
+    orphans_options.shard = options.shard;
+
+    colocated_nodes::options_type colocated_nodes_options;
+    colocated_nodes_options.before_time = options.before_time;
+    colocated_nodes_options.shard = options.shard;
+
+    relation_problems::options_type relation_problems_options;
+    relation_problems_options.before_time = options.before_time;
+    relation_problems_options.shard = options.shard;
+
+    multipolygon_problems::options_type multipolygon_problems_options;
+    multipolygon_problems_options.shard = options.shard;
+
+    const osmium::io::File input_file{input_filename};
+    const auto file_size = osmium::util::file_size(input_filename);
+    osmium::ProgressBar progress_bar{file_size * 3, display_progress()};
+
+    LastTimestampsHandler timestamps_handler;
+
+    // All checks share one multiplexer, so the memory limit is for all
+    // output files together.
+    OutputMultiplexer multiplexer{options.output_memory};
+
+    unusual_tags::CheckHandler unusual_tags_handler{multiplexer, output_dirname, unusual_tags_options, make_header(unusual_tags::program_name)};
+    way_problems::CheckHandler way_problems_handler{multiplexer, output_dirname, way_problems_options};
+
+    osmium::nwr_array<orphans::id_set_type> orphans_index;
+    orphans::ReferencesHandler<orphans::id_set_type> orphans_references_handler{orphans_index};
+
+    std::unique_ptr<colocated_nodes::LocationExtractor> colocated_nodes_extractor{new colocated_nodes::LocationExtractor{output_dirname, colocated_nodes_options}};
+
+    Outputs relation_problems_outputs{multiplexer, output_dirname, "geoms-relation-problems", make_header(relation_problems::program_name)};
+    relation_problems::add_outputs(relation_problems_outputs);
+    relation_problems::CheckHandler relation_problems_handler{relation_problems_outputs, relation_problems_options};
+
+    Outputs multipolygon_problems_outputs{multiplexer, output_dirname, "geoms-multipolygon-problems", make_header(multipolygon_problems::program_name)};
+    multipolygon_problems::add_outputs(multipolygon_problems_outputs);
+    multipolygon_problems::CheckMPManager multipolygon_problems_manager{multipolygon_problems_outputs, multipolygon_problems_options};
+
+    shard::write_info(output_dirname, options.shard);
+
+    PhaseTimer timer{options.perf_counters};
+    trace::start(options.trace_filename);
+    if (options.mmap_input) {
+        input_mapping::start(input_filename);
+    }
+
+    vout << "First pass: Checking tags, ways, and relations, creating indexes...\n";
+    timer.start("first_pass");
+    {
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nwr};
+        if (input_file.format() == osmium::io::file_format::pbf && !has_locations_on_ways(reader.header())) {
+            std::cerr << "Input file must have locations on ways.\n";
+            return 2;
+        }
+
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            trace::Span span{"process_buffer"};
+            progress_bar.update(reader.offset());
+            timer.count(buffer);
+            osmium::apply(buffer,
+                          timestamps_handler,
+                          unusual_tags_handler,
+                          way_problems_handler,
+                          orphans_references_handler,
+                          *colocated_nodes_extractor,
+                          relation_problems_handler,
+                          multipolygon_problems_manager);
+        }
+        reader.close();
+    }
+    progress_bar.file_done(file_size);
+
+    unusual_tags_handler.close();
+    way_problems_handler.close();
+    relation_problems_handler.close();
+    colocated_nodes_extractor.reset();
+
+    relation_problems_outputs.prepare();
+    multipolygon_problems_manager.prepare_for_lookup();
+
+    progress_bar.remove();
+    relation_problems_outputs.print_index_stats(vout);
+    vout << "Finding locations with multiple nodes...\n";
+    timer.start("find_locations");
+    auto colocated_locations = colocated_nodes::find_locations(output_dirname, timer);
+    vout << "Found " << colocated_locations.size() << " locations with multiple nodes.\n";
+
+    if (!options.shard.all()) {
+        vout << "Exchanging locations with the other shards in '" << options.exchange_dirname << "'...\n";
+        timer.start("exchange_locations");
+        const ShardExchange exchange{options.exchange_dirname, options.shard, input_filename, colocated_nodes::exchange_run_id(options.before_time), options.exchange_timeout};
+        colocated_locations = colocated_nodes::exchange_locations(colocated_locations, exchange, vout);
+        vout << "Found " << colocated_locations.size() << " locations with multiple nodes in all shards.\n";
+    }
+
+    vout << "Second pass: Writing out orphans, colocated nodes, relation data, and checking multipolygons...\n";
+    timer.start("second_pass");
+    {
+        orphans::CheckHandler<orphans::id_set_type> orphans_handler{output_dirname, orphans_options, orphans_index};
+
+        osmium::io::Writer colocated_nodes_writer{osmium::io::File{output_dirname + "/colocated-nodes.osm.pbf"},
+                                                  make_header(colocated_nodes::program_name),
+                                                  osmium::io::overwrite::allow};
+        colocated_nodes::CheckHandler colocated_nodes_handler{output_dirname, colocated_nodes_writer, colocated_locations, options.shard};
+
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nwr};
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            trace::Span span{"process_buffer"};
+            progress_bar.update(reader.offset());
+            timer.count(buffer);
+            osmium::apply(buffer, orphans_handler, colocated_nodes_handler, multipolygon_problems_manager.handler());
+            for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                relation_problems_outputs.write_to_all(object);
+            }
+        }
+        reader.close();
+        multipolygon_problems_manager.close();
+
+        orphans_handler.close();
+        colocated_nodes_writer.close();
+
+        vout << "Writing out stats...\n";
+        write_stats(output_dirname + "/stats-orphans.db", timestamps_handler.all(), [&](std::function<void(const char*, uint64_t)>& add){
+            orphans::add_stats(orphans_handler.stats(), add);
+        });
+        write_stats(output_dirname + "/stats-colocated-nodes.db", timestamps_handler.all(), [&](std::function<void(const char*, uint64_t)>& add){
+            colocated_nodes::add_stats(colocated_nodes_handler.stats(), add);
+        });
+    }
+    progress_bar.file_done(file_size);
+
+    relation_problems_outputs.for_all([](Output& output) {
+        output.close_writer_all();
+    });
+
+    multipolygon_problems_outputs.for_all([&](Output& output){
+        output.close_writer_rel();
+    });
+    multipolygon_problems_outputs.prepare();
+
+    progress_bar.remove();
+    multipolygon_problems_outputs.print_index_stats(vout);
+    vout << "Third pass: Writing out multipolygon data...\n";
+    timer.start("third_pass");
+    {
+        osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nwr};
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            trace::Span span{"process_buffer"};
+            progress_bar.update(reader.offset());
+            timer.count(buffer);
+            for (const auto& object : buffer.select<osmium::OSMObject>()) {
+                multipolygon_problems_outputs.write_to_all(object);
+            }
+        }
+        reader.close();
+    }
+    progress_bar.done();
+
+    multipolygon_problems_outputs.for_all([](Output& output) {
+        output.close_writer_all();
+    });
+    timer.stop();
+
+    vout << "Writing out stats...\n";
+    write_stats(output_dirname + "/stats-unusual-tags.db", timestamps_handler.all(), [&](std::function<void(const char*, uint64_t)>& add){
+        unusual_tags::add_stats(unusual_tags_handler.stats(), add);
+    });
+    write_stats(output_dirname + "/stats-way-problems.db", timestamps_handler.ways(), [&](std::function<void(const char*, uint64_t)>& add){
+        way_problems::add_stats(way_problems_handler.stats(), add);
+    });
+    write_stats(output_dirname + "/stats-relation-problems.db", timestamps_handler.relations(), [&](std::function<void(const char*, uint64_t)>& add_stat){
+        relation_problems::add_stats(relation_problems_handler.stats(), relation_problems_outputs, add_stat);
+    });
+    write_stats(output_dirname + "/stats-multipolygon-problems.db", timestamps_handler.ways(), [&](std::function<void(const char*, uint64_t)>& add_stat){
+        multipolygon_problems::add_stats(multipolygon_problems_manager.stats(), multipolygon_problems_outputs, add_stat);
+    });
+    write_stats(output_dirname + "/stats-run-all.db", timestamps_handler.all(), [&](std::function<void(const char*, uint64_t)>& add){
+        timer.add_stats(add);
+    });
+
+    timer.print(vout);
+    multiplexer.print(vout);
+
+    trace::finish(options.trace_filename);
+
+    osmium::MemoryUsage memory_usage;
+    if (memory_usage.peak() != 0) {
+        vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
+    }
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
@@ -0,0 +1,312 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include "orphans_state.hpp"
+
+static const char* const program_name = "odad-update-orphans";
+
+struct options_type {
+    orphans::options_type orphans;
+    std::string init_filename;
+    uint64_t sequence = 0;
+    bool has_sequence = false;
+};
+
+static void print_usage() {
+    std::cerr << "Usage: " << program_name << " [OPTIONS] --init=OSM-FILE STATE-DIR\n"
+              << "       " << program_name << " [OPTIONS] STATE-DIR OUTPUT-DIR OSC-FILE...\n"
+              << "Call '" << program_name << " --help' for usage information.\n";
+}
+
+static void print_help() {
+    std::cout << program_name << " [OPTIONS] --init=OSM-FILE STATE-DIR\n"
+              << program_name << " [OPTIONS] STATE-DIR OUTPUT-DIR OSC-FILE...\n\n"
+              << "Keep track of references to all objects and find new orphans in change files.\n"
+              << "\nOptions:\n"
+              << "  -h, --help              This help message\n"
+              << "  -I, --ignore-keys=FILE  Also treat tags with keys from FILE (one per line)\n"
+              << "                          like created_by and source tags\n"
+              << "  -i, --init=OSM-FILE     Initialize state from OSM-FILE\n"
+              << "      --perf-counters     Measure hardware performance counters for each phase\n"
+              << "      --trace=FILE        Write trace of program run in Chrome trace format to FILE\n"
+              << "  -q, --quiet             Work quietly\n"
+              << "      --sequence=NUM      Sequence number of the (first) change file or of\n"
+              << "                          the OSM-FILE given with --init\n"
+              << "  -u, --untagged-only     Untagged objects only\n"
+              << "  -U, --no-untagged       No untagged objects\n"
+              ;
+}
+
+static options_type parse_command_line(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"help",          no_argument, nullptr, 'h'},
+        {"ignore-keys", required_argument, nullptr, 'I'},
+        {"init",    required_argument, nullptr, 'i'},
+        {"quiet",         no_argument, nullptr, 'q'},
+        {"untagged-only", no_argument, nullptr, 'u'},
+        {"no-untagged",   no_argument, nullptr, 'U'},
+        {"perf-counters", no_argument, nullptr, 'P'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"sequence", required_argument, nullptr, 'N'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    options_type options;
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hI:i:quU", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'h':
+                print_help();
+                std::exit(0);
+            case 'I':
+                options.orphans.ignore_keys_filename = optarg;
+                break;
+            case 'i':
+                options.init_filename = optarg;
+                break;
+            case 'q':
+                options.orphans.verbose = false;
+                break;
+            case 'u':
+                options.orphans.tagged = false;
+                break;
+            case 'U':
+                options.orphans.untagged = false;
+                break;
+            case 'P':
+                options.orphans.perf_counters = true;
+                break;
+            case 'T':
+                options.orphans.trace_filename = optarg;
+                break;
+            case 'N': {
+                    // strtoull() would accept leading spaces and signs
+                    char* end = nullptr;
+                    errno = 0;
+                    options.sequence = std::strtoull(optarg, &end, 10);
+                    if (*optarg < '0' || *optarg > '9' || errno != 0 || !end || *end != '\0') {
+                        std::cerr << "Invalid value for --sequence: " << optarg << '\n';
+                        std::exit(2);
+                    }
+                    options.has_sequence = true;
+                }
+                break;
+            default:
+                std::exit(2);
+        }
+    }
+
+    if (!options.orphans.tagged && !options.orphans.untagged) {
+        std::cerr << "Can not use -u,--untagged-only and -U,--no-untagged together.\n";
+        std::exit(2);
+    }
+
+    const int remaining_args = argc - optind;
+    if (options.init_filename.empty() ? remaining_args < 3 : remaining_args != 1) {
+        print_usage();
+        std::exit(2);
+    }
+
+    return options;
+}
+
+/**
+ * Check that the state is consistent and the change files are the next
+ * ones in sequence. Returns the status to set after the change files were
+ * applied.
+ */
+static orphans_state::status_type check_status(const options_type& options, const std::string& state_dirname, std::size_t num_change_files) {
+    auto status = orphans_state::read_status(state_dirname);
+    if (!status.clean) {
+        throw std::runtime_error{"Orphans state in '" + state_dirname + "' is inconsistent, because an earlier run was interrupted. Initialize it again with --init."};
+    }
+
+    if (status.has_sequence) {
+        if (!options.has_sequence) {
+            throw std::runtime_error{"Orphans state is at sequence " + std::to_string(status.sequence) + ", use --sequence to give the sequence number of the first change file"};
+        }
+        if (options.sequence != status.sequence + 1) {
+            throw std::runtime_error{"Orphans state is at sequence " + std::to_string(status.sequence) + ", expected change files starting at sequence " + std::to_string(status.sequence + 1) + " not " + std::to_string(options.sequence)};
+        }
+    }
+
+    status.has_sequence = options.has_sequence;
+    status.sequence = options.sequence + num_change_files - 1;
+    return status;
+}
+
+static void init_state(const options_type& options, orphans_state::State& state, PhaseTimer& timer, osmium::util::VerboseOutput& vout) {
+    vout << "Initializing state from '" << options.init_filename << "'...\n";
+    timer.start("init");
+
+    state.track_changes(false);
+
+    osmium::io::Reader reader{options.init_filename, osmium::osm_entity_bits::nwr};
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        trace::Span span{"process_buffer"};
+        progress_bar.update(reader.offset());
+        timer.count(buffer);
+        osmium::apply(buffer, state);
+    }
+    progress_bar.done();
+    reader.close();
+}
+
+static void apply_changes(const std::vector<std::string>& filenames, const std::string& output_dirname, orphans_state::State& state, PhaseTimer& timer, osmium::util::VerboseOutput& vout) {
+    timer.start("apply_changes");
+    LastTimestampHandler last_timestamp_handler;
+    for (const auto& filename : filenames) {
+        vout << "Applying changes from '" << filename << "'...\n";
+        osmium::io::Reader reader{filename, osmium::osm_entity_bits::nwr};
+        while (osmium::memory::Buffer buffer = read_traced(reader)) {
+            trace::Span span{"process_buffer"};
+            timer.count(buffer);
+            osmium::apply(buffer, last_timestamp_handler, state);
+        }
+        reader.close();
+    }
+
+    vout << "Writing out new orphans...\n";
+    timer.start("find_orphans");
+
+    orphans::stats_type stats;
+    const std::string orphans_filename{output_dirname + "/new-orphans.txt"};
+    std::ofstream file{orphans_filename};
+    state.for_each_new_orphan([&](osmium::item_type type, osmium::unsigned_object_id_type id) {
+        file << osmium::item_type_to_char(type) << id << '\n';
+        switch (type) {
+            case osmium::item_type::node:
+                ++stats.orphan_nodes;
+                break;
+            case osmium::item_type::way:
+                ++stats.orphan_ways;
+                break;
+            default:
+                ++stats.orphan_relations;
+        }
+    });
+    file.close();
+    if (!file) {
+        throw std::runtime_error{"Can't write file '" + orphans_filename + "'"};
+    }
+
+    vout << "Found " << stats.orphan_nodes << " nodes, "
+         << stats.orphan_ways << " ways, and "
+         << stats.orphan_relations << " relations.\n";
+
+    timer.stop();
+
+    vout << "Writing out stats...\n";
+    write_stats(output_dirname + "/stats-orphans-incremental.db", last_timestamp_handler.get_timestamp(), [&](std::function<void(const char*, uint64_t)>& add){
+        orphans::add_stats(stats, add);
+        timer.add_stats(add);
+    });
+}
+
+int main(int argc, char* argv[]) try {
+    const auto options = parse_command_line(argc, argv);
+
+    osmium::util::VerboseOutput vout{options.orphans.verbose};
+    vout << "Starting " << program_name << "...\n";
+
+    const std::string state_dirname{argv[optind]};
+
+    vout << "Command line options:\n";
+    vout << "  State directory '" << state_dirname << "'\n";
+    vout << "  Finding untagged objects: " << (options.orphans.untagged ? "yes" : "no") << " (change with --untagged, -u)\n";
+    vout << "  Finding tagged objects: " << (options.orphans.tagged ? "yes" : "no") << " (change with --no-untagged, -U)\n";
+
+    PhaseTimer timer{options.orphans.perf_counters};
+    trace::start(options.orphans.trace_filename);
+
+    orphans_state::status_type status;
+    if (options.init_filename.empty()) {
+        status = check_status(options, state_dirname, static_cast<std::size_t>(argc - optind - 2));
+    } else {
+        orphans_state::State::remove_files(state_dirname);
+        status.has_sequence = options.has_sequence;
+        status.sequence = options.sequence;
+    }
+
+    // Mark the state as dirty while it is changed, so it isn't used again
+    // if this run is interrupted.
+    orphans_state::write_status(state_dirname, orphans_state::status_type{});
+
+    {
+        orphans_state::State state{state_dirname, options.orphans, status};
+
+        if (options.init_filename.empty()) {
+            const std::string output_dirname{argv[optind + 1]};
+            const std::vector<std::string> filenames(argv + optind + 2, argv + argc);
+            apply_changes(filenames, output_dirname, state, timer, vout);
+        } else {
+            init_state(options, state, timer, vout);
+        }
+
+        vout << "Saving state...\n";
+        timer.start("save_state");
+        state.save(status);
+    }
+    status.clean = true;
+    orphans_state::write_status(state_dirname, status);
+    timer.stop();
+
+    timer.print(vout);
+
+    trace::finish(options.orphans.trace_filename);
+
+    osmium::MemoryUsage memory_usage;
+    if (memory_usage.peak() != 0) {
+        vout << "Peak memory usage: " << memory_usage.peak() << " MBytes\n";
+    }
+
+    vout << "Done with " << program_name << ".\n";
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
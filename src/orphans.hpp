@@ -0,0 +1,441 @@
+#ifndef ORPHANS_HPP
+#define ORPHANS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <osmium/index/nwr_array.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/osm/timestamp.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include <gdalcpp.hpp>
+
+#include "concurrent_id_set.hpp"
+#include "id_set_compressed.hpp"
+#include "tag_classifier.hpp"
+#include "utils.hpp"
+
+namespace orphans {
+
+static const char* const program_name = "odad-find-orphans";
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    bool untagged = true;
+    bool tagged = true;
+    bool single_pass = false;
+    Shard shard;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string index_type{"dense"};
+    std::string ref_index_filename;
+    std::string ignore_keys_filename;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t orphan_nodes = 0;
+    uint64_t orphan_ways = 0;
+    uint64_t orphan_relations = 0;
+};
+
+// Can be filled from several threads at the same time
+using id_set_type = ConcurrentIdSetDense<osmium::unsigned_object_id_type>;
+
+// Uses much less memory on extracts, but is filled from one thread only
+using compressed_id_set_type = IdSetCompressed<osmium::unsigned_object_id_type>;
+
+/**
+ * Handler filling the index of all objects referenced from ways and
+ * relations.
+ */
+template <typename TIdSet>
+class ReferencesHandler : public osmium::handler::Handler {
+
+    osmium::nwr_array<TIdSet>& m_index;
+
+public:
+
+    explicit ReferencesHandler(osmium::nwr_array<TIdSet>& index) :
+        m_index(index) {
+    }
+
+    void way(const osmium::Way& way) {
+        // Way nodes often have consecutive IDs, add them as ranges.
+        const auto& nodes = way.nodes();
+        auto it = nodes.begin();
+        while (it != nodes.end()) {
+            const auto first = it->positive_ref();
+            auto last = first;
+            for (++it; it != nodes.end() && it->positive_ref() == last + 1; ++it) {
+                ++last;
+            }
+            m_index(osmium::item_type::node).set_range(first, last);
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        for (const auto& member : relation.members()) {
+            m_index(member.type()).set(member.positive_ref());
+        }
+    }
+
+}; // class ReferencesHandler
+
+/**
+ * Task for the thread pool adding all references from the objects in a
+ * buffer to the index.
+ */
+template <typename TIdSet>
+class ReferencesTask {
+
+    std::shared_ptr<osmium::memory::Buffer> m_buffer;
+    osmium::nwr_array<TIdSet>* m_index;
+
+public:
+
+    ReferencesTask(std::shared_ptr<osmium::memory::Buffer> buffer, osmium::nwr_array<TIdSet>& index) :
+        m_buffer(std::move(buffer)),
+        m_index(&index) {
+    }
+
+    void operator()() const {
+        trace::Span span{"ReferencesTask"};
+        ReferencesHandler<TIdSet> handler{*m_index};
+        osmium::apply(*m_buffer, handler);
+    }
+
+}; // class ReferencesTask
+
+/**
+ * Hands buffers to the osmium thread pool where the references are added
+ * to the index, so the work is spread over all cores. The number of
+ * buffers in flight is limited to keep memory use in check.
+ *
+ * Index types that can't be filled from several threads at the same time
+ * are filled directly in submit().
+ */
+template <typename TIdSet>
+class ReferencesDispatcher {
+
+    osmium::nwr_array<TIdSet>& m_index;
+    osmium::thread::Pool& m_pool;
+    std::size_t m_max_in_flight;
+    std::deque<std::future<void>> m_in_flight;
+
+public:
+
+    explicit ReferencesDispatcher(osmium::nwr_array<TIdSet>& index) :
+        m_index(index),
+        m_pool(osmium::thread::Pool::default_instance()),
+        m_max_in_flight(static_cast<std::size_t>(m_pool.num_threads()) * 2) {
+    }
+
+    ReferencesDispatcher(const ReferencesDispatcher&) = delete;
+    ReferencesDispatcher& operator=(const ReferencesDispatcher&) = delete;
+
+    /**
+     * Wait for all tasks still in flight, because they write into the
+     * index. This only happens if there was an error, so errors in the
+     * tasks are ignored here. (The futures from the thread pool don't
+     * wait in their destructor.)
+     */
+    ~ReferencesDispatcher() {
+        for (auto& future : m_in_flight) {
+            if (future.valid()) {
+                future.wait();
+            }
+        }
+    }
+
+    void submit(std::shared_ptr<osmium::memory::Buffer> buffer) {
+        if (!TIdSet::concurrent) {
+            ReferencesTask<TIdSet>{std::move(buffer), m_index}();
+            return;
+        }
+
+        if (m_in_flight.size() >= m_max_in_flight) {
+            trace::Span span{"wait_for_task"};
+            auto future = std::move(m_in_flight.front());
+            m_in_flight.pop_front();
+            future.get();
+        }
+
+        m_in_flight.push_back(m_pool.submit(ReferencesTask<TIdSet>{std::move(buffer), m_index}));
+    }
+
+    /// Wait for all tasks to finish and prepare the index for lookups.
+    void wait() {
+        while (!m_in_flight.empty()) {
+            auto future = std::move(m_in_flight.front());
+            m_in_flight.pop_front();
+            future.get();
+        }
+
+        trace::Span span{"optimize_index"};
+        m_index(osmium::item_type::node).optimize();
+        m_index(osmium::item_type::way).optimize();
+        m_index(osmium::item_type::relation).optimize();
+    }
+
+}; // class ReferencesDispatcher
+
+/**
+ * Reads all ways and relations and creates the index of all referenced
+ * objects.
+ */
+template <typename TIdSet>
+inline osmium::nwr_array<TIdSet> create_index_of_referenced_objects(const osmium::io::File& input_file, osmium::ProgressBar& progress_bar, PhaseTimer& timer) {
+    osmium::nwr_array<TIdSet> index;
+    ReferencesDispatcher<TIdSet> dispatcher{index};
+
+    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation};
+
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        progress_bar.update(reader.offset());
+        timer.count(buffer);
+        dispatcher.submit(std::make_shared<osmium::memory::Buffer>(std::move(buffer)));
+    }
+
+    dispatcher.wait();
+    reader.close();
+
+    return index;
+}
+
+/**
+ * Returns the set of keys of tags that don't say anything about what an
+ * object is: created_by, source, and the keys from the file set with
+ * --ignore-keys.
+ */
+inline KeyClassifier create_ignored_keys(const options_type& options) {
+    KeyClassifier keys{"created_by", "source"};
+    if (!options.ignore_keys_filename.empty()) {
+        keys.add_keys_from_file(options.ignore_keys_filename);
+    }
+    return keys;
+}
+
+/**
+ * Is this object an orphan if it is not referenced from anywhere? This
+ * checks the shard, the timestamp, and the tags.
+ */
+inline bool is_candidate(const osmium::OSMObject& object, const options_type& options, const KeyClassifier& ignored_keys) {
+    if (object.timestamp() >= options.before_time || !options.shard.contains(object)) {
+        return false;
+    }
+
+    if (object.tags().empty()) {
+        return options.untagged;
+    }
+
+    return options.tagged && ignored_keys.all_of(object.tags());
+}
+
+/**
+ * Handler writing all objects that could be orphans into a temporary file.
+ * This is usually a small part of the input data.
+ */
+class CandidatesHandler : public osmium::handler::Handler {
+
+    options_type m_options;
+    KeyClassifier m_ignored_keys;
+    osmium::io::Writer m_writer;
+    uint64_t m_count = 0;
+
+public:
+
+    CandidatesHandler(const std::string& filename, const options_type& options) :
+        m_options(options),
+        m_ignored_keys(create_ignored_keys(options)),
+        m_writer(osmium::io::File{filename, "pbf,locations_on_ways=true"}, osmium::io::overwrite::allow) {
+    }
+
+    void osm_object(const osmium::OSMObject& object) {
+        if (is_candidate(object, m_options, m_ignored_keys)) {
+            m_writer(object);
+            ++m_count;
+        }
+    }
+
+    void close() {
+        m_writer.close();
+    }
+
+    uint64_t count() const noexcept {
+        return m_count;
+    }
+
+}; // class CandidatesHandler
+
+/**
+ * Reads the input file once creating the index of referenced objects and
+ * writing out all objects that could be orphans into the candidates file
+ * at the same time.
+ */
+template <typename TIdSet, typename... THandlers>
+inline osmium::nwr_array<TIdSet> collect_candidates_and_references(const osmium::io::File& input_file, CandidatesHandler& candidates_handler, osmium::ProgressBar& progress_bar, PhaseTimer& timer, THandlers&... handlers) {
+    osmium::nwr_array<TIdSet> index;
+    ReferencesDispatcher<TIdSet> dispatcher{index};
+
+    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::nwr};
+
+    while (osmium::memory::Buffer buffer = read_traced(reader)) {
+        progress_bar.update(reader.offset());
+        timer.count(buffer);
+
+        // The buffer is only read from here, so it can be used in the
+        // references task at the same time.
+        auto shared_buffer = std::make_shared<osmium::memory::Buffer>(std::move(buffer));
+        dispatcher.submit(shared_buffer);
+
+        trace::Span span{"process_buffer"};
+        osmium::apply(*shared_buffer, candidates_handler, handlers...);
+    }
+
+    dispatcher.wait();
+    reader.close();
+    candidates_handler.close();
+
+    return index;
+}
+
+template <typename TIdSet>
+class CheckHandler : public HandlerWithDB {
+
+    options_type m_options;
+    stats_type m_stats;
+
+    gdalcpp::Layer m_layer_orphan_nodes;
+    gdalcpp::Layer m_layer_orphan_ways;
+
+    KeyClassifier m_ignored_keys;
+
+    osmium::nwr_array<TIdSet>& m_index;
+    osmium::nwr_array<std::unique_ptr<osmium::io::Writer>> m_writers;
+
+public:
+
+    CheckHandler(const std::string& output_dirname, const options_type& options, osmium::nwr_array<TIdSet>& index) :
+        HandlerWithDB(output_dirname + "/geoms-orphans.db"),
+        m_options(options),
+        m_layer_orphan_nodes(m_dataset, "orphan_nodes", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_orphan_ways(m_dataset, "orphan_ways", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_ignored_keys(create_ignored_keys(options)),
+        m_index(index) {
+        m_layer_orphan_nodes.add_field("node_id", OFTReal, 12);
+        m_layer_orphan_nodes.add_field("timestamp", OFTString, 20);
+
+        m_layer_orphan_ways.add_field("way_id", OFTInteger, 10);
+        m_layer_orphan_ways.add_field("timestamp", OFTString, 20);
+
+        osmium::io::Header header;
+        header.set("generator", program_name);
+        m_writers(osmium::item_type::node).reset(new osmium::io::Writer{output_dirname + "/n-orphans.osm.pbf", header, osmium::io::overwrite::allow});
+        m_writers(osmium::item_type::way).reset(new osmium::io::Writer{output_dirname + "/w-orphans.osm.pbf", header, osmium::io::overwrite::allow});
+        m_writers(osmium::item_type::relation).reset(new osmium::io::Writer{output_dirname + "/r-orphans.osm.pbf", header, osmium::io::overwrite::allow});
+    }
+
+    void node(const osmium::Node& node) {
+        if (m_index(osmium::item_type::node).get(node.positive_id())) {
+            return;
+        }
+
+        if (is_candidate(node, m_options, m_ignored_keys)) {
+            (*m_writers(osmium::item_type::node))(node);
+            ++m_stats.orphan_nodes;
+            gdalcpp::Feature feature{m_layer_orphan_nodes, m_factory.create_point(node)};
+            feature.set_field("node_id", static_cast<double>(node.id()));
+            const auto ts = node.timestamp().to_iso();
+            feature.set_field("timestamp", ts.c_str());
+            add_to_layer(feature);
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (m_index(osmium::item_type::way).get(way.positive_id())) {
+            return;
+        }
+
+        if (is_candidate(way, m_options, m_ignored_keys)) {
+            (*m_writers(osmium::item_type::way))(way);
+            ++m_stats.orphan_ways;
+            try {
+                gdalcpp::Feature feature{m_layer_orphan_ways, m_factory.create_linestring(way)};
+                feature.set_field("way_id", static_cast<double>(way.id()));
+                const auto ts = way.timestamp().to_iso();
+                feature.set_field("timestamp", ts.c_str());
+                add_to_layer(feature);
+            } catch (const osmium::geometry_error&) {
+                // ignore geometry errors
+            }
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        if (m_index(osmium::item_type::relation).get(relation.positive_id())) {
+            return;
+        }
+
+        if (is_candidate(relation, m_options, m_ignored_keys)) {
+            (*m_writers(osmium::item_type::relation))(relation);
+            ++m_stats.orphan_relations;
+        }
+    }
+
+    void close() {
+        m_writers(osmium::item_type::node)->close();
+        m_writers(osmium::item_type::way)->close();
+        m_writers(osmium::item_type::relation)->close();
+    }
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class CheckHandler
+
+inline void add_stats(const stats_type& stats, std::function<void(const char*, uint64_t)>& add) {
+    add("orphan_nodes", stats.orphan_nodes);
+    add("orphan_ways", stats.orphan_ways);
+    add("orphan_relations", stats.orphan_relations);
+}
+
+} // namespace orphans
+
+#endif // ORPHANS_HPP
@@ -0,0 +1,783 @@
+#ifndef ORPHANS_STATE_HPP
+#define ORPHANS_STATE_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <osmium/handler.hpp>
+#include <osmium/index/nwr_array.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include "orphans.hpp"
+#include "tag_classifier.hpp"
+#include "varint.hpp"
+
+/**
+ * On-disk state for incremental orphan tracking (odad-update-orphans).
+ *
+ * For each object the state contains the number of references to it and
+ * whether it exists and is untagged or minimally tagged. For each way and
+ * relation the list of node refs or members is kept, so the references of
+ * the old version can be removed when a new version comes in through a
+ * change file.
+ *
+ * The state files are changed in place. A status file records whether the
+ * state is consistent and which change file was applied last, see
+ * status_type.
+ */
+namespace orphans_state {
+
+namespace detail {
+
+    /**
+     * Write a small file atomically: write to a temporary file, sync it,
+     * and rename it to the final name.
+     */
+    template <typename TFunc>
+    void write_file_atomically(const std::string& filename, TFunc&& func) {
+        const std::string tmp_filename{filename + ".tmp"};
+        {
+            std::ofstream file{tmp_filename, std::ios::binary | std::ios::trunc};
+            std::forward<TFunc>(func)(file);
+            file.close();
+            if (!file) {
+                ::unlink(tmp_filename.c_str());
+                throw std::runtime_error{std::string{"Can't write file '"} + tmp_filename + "'"};
+            }
+        }
+
+        const int fd = ::open(tmp_filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0 || ::fsync(fd) != 0) {
+            const int error = errno;
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            ::unlink(tmp_filename.c_str());
+            throw std::system_error{error, std::system_category(), std::string{"Can't sync file '"} + tmp_filename + "'"};
+        }
+        ::close(fd);
+
+        if (::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            const int error = errno;
+            ::unlink(tmp_filename.c_str());
+            throw std::system_error{error, std::system_category(), std::string{"Can't rename '"} + tmp_filename + "' to '" + filename + "'"};
+        }
+    }
+
+} // namespace detail
+
+/**
+ * Status of the state directory, kept in the file "status". It is set to
+ * dirty before any state file is changed and back to clean after all of
+ * them were saved. A dirty state is inconsistent, because a run was
+ * interrupted while changing it, it has to be initialized again.
+ *
+ * The sequence number of the last change file applied is kept if it is
+ * known, so that change files are not applied twice or skipped. The
+ * status also contains the number of garbage bytes in the data files of
+ * the list stores (see ListStore).
+ */
+struct status_type {
+    bool clean = false;
+    bool has_sequence = false;
+    uint64_t sequence = 0;
+    uint64_t way_nodes_garbage = 0;
+    uint64_t relation_members_garbage = 0;
+};
+
+inline std::string status_filename(const std::string& dirname) {
+    return dirname + "/status";
+}
+
+/// Read status of the state. Throws if there is no state in the directory.
+inline status_type read_status(const std::string& dirname) {
+    std::ifstream file{status_filename(dirname)};
+    std::string clean;
+    std::string sequence;
+    if (!(file >> clean >> sequence) || (clean != "clean" && clean != "dirty")) {
+        throw std::runtime_error{std::string{"No orphans state in '"} + dirname + "', initialize it with --init"};
+    }
+
+    status_type status;
+    status.clean = clean == "clean";
+    if (sequence != "-") {
+        status.has_sequence = true;
+        status.sequence = std::stoull(sequence);
+    }
+    if (!(file >> status.way_nodes_garbage >> status.relation_members_garbage)) {
+        status.clean = false;
+    }
+    return status;
+}
+
+inline void write_status(const std::string& dirname, const status_type& status) {
+    detail::write_file_atomically(status_filename(dirname), [&](std::ofstream& file) {
+        file << (status.clean ? "clean" : "dirty") << ' ';
+        if (status.has_sequence) {
+            file << status.sequence;
+        } else {
+            file << '-';
+        }
+        file << ' ' << status.way_nodes_garbage << ' ' << status.relation_members_garbage << '\n';
+    });
+}
+
+/**
+ * Array of T in a file, memory mapped. The file grows when elements past
+ * the end are accessed. New elements are zero. The file is sparse, so
+ * large unused ID ranges don't need disk space.
+ */
+template <typename T>
+class MappedFileArray {
+
+    // Grow in steps of at least this many elements.
+    constexpr static const std::size_t min_growth = 1024 * 1024;
+
+    std::string m_filename;
+    int m_fd;
+    std::size_t m_size = 0;
+    std::unique_ptr<osmium::util::MemoryMapping> m_mapping;
+
+    void map(std::size_t size) {
+        m_mapping.reset();
+        if (size > 0) {
+            m_mapping.reset(new osmium::util::MemoryMapping{size * sizeof(T), osmium::util::MemoryMapping::mapping_mode::write_shared, m_fd});
+        }
+        m_size = size;
+    }
+
+    void grow(std::size_t min_size) {
+        const std::size_t new_size = std::max(min_size + min_growth, m_size + m_size / 2);
+        if (::ftruncate(m_fd, static_cast<off_t>(new_size * sizeof(T))) != 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't resize file '"} + m_filename + "'"};
+        }
+        map(new_size);
+    }
+
+public:
+
+    explicit MappedFileArray(const std::string& filename) :
+        m_filename(filename),
+        m_fd(::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666)) { // NOLINT(hicpp-signed-bitwise)
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + filename + "'"};
+        }
+        map(osmium::util::file_size(m_fd) / sizeof(T));
+    }
+
+    MappedFileArray(const MappedFileArray&) = delete;
+    MappedFileArray& operator=(const MappedFileArray&) = delete;
+
+    ~MappedFileArray() {
+        m_mapping.reset();
+        ::close(m_fd);
+    }
+
+    /// The number of elements, accessing elements past this grows the file.
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    T get(std::size_t n) const noexcept {
+        return n < m_size ? m_mapping->get_addr<T>()[n] : T{};
+    }
+
+    T& at(std::size_t n) {
+        if (n >= m_size) {
+            grow(n + 1);
+        }
+        return m_mapping->get_addr<T>()[n];
+    }
+
+    /// Write all changes to disk.
+    void sync() {
+        if (m_mapping && ::msync(m_mapping->get_addr<char>(), m_mapping->size(), MS_SYNC) != 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't sync file '"} + m_filename + "'"};
+        }
+        if (::fsync(m_fd) != 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't sync file '"} + m_filename + "'"};
+        }
+    }
+
+}; // class MappedFileArray
+
+/**
+ * Reference counts and flags for all objects of one type, one byte per
+ * object ID. Counts too large for the byte are kept in an overflow map
+ * which is stored in a separate file.
+ */
+class RefCounts {
+
+public:
+
+    enum : uint8_t {
+        exists    = 0x80U,
+        untagged  = 0x40U,
+        minimally_tagged = 0x20U,
+        count_mask = 0x1fU
+    };
+
+private:
+
+    MappedFileArray<uint8_t> m_data;
+    std::string m_overflow_filename;
+    std::map<osmium::unsigned_object_id_type, uint64_t> m_overflow;
+
+    std::map<osmium::unsigned_object_id_type, uint64_t>::iterator find_overflow(osmium::unsigned_object_id_type id) {
+        const auto it = m_overflow.find(id);
+        if (it == m_overflow.end()) {
+            throw std::runtime_error{std::string{"Inconsistent orphans state: no overflow count for ID "} + std::to_string(id) + " in '" + m_overflow_filename + "', initialize the state again"};
+        }
+        return it;
+    }
+
+public:
+
+    explicit RefCounts(const std::string& filename) :
+        m_data(filename),
+        m_overflow_filename(filename + ".overflow") {
+        std::ifstream file{m_overflow_filename, std::ios::binary};
+        std::pair<osmium::unsigned_object_id_type, uint64_t> entry;
+        while (file.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+            m_overflow.insert(entry);
+        }
+    }
+
+    /// Write counts and overflow map to disk.
+    void save() {
+        m_data.sync();
+        detail::write_file_atomically(m_overflow_filename, [&](std::ofstream& file) {
+            for (const auto& entry : m_overflow) {
+                const std::pair<osmium::unsigned_object_id_type, uint64_t> e{entry};
+                file.write(reinterpret_cast<const char*>(&e), sizeof(e));
+            }
+        });
+    }
+
+    uint8_t flags(osmium::unsigned_object_id_type id) const noexcept {
+        return m_data.get(id) & ~count_mask;
+    }
+
+    void set_flags(osmium::unsigned_object_id_type id, uint8_t flags) {
+        auto& value = m_data.at(id);
+        value = static_cast<uint8_t>((value & count_mask) | flags);
+    }
+
+    uint64_t count(osmium::unsigned_object_id_type id) {
+        const auto c = m_data.get(id) & count_mask;
+        if (c == count_mask) {
+            return find_overflow(id)->second;
+        }
+        return c;
+    }
+
+    void increment(osmium::unsigned_object_id_type id) {
+        auto& value = m_data.at(id);
+        const auto c = value & count_mask;
+        if (c == count_mask) {
+            ++m_overflow[id];
+        } else if (c == count_mask - 1) {
+            value |= count_mask;
+            m_overflow[id] = count_mask;
+        } else {
+            ++value;
+        }
+    }
+
+    /// Decrement count, returns true if it is 0 afterwards.
+    bool decrement(osmium::unsigned_object_id_type id) {
+        auto& value = m_data.at(id);
+        const auto c = value & count_mask;
+        if (c == count_mask) {
+            const auto it = find_overflow(id);
+            if (--it->second >= count_mask) {
+                return false;
+            }
+            value = static_cast<uint8_t>((value & ~count_mask) | it->second);
+            m_overflow.erase(it);
+            return false;
+        }
+        if (c == 0) {
+            // Can happen if the state and the change files don't match.
+            return true;
+        }
+        --value;
+        return c == 1;
+    }
+
+}; // class RefCounts
+
+/**
+ * Lists of IDs (way node refs or relation members) for all ways or all
+ * relations. The index file contains the offset of the current list for
+ * each object ID in the data file (0 if there is none).
+ *
+ * Each list is stored in a slot: the capacity of the slot in bytes, then
+ * the number of IDs and the IDs as differences to the previous ID, all
+ * varint encoded. A changed list is written into its old slot if it fits,
+ * otherwise it is appended to the data file. The bytes of slots which are
+ * not used any more are counted as garbage. When the garbage is more than
+ * half of the data file, sync() compacts the file by copying all current
+ * lists into a new file. The garbage count is kept in the status file.
+ */
+class ListStore {
+
+    constexpr static const std::size_t max_buffer_size = 1024 * 1024;
+
+    // Enough for the capacity of any slot.
+    constexpr static const std::size_t max_header_size = 10;
+
+    MappedFileArray<uint64_t> m_index;
+    std::string m_data_filename;
+    int m_fd;
+    uint64_t m_end;
+    uint64_t m_garbage;
+    std::vector<unsigned char> m_buffer;
+    std::vector<unsigned char> m_encoded;
+
+    static void encode(const std::vector<uint64_t>& list, std::vector<unsigned char>& out) {
+        out.clear();
+        varint::append(out, list.size());
+        uint64_t last = 0;
+        for (const auto value : list) {
+            varint::append(out, varint::zigzag(static_cast<int64_t>(value - last)));
+            last = value;
+        }
+    }
+
+    static void decode(const unsigned char* data, std::vector<uint64_t>& list) {
+        list.resize(varint::decode(&data));
+        uint64_t last = 0;
+        for (auto& value : list) {
+            last += static_cast<uint64_t>(varint::unzigzag(varint::decode(&data)));
+            value = last;
+        }
+    }
+
+    void read_at(uint64_t offset, void* data, std::size_t size) const {
+        if (::pread(m_fd, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size)) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't read from file '"} + m_data_filename + "'"};
+        }
+    }
+
+    void write_at(int fd, uint64_t offset, const std::vector<unsigned char>& data) const {
+        if (::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)) != static_cast<ssize_t>(data.size())) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't write to file '"} + m_data_filename + "'"};
+        }
+    }
+
+    void flush() {
+        if (m_buffer.empty()) {
+            return;
+        }
+        write_at(m_fd, m_end - m_buffer.size(), m_buffer);
+        m_buffer.clear();
+    }
+
+    /// Read header of the slot at offset, returns capacity and header size.
+    std::pair<uint64_t, std::size_t> read_header(uint64_t offset) const {
+        unsigned char header[max_header_size];
+        read_at(offset, header, static_cast<std::size_t>(std::min(static_cast<uint64_t>(max_header_size), m_end - offset)));
+        const unsigned char* ptr = header;
+        const auto capacity = varint::decode(&ptr);
+        return {capacity, static_cast<std::size_t>(ptr - header)};
+    }
+
+    /// Append new slot with the data in m_encoded, returns its offset.
+    uint64_t append_slot(std::vector<unsigned char>& buffer, uint64_t& end) const {
+        const auto offset = end;
+        const auto size = buffer.size();
+        varint::append(buffer, m_encoded.size());
+        buffer.insert(buffer.end(), m_encoded.begin(), m_encoded.end());
+        end += buffer.size() - size;
+        return offset;
+    }
+
+    /**
+     * Copy all current lists into a new data file and replace the old one
+     * with it. The status must be dirty while this happens, because the
+     * index is changed in place.
+     */
+    void compact() {
+        flush();
+
+        const std::string tmp_filename{m_data_filename + ".tmp"};
+        const int fd = ::open(tmp_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + tmp_filename + "'"};
+        }
+
+        try {
+            // Offset 0 is used in the index to mark missing lists.
+            std::vector<unsigned char> buffer(1, 0);
+            buffer.reserve(max_buffer_size);
+            uint64_t end = 1;
+
+            std::vector<uint64_t> list;
+            for (std::size_t id = 0; id < m_index.size(); ++id) {
+                if (m_index.get(id) == 0) {
+                    continue;
+                }
+                get(id, list);
+                encode(list, m_encoded);
+                m_index.at(id) = append_slot(buffer, end);
+                if (buffer.size() >= max_buffer_size) {
+                    write_at(fd, end - buffer.size(), buffer);
+                    buffer.clear();
+                }
+            }
+            write_at(fd, end - buffer.size(), buffer);
+
+            if (::fsync(fd) != 0) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't sync file '"} + tmp_filename + "'"};
+            }
+            if (::rename(tmp_filename.c_str(), m_data_filename.c_str()) != 0) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't rename '"} + tmp_filename + "' to '" + m_data_filename + "'"};
+            }
+
+            ::close(m_fd);
+            m_fd = fd;
+            m_end = end;
+            m_garbage = 0;
+        } catch (...) {
+            ::close(fd);
+            ::unlink(tmp_filename.c_str());
+            throw;
+        }
+    }
+
+public:
+
+    /// Open list store, garbage is the value from the status file.
+    ListStore(const std::string& filename, uint64_t garbage) :
+        m_index(filename + ".idx"),
+        m_data_filename(filename + ".dat"),
+        m_fd(::open(m_data_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666)), // NOLINT(hicpp-signed-bitwise)
+        m_garbage(garbage) {
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + m_data_filename + "'"};
+        }
+        m_end = osmium::util::file_size(m_fd);
+        if (m_end == 0) {
+            // Offset 0 is used in the index to mark missing lists.
+            m_buffer.push_back(0);
+            m_end = 1;
+        }
+        m_buffer.reserve(max_buffer_size);
+    }
+
+    ListStore(const ListStore&) = delete;
+    ListStore& operator=(const ListStore&) = delete;
+
+    ~ListStore() {
+        try {
+            flush();
+        } catch (...) {
+            // ignore exceptions
+        }
+        ::close(m_fd);
+    }
+
+    /// The number of bytes in the data file not used by any list.
+    uint64_t garbage() const noexcept {
+        return m_garbage;
+    }
+
+    /// Get the list stored for this ID into list (empty if there is none).
+    void get(osmium::unsigned_object_id_type id, std::vector<uint64_t>& list) {
+        list.clear();
+
+        const auto offset = m_index.get(id);
+        if (offset == 0) {
+            return;
+        }
+
+        flush();
+
+        const auto header = read_header(offset);
+        std::vector<unsigned char> data(static_cast<std::size_t>(header.first));
+        read_at(offset + header.second, data.data(), data.size());
+        decode(data.data(), list);
+    }
+
+    void set(osmium::unsigned_object_id_type id, const std::vector<uint64_t>& list) {
+        encode(list, m_encoded);
+
+        const auto offset = m_index.get(id);
+        if (offset != 0) {
+            flush();
+            const auto header = read_header(offset);
+            if (m_encoded.size() <= header.first) {
+                write_at(m_fd, offset + header.second, m_encoded);
+                return;
+            }
+            m_garbage += header.first + header.second;
+        }
+
+        m_index.at(id) = append_slot(m_buffer, m_end);
+        if (m_buffer.size() >= max_buffer_size) {
+            flush();
+        }
+    }
+
+    void remove(osmium::unsigned_object_id_type id) {
+        const auto offset = m_index.get(id);
+        if (offset != 0) {
+            flush();
+            const auto header = read_header(offset);
+            m_garbage += header.first + header.second;
+            m_index.at(id) = 0;
+        }
+    }
+
+    /// Write all changes to disk, compact the data file if needed.
+    void sync() {
+        if (m_garbage > m_end / 2) {
+            compact();
+        } else {
+            flush();
+            if (::fsync(m_fd) != 0) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't sync file '"} + m_data_filename + "'"};
+            }
+        }
+        m_index.sync();
+    }
+
+}; // class ListStore
+
+// Relation members are stored with the item type in the top two bits.
+inline uint64_t encode_member(osmium::item_type type, osmium::unsigned_object_id_type id) noexcept {
+    return (static_cast<uint64_t>(osmium::item_type_to_nwr_index(type)) << 62U) | id;
+}
+
+inline std::pair<osmium::item_type, osmium::unsigned_object_id_type> decode_member(uint64_t value) noexcept {
+    return {osmium::nwr_index_to_item_type(static_cast<unsigned int>(value >> 62U)), value & ((uint64_t(1) << 62U) - 1)};
+}
+
+/**
+ * The complete state in a directory. Use it as handler to apply objects
+ * (from the full planet file or change files) to the state.
+ */
+class State : public osmium::handler::Handler {
+
+    orphans::options_type m_options;
+    KeyClassifier m_ignored_keys;
+
+    RefCounts m_node_counts;
+    RefCounts m_way_counts;
+    RefCounts m_relation_counts;
+
+    ListStore m_way_nodes;
+    ListStore m_relation_members;
+
+    // Reused for reading lists from the list stores.
+    std::vector<uint64_t> m_old_list;
+
+    // Objects that might have become orphans.
+    std::vector<uint64_t> m_touched;
+    bool m_track_changes = true;
+
+    RefCounts& counts(osmium::item_type type) {
+        switch (type) {
+            case osmium::item_type::node:
+                return m_node_counts;
+            case osmium::item_type::way:
+                return m_way_counts;
+            default:
+                break;
+        }
+        return m_relation_counts;
+    }
+
+    void touch(osmium::item_type type, osmium::unsigned_object_id_type id) {
+        if (m_track_changes) {
+            m_touched.push_back(encode_member(type, id));
+        }
+    }
+
+    void add_ref(osmium::item_type type, osmium::unsigned_object_id_type id) {
+        counts(type).increment(id);
+    }
+
+    void remove_ref(osmium::item_type type, osmium::unsigned_object_id_type id) {
+        if (counts(type).decrement(id)) {
+            touch(type, id);
+        }
+    }
+
+    void update_object(const osmium::OSMObject& object) {
+        uint8_t flags = 0;
+        if (object.visible()) {
+            flags = RefCounts::exists;
+            if (object.tags().empty()) {
+                flags |= RefCounts::untagged;
+            } else if (m_ignored_keys.all_of(object.tags())) {
+                flags |= RefCounts::minimally_tagged;
+            }
+        }
+        counts(object.type()).set_flags(object.positive_id(), flags);
+        touch(object.type(), object.positive_id());
+    }
+
+public:
+
+    /// Remove all state files from the directory.
+    static void remove_files(const std::string& dirname) {
+        ::unlink(status_filename(dirname).c_str());
+        for (const char* name : {"node-counts", "way-counts", "relation-counts"}) {
+            ::unlink((dirname + "/" + name).c_str());
+            ::unlink((dirname + "/" + name + ".overflow").c_str());
+        }
+        for (const char* name : {"way-nodes", "relation-members"}) {
+            ::unlink((dirname + "/" + name + ".idx").c_str());
+            ::unlink((dirname + "/" + name + ".dat").c_str());
+        }
+    }
+
+    /// Open state in the directory, status is the current status.
+    State(const std::string& dirname, const orphans::options_type& options, const status_type& status) :
+        m_options(options),
+        m_ignored_keys(orphans::create_ignored_keys(options)),
+        m_node_counts(dirname + "/node-counts"),
+        m_way_counts(dirname + "/way-counts"),
+        m_relation_counts(dirname + "/relation-counts"),
+        m_way_nodes(dirname + "/way-nodes", status.way_nodes_garbage),
+        m_relation_members(dirname + "/relation-members", status.relation_members_garbage) {
+    }
+
+    void node(const osmium::Node& node) {
+        update_object(node);
+    }
+
+    void way(const osmium::Way& way) {
+        m_way_nodes.get(way.positive_id(), m_old_list);
+        for (const auto ref : m_old_list) {
+            remove_ref(osmium::item_type::node, ref);
+        }
+
+        if (way.visible()) {
+            std::vector<uint64_t> refs;
+            refs.reserve(way.nodes().size());
+            for (const auto& node_ref : way.nodes()) {
+                refs.push_back(node_ref.positive_ref());
+                add_ref(osmium::item_type::node, node_ref.positive_ref());
+            }
+            m_way_nodes.set(way.positive_id(), refs);
+        } else {
+            m_way_nodes.remove(way.positive_id());
+        }
+
+        update_object(way);
+    }
+
+    void relation(const osmium::Relation& relation) {
+        m_relation_members.get(relation.positive_id(), m_old_list);
+        for (const auto value : m_old_list) {
+            const auto member = decode_member(value);
+            remove_ref(member.first, member.second);
+        }
+
+        if (relation.visible()) {
+            std::vector<uint64_t> members;
+            members.reserve(relation.members().size());
+            for (const auto& member : relation.members()) {
+                members.push_back(encode_member(member.type(), member.positive_ref()));
+                add_ref(member.type(), member.positive_ref());
+            }
+            m_relation_members.set(relation.positive_id(), members);
+        } else {
+            m_relation_members.remove(relation.positive_id());
+        }
+
+        update_object(relation);
+    }
+
+    /**
+     * Remember objects that might have become orphans. Switch this off
+     * when initializing the state from a full planet file.
+     */
+    void track_changes(bool track) noexcept {
+        m_track_changes = track;
+    }
+
+    /// Call func(type, id) for all objects touched which are now orphans.
+    template <typename TFunc>
+    void for_each_new_orphan(TFunc&& func) {
+        std::sort(m_touched.begin(), m_touched.end());
+        const auto last = std::unique(m_touched.begin(), m_touched.end());
+
+        for (auto it = m_touched.begin(); it != last; ++it) {
+            const auto member = decode_member(*it);
+            auto& c = counts(member.first);
+            const auto flags = c.flags(member.second);
+            if (!(flags & RefCounts::exists) || c.count(member.second) != 0) {
+                continue;
+            }
+            if ((m_options.untagged && (flags & RefCounts::untagged)) ||
+                (m_options.tagged && (flags & RefCounts::minimally_tagged))) {
+                std::forward<TFunc>(func)(member.first, member.second);
+            }
+        }
+    }
+
+    /**
+     * Write all changes to disk and put the garbage counts into status.
+     * Set the status to clean only after this was successful.
+     */
+    void save(status_type& status) {
+        m_way_nodes.sync();
+        m_relation_members.sync();
+        status.way_nodes_garbage = m_way_nodes.garbage();
+        status.relation_members_garbage = m_relation_members.garbage();
+        m_node_counts.save();
+        m_way_counts.save();
+        m_relation_counts.save();
+    }
+
+}; // class State
+
+} // namespace orphans_state
+
+#endif // ORPHANS_STATE_HPP
@@ -0,0 +1,429 @@
+#ifndef OUTPUT_MULTIPLEXER_HPP
+#define OUTPUT_MULTIPLEXER_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/memory/item.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include "trace.hpp"
+
+/**
+ * Collects the objects for many OSM output files and writes those files
+ * using a bounded number of threads and a bounded amount of memory.
+ *
+ * Every osmium::io::Writer has its own output thread, queue, and buffers,
+ * so having dozens of them open at the same time is expensive. Instead
+ * objects are copied into in-memory blocks, one list of blocks per file.
+ * If the blocks of all files together use more than the memory limit, the
+ * blocks of the file using the most memory are moved to a temporary spill
+ * file. Only when a file is closed an osmium::io::Writer is created for it
+ * and all blocks are handed over. So there is at most one Writer at any
+ * time and the PBF encoding and compression is done in the shared osmium
+ * thread pool (its size can be set with the OSMIUM_POOL_THREADS
+ * environment variable).
+ *
+ * The files written are exactly the same as if the objects were written
+ * to a Writer directly.
+ *
+ * This class is not thread safe.
+ */
+class OutputMultiplexer {
+
+    // Start a new block when the current one has reached this size.
+    constexpr static const std::size_t block_size = 1024UL * 1024UL;
+
+    // Initial size of the buffer for a new block. Most output files are
+    // small, so the buffer starts small and grows when needed.
+    constexpr static const std::size_t initial_buffer_size = 64UL * 1024UL;
+
+    struct file_data {
+
+        osmium::io::File file;
+        osmium::io::Header header;
+
+        // Full blocks in the order they were written.
+        std::vector<osmium::memory::Buffer> blocks;
+
+        // The block currently written to.
+        osmium::memory::Buffer buffer;
+
+        // Memory used by blocks and buffer.
+        std::size_t memory = 0;
+
+        // File descriptor of the (already unlinked) spill file or -1.
+        int spill_fd = -1;
+
+        bool closed = false;
+
+        file_data(const osmium::io::File& f, const osmium::io::Header& h) :
+            file(f),
+            header(h),
+            blocks(),
+            buffer() {
+        }
+
+    }; // struct file_data
+
+    std::vector<file_data> m_files;
+
+    std::size_t m_memory_limit;
+    std::size_t m_memory_used = 0;
+    std::size_t m_peak_memory_used = 0;
+    uint64_t m_bytes_spilled = 0;
+
+    static void write_all(int fd, const unsigned char* data, std::size_t size) {
+        while (size > 0) {
+            const auto length = ::write(fd, data, size);
+            if (length < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Can't write to spill file"};
+            }
+            data += length;
+            size -= static_cast<std::size_t>(length);
+        }
+    }
+
+    /**
+     * Read exactly size bytes. If at_eof_ok is set and the file is at its
+     * end before anything was read, returns false.
+     */
+    static bool read_all(int fd, unsigned char* data, std::size_t size, bool at_eof_ok = false) {
+        bool first = true;
+        while (size > 0) {
+            const auto length = ::read(fd, data, size);
+            if (length < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), "Can't read from spill file"};
+            }
+            if (length == 0) {
+                if (first && at_eof_ok) {
+                    return false;
+                }
+                throw std::runtime_error{"Spill file is truncated"};
+            }
+            first = false;
+            data += length;
+            size -= static_cast<std::size_t>(length);
+        }
+        return true;
+    }
+
+    static void write_block(int fd, const osmium::memory::Buffer& block) {
+        const uint64_t size = block.committed();
+        write_all(fd, reinterpret_cast<const unsigned char*>(&size), sizeof(size));
+        write_all(fd, block.data(), block.committed());
+    }
+
+    /**
+     * Read the next block from the spill file. Returns an invalid buffer
+     * at the end of the file.
+     */
+    static osmium::memory::Buffer read_block(int fd) {
+        uint64_t size = 0;
+        if (!read_all(fd, reinterpret_cast<unsigned char*>(&size), sizeof(size), true)) {
+            return osmium::memory::Buffer{};
+        }
+
+        osmium::memory::Buffer block{static_cast<std::size_t>(size), osmium::memory::Buffer::auto_grow::no};
+        read_all(fd, block.reserve_space(static_cast<std::size_t>(size)), static_cast<std::size_t>(size));
+        block.commit();
+        return block;
+    }
+
+    /**
+     * Create the spill file next to the output file. It is unlinked right
+     * away, so it will always be cleaned up, even if the program crashes.
+     */
+    static int open_spill_file(const osmium::io::File& file) {
+        const std::string filename{file.filename() + ".spill"};
+        const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open spill file '"} + filename + "'"};
+        }
+        ::unlink(filename.c_str());
+        return fd;
+    }
+
+    void spill(file_data& f) {
+        trace::Span span{"OutputMultiplexer::spill"};
+        if (f.spill_fd < 0) {
+            f.spill_fd = open_spill_file(f.file);
+        }
+
+        for (const auto& block : f.blocks) {
+            write_block(f.spill_fd, block);
+            m_bytes_spilled += block.committed();
+        }
+        std::vector<osmium::memory::Buffer>{}.swap(f.blocks);
+
+        if (f.buffer && f.buffer.committed() > 0) {
+            write_block(f.spill_fd, f.buffer);
+            m_bytes_spilled += f.buffer.committed();
+        }
+        f.buffer = osmium::memory::Buffer{};
+
+        m_memory_used -= f.memory;
+        f.memory = 0;
+    }
+
+    // Spill the files using the most memory until we are below the limit.
+    void enforce_memory_limit() {
+        while (m_memory_used > m_memory_limit) {
+            const auto it = std::max_element(m_files.begin(), m_files.end(), [](const file_data& a, const file_data& b){
+                return a.memory < b.memory;
+            });
+            if (it == m_files.end() || it->memory == 0) {
+                return;
+            }
+            spill(*it);
+        }
+    }
+
+    void do_close(file_data& f) {
+        trace::Span span{"OutputMultiplexer::close"};
+
+        // If this throws, nothing has happened yet and the data is still
+        // there.
+        osmium::io::Writer writer{f.file, f.header, osmium::io::overwrite::allow};
+
+        // Once the data is handed to the writer it can't be written again,
+        // so the file counts as closed even if writing it fails.
+        f.closed = true;
+
+        if (f.spill_fd >= 0) {
+            if (::lseek(f.spill_fd, 0, SEEK_SET) != 0) {
+                throw std::system_error{errno, std::system_category(), "Can't seek in spill file"};
+            }
+            while (osmium::memory::Buffer block = read_block(f.spill_fd)) {
+                writer(std::move(block));
+            }
+            ::close(f.spill_fd);
+            f.spill_fd = -1;
+        }
+
+        for (auto& block : f.blocks) {
+            writer(std::move(block));
+        }
+        std::vector<osmium::memory::Buffer>{}.swap(f.blocks);
+
+        if (f.buffer && f.buffer.committed() > 0) {
+            writer(std::move(f.buffer));
+        }
+        f.buffer = osmium::memory::Buffer{};
+
+        m_memory_used -= f.memory;
+        f.memory = 0;
+
+        writer.close();
+    }
+
+public:
+
+    /// Default memory limit in MBytes.
+    constexpr static const std::size_t default_memory_limit_mb = 1024;
+
+    explicit OutputMultiplexer(std::size_t memory_limit_mb = default_memory_limit_mb) :
+        m_memory_limit(memory_limit_mb * 1024UL * 1024UL) {
+    }
+
+    OutputMultiplexer(const OutputMultiplexer&) = delete;
+    OutputMultiplexer& operator=(const OutputMultiplexer&) = delete;
+
+    OutputMultiplexer(OutputMultiplexer&&) = delete;
+    OutputMultiplexer& operator=(OutputMultiplexer&&) = delete;
+
+    /**
+     * Write out all files not closed yet. Like the destructor of
+     * osmium::io::Writer this will not report any errors, call close()
+     * or close_all() if you want to know about them.
+     */
+    ~OutputMultiplexer() noexcept {
+        for (auto& f : m_files) {
+            try {
+                if (!f.closed) {
+                    do_close(f);
+                }
+            } catch (...) {
+                // ignore exceptions in destructor
+            }
+            if (f.spill_fd >= 0) {
+                ::close(f.spill_fd);
+            }
+        }
+    }
+
+    /**
+     * Parse the value of the --output-memory option (in MBytes). Throws
+     * if it is not a positive number.
+     */
+    static std::size_t parse_memory_limit(const char* arg) {
+        char* end = nullptr;
+        errno = 0;
+        const auto value = std::strtoll(arg, &end, 10);
+        if (errno != 0 || !end || *end != '\0' || end == arg || value < 1 ||
+            static_cast<unsigned long long>(value) > std::numeric_limits<std::size_t>::max() / (1024UL * 1024UL)) {
+            throw std::runtime_error{std::string{"Value not allowed for output memory: "} + arg};
+        }
+        return static_cast<std::size_t>(value);
+    }
+
+    /**
+     * Add an output file. The file is created (empty) right away, so
+     * problems like an unwritable output directory are found early, but
+     * it is only written when it is closed. Returns the ID of the file.
+     */
+    std::size_t add_file(const osmium::io::File& file, const osmium::io::Header& header) {
+        const auto& filename = file.filename();
+        if (!filename.empty() && filename != "-") {
+            const int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666); // NOLINT(hicpp-signed-bitwise)
+            if (fd < 0) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't open output file '"} + filename + "'"};
+            }
+            ::close(fd);
+        }
+
+        m_files.emplace_back(file, header);
+        return m_files.size() - 1;
+    }
+
+    /// Add an OSM object (or any other item) to the specified file.
+    void write(std::size_t id, const osmium::memory::Item& item) {
+        auto& f = m_files[id];
+        if (f.closed) {
+            throw std::runtime_error{"Can't write to closed output file '" + f.file.filename() + "'"};
+        }
+        if (!f.buffer) {
+            std::size_t size = initial_buffer_size;
+            if (item.padded_size() > size) {
+                size = item.padded_size();
+            }
+            f.buffer = osmium::memory::Buffer{size, osmium::memory::Buffer::auto_grow::yes};
+            f.memory += f.buffer.capacity();
+            m_memory_used += f.buffer.capacity();
+        }
+
+        const auto capacity = f.buffer.capacity();
+        f.buffer.add_item(item);
+        f.buffer.commit();
+        if (f.buffer.capacity() != capacity) {
+            f.memory += f.buffer.capacity() - capacity;
+            m_memory_used += f.buffer.capacity() - capacity;
+        }
+
+        if (f.buffer.committed() >= block_size) {
+            f.blocks.push_back(std::move(f.buffer));
+            f.buffer = osmium::memory::Buffer{};
+        }
+
+        m_peak_memory_used = std::max(m_peak_memory_used, m_memory_used);
+        enforce_memory_limit();
+    }
+
+    /**
+     * Write out the specified file. Nothing can be added to the file
+     * after that.
+     */
+    void close(std::size_t id) {
+        auto& f = m_files[id];
+        if (!f.closed) {
+            do_close(f);
+        }
+    }
+
+    /// Write out all files not closed yet.
+    void close_all() {
+        for (auto& f : m_files) {
+            if (!f.closed) {
+                do_close(f);
+            }
+        }
+    }
+
+    /// The largest amount of memory used for blocks at any time.
+    std::size_t peak_memory_used() const noexcept {
+        return m_peak_memory_used;
+    }
+
+    /// The number of bytes moved to spill files.
+    uint64_t bytes_spilled() const noexcept {
+        return m_bytes_spilled;
+    }
+
+    void print(osmium::util::VerboseOutput& vout) const {
+        vout << "Output buffers: " << m_files.size() << " files, "
+             << (m_peak_memory_used / (1024 * 1024)) << " MBytes peak memory, "
+             << (m_bytes_spilled / (1024 * 1024)) << " MBytes spilled to disk\n";
+    }
+
+}; // class OutputMultiplexer
+
+/**
+ * Handle for one file in an OutputMultiplexer. It can be used like an
+ * osmium::io::Writer.
+ */
+class MultiplexedWriter {
+
+    OutputMultiplexer* m_multiplexer;
+    std::size_t m_id;
+
+public:
+
+    MultiplexedWriter(OutputMultiplexer& multiplexer, const osmium::io::File& file, const osmium::io::Header& header) :
+        m_multiplexer(&multiplexer),
+        m_id(multiplexer.add_file(file, header)) {
+    }
+
+    void operator()(const osmium::memory::Item& item) {
+        m_multiplexer->write(m_id, item);
+    }
+
+    void close() {
+        m_multiplexer->close(m_id);
+    }
+
+}; // class MultiplexedWriter
+
+#endif // OUTPUT_MULTIPLEXER_HPP
@@ -1,3 +1,6 @@
+#ifndef OUTPUTS_HPP
+#define OUTPUTS_HPP
+
 /*
 
 https://github.com/osmcode/osm-data-anomaly-detection
@@ -19,54 +22,52 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <string>
-#include <tuple>
 #include <utility>
+#include <vector>
 
 #include <osmium/geom/ogr.hpp>
+#include <osmium/index/id_set.hpp>
 #include <osmium/index/nwr_array.hpp>
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/any_output.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
 
 #include <gdalcpp.hpp>
 
-class Output {
-
-    struct mem_rel_mapping {
+#include "location_index.hpp"
+#include "member_index.hpp"
+#include "output_multiplexer.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
 
-        osmium::unsigned_object_id_type member_id;
-        osmium::unsigned_object_id_type relation_id;
-
-        mem_rel_mapping(osmium::unsigned_object_id_type mem_id, osmium::unsigned_object_id_type rel_id = 0) :
-            member_id(mem_id),
-            relation_id(rel_id) {
-        }
-
-        bool operator<(const mem_rel_mapping& other) noexcept {
-            return std::tie(member_id, relation_id) < std::tie(other.member_id, other.relation_id);
-        }
-
-    }; // struct mem_rel_mapping
+class Output {
 
-    using id_map_type = std::vector<mem_rel_mapping>;
+    using mark_type = std::pair<osmium::unsigned_object_id_type, osmium::unsigned_object_id_type>;
 
     std::string m_name;
-    std::map<osmium::unsigned_object_id_type, std::vector<osmium::unsigned_object_id_type>> m_marks;
+
+    // Pairs of (relation ID, way ID) of marked ways. Sorted in
+    // move_members().
+    std::vector<mark_type> m_marks;
     osmium::geom::OGRFactory<>& m_factory;
     std::unique_ptr<gdalcpp::Layer> m_layer_points;
     std::unique_ptr<gdalcpp::Layer> m_layer_lines;
 
-    osmium::io::File m_file;
-    osmium::io::Writer m_writer_rel;
-    osmium::io::Writer m_writer_all;
+    MultiplexedWriter m_writer_rel;
+    MultiplexedWriter m_writer_all;
 
     uint64_t m_counter;
 
-    osmium::nwr_array<id_map_type> m_id_maps;
+    osmium::nwr_array<MemberList> m_members;
 
     static std::string underscore_to_dash(const std::string& str) {
         std::string out;
@@ -78,20 +79,15 @@ class Output {
         return out;
     }
 
-    bool check_mark(osmium::unsigned_object_id_type rel_id, osmium::unsigned_object_id_type obj_id) {
-        if (m_marks.count(rel_id) == 0) {
-            return false;
-        }
-        const auto& vec = m_marks[rel_id];
-        const auto range = std::equal_range(vec.begin(), vec.end(), obj_id);
-        return range.first != range.second;
+    bool check_mark(osmium::unsigned_object_id_type rel_id, osmium::unsigned_object_id_type obj_id) const {
+        return std::binary_search(m_marks.begin(), m_marks.end(), mark_type{rel_id, obj_id});
     }
 
-    void add_features_to_layers(const osmium::OSMObject& object, const std::pair<id_map_type::const_iterator, id_map_type::const_iterator>& range) {
+    void add_features_to_layers(const osmium::OSMObject& object, const member_entry* first, const member_entry* last) {
         const auto ts = object.timestamp().to_iso();
 
-        for (auto it = range.first; it != range.second; ++it) {
-            const auto rel_id = it->relation_id;
+        for (auto it = first; it != last; ++it) {
+            const auto rel_id = it->relation_id();
             if (object.type() == osmium::item_type::node && m_layer_points) {
                 try {
                     gdalcpp::Feature feature{*m_layer_points, m_factory.create_point(static_cast<const osmium::Node&>(object))};
@@ -99,7 +95,7 @@ class Output {
                     feature.set_field("node_id", static_cast<double>(object.id()));
                     feature.set_field("timestamp", ts.c_str());
                     feature.set_field("mark", 0);
-                    feature.add_to_layer();
+                    add_to_layer(feature);
                 } catch (osmium::geometry_error& e) {
                     std::cerr << "Geometry error writing out node " << object.id() << " for relation " << rel_id << ": " << e.what() << '\n';
                 }
@@ -110,7 +106,7 @@ class Output {
                     feature.set_field("way_id", static_cast<int32_t>(object.id()));
                     feature.set_field("timestamp", ts.c_str());
                     feature.set_field("mark", check_mark(rel_id, object.positive_id()));
-                    feature.add_to_layer();
+                    add_to_layer(feature);
                 } catch (osmium::geometry_error& e) {
                     std::cerr << "Geometry error writing out way " << object.id() << " for relation " << rel_id << ": " << e.what() << '\n';
                 }
@@ -120,22 +116,21 @@ class Output {
 
     void add_members_to_index(const osmium::Relation& relation) {
         for (const auto& member : relation.members()) {
-            m_id_maps(member.type()).emplace_back(member.positive_ref(), relation.positive_id());
+            m_members(member.type()).add(member.positive_ref(), relation.positive_id());
         }
     }
 
 public:
 
-    Output(const std::string& name, gdalcpp::Dataset& dataset, osmium::geom::OGRFactory<>& factory, const std::string& directory, const osmium::io::Header& header, bool points, bool lines) :
+    Output(const std::string& name, gdalcpp::Dataset& dataset, osmium::geom::OGRFactory<>& factory, OutputMultiplexer& multiplexer, const std::string& directory, const osmium::io::Header& header, bool points, bool lines) :
         m_name(name),
         m_factory(factory),
         m_layer_points(nullptr),
         m_layer_lines(nullptr),
-        m_file(directory + "/" + underscore_to_dash(name) + "-all.osm.pbf", "pbf,locations_on_ways=true"),
-        m_writer_rel(directory + "/" + underscore_to_dash(name) + ".osm.pbf", header, osmium::io::overwrite::allow),
-        m_writer_all(m_file, header, osmium::io::overwrite::allow),
+        m_writer_rel(multiplexer, osmium::io::File{directory + "/" + underscore_to_dash(name) + ".osm.pbf"}, header),
+        m_writer_all(multiplexer, osmium::io::File{directory + "/" + underscore_to_dash(name) + "-all.osm.pbf", "pbf,locations_on_ways=true"}, header),
         m_counter(0),
-        m_id_maps() {
+        m_members() {
         if (points) {
             m_layer_points.reset(new gdalcpp::Layer{dataset, name + "_points", wkbPoint, {"SPATIAL_INDEX=NO"}});
             m_layer_points->add_field("rel_id", OFTInteger, 10);
@@ -164,28 +159,60 @@ public:
         m_counter += increment;
         m_writer_rel(relation);
         add_members_to_index(relation);
-        if (!marks.empty()) {
-            m_marks.emplace(relation.positive_id(), marks);
+        for (const auto mark : marks) {
+            m_marks.emplace_back(relation.positive_id(), mark);
         }
     }
 
-    using id_pair = std::pair<osmium::unsigned_object_id_type, osmium::unsigned_object_id_type>;
+    /**
+     * Add a point for the relation to the points layer which is not one
+     * of its member nodes, for instance the loose end of an open ring.
+     * These points have the mark field set.
+     */
+    void add_point(osmium::unsigned_object_id_type rel_id, const osmium::NodeRef& node_ref, const osmium::Timestamp& timestamp) {
+        if (!m_layer_points) {
+            return;
+        }
 
-    void write_to_all(const osmium::OSMObject& object) {
-        const auto& map = m_id_maps(object.type());
-        const auto range = std::equal_range(map.begin(), map.end(), mem_rel_mapping{object.positive_id()}, [](const mem_rel_mapping& a, const mem_rel_mapping& b){
-            return a.member_id < b.member_id;
-        });
-        if (range.first != range.second) {
-            m_writer_all(object);
-            add_features_to_layers(object, range);
+        try {
+            gdalcpp::Feature feature{*m_layer_points, m_factory.create_point(node_ref)};
+            feature.set_field("rel_id", static_cast<int32_t>(rel_id));
+            feature.set_field("node_id", static_cast<double>(node_ref.ref()));
+            feature.set_field("timestamp", timestamp.to_iso().c_str());
+            feature.set_field("mark", 1);
+            add_to_layer(feature);
+        } catch (osmium::geometry_error& e) {
+            std::cerr << "Geometry error writing out node " << node_ref.ref() << " for relation " << rel_id << ": " << e.what() << '\n';
         }
     }
 
-    void prepare() {
-        std::sort(m_id_maps(osmium::item_type::node).begin(), m_id_maps(osmium::item_type::node).end());
-        std::sort(m_id_maps(osmium::item_type::way).begin(), m_id_maps(osmium::item_type::way).end());
-        std::sort(m_id_maps(osmium::item_type::relation).begin(), m_id_maps(osmium::item_type::relation).end());
+    /// The number of members of the specified type in all relations.
+    std::size_t num_members(osmium::item_type type) const noexcept {
+        return m_members(type).size();
+    }
+
+    /**
+     * Call func(member_id, relation_id) for all members of the specified
+     * type of relations added to this output and free the memory used for
+     * them. Must be called for all types before objects are written.
+     */
+    template <typename TFunc>
+    void move_members(osmium::item_type type, TFunc&& func) {
+        m_members(type).for_each(std::forward<TFunc>(func));
+        m_members(type).clear();
+
+        std::sort(m_marks.begin(), m_marks.end());
+        m_marks.shrink_to_fit();
+    }
+
+    /**
+     * Write object to the "all" file and add it to the layers once for
+     * each of the relations in the range of index entries.
+     */
+    void write_object(const osmium::OSMObject& object, const member_entry* first, const member_entry* last) {
+        trace::Span span{"Output::write_to_all"};
+        m_writer_all(object);
+        add_features_to_layers(object, first, last);
     }
 
     void close_writer_rel() {
@@ -198,12 +225,37 @@ public:
 
 }; // class Output
 
+/**
+ * Name and layer types of an output. Programs define a table of these
+ * and an enum with the same order to access the outputs by ID.
+ */
+struct output_definition {
+    const char* name;
+    bool points;
+    bool lines;
+};
+
 /**
  * This is a collection of Outputs using the same database.
  */
 class Outputs {
 
-    std::map<std::string, Output> m_outputs;
+    // Outputs in the order they were added, the position is the ID used
+    // in operator[].
+    std::vector<std::unique_ptr<Output>> m_outputs;
+
+    // Index from members to the outputs and relations they are needed for,
+    // sorted by member ID, output, and relation ID.
+    osmium::nwr_array<MemberIndex> m_members;
+
+    // Entries found in the index for the current object.
+    std::vector<member_entry> m_found;
+
+    // Set of all member IDs in the index. Most objects are not in it, for
+    // them this one bit test is all that is needed.
+    osmium::nwr_array<osmium::index::IdSetDense<osmium::unsigned_object_id_type>> m_member_ids;
+
+    OutputMultiplexer& m_multiplexer;
     std::string m_dirname;
     osmium::io::Header m_header;
     osmium::geom::OGRFactory<> m_factory;
@@ -211,8 +263,9 @@ class Outputs {
 
 public:
 
-    Outputs(const std::string& dirname, const std::string& dbname, osmium::io::Header& header) :
+    Outputs(OutputMultiplexer& multiplexer, const std::string& dirname, const std::string& dbname, const osmium::io::Header& header) :
         m_outputs(),
+        m_multiplexer(multiplexer),
         m_dirname(dirname),
         m_header(header),
         m_factory(),
@@ -222,22 +275,176 @@ public:
         m_dataset.exec("PRAGMA journal_mode = OFF;");
     }
 
-    void add_output(const char* name, bool points = true, bool lines = true) {
-        m_outputs.emplace(std::piecewise_construct,
-                          std::forward_as_tuple(name),
-                          std::forward_as_tuple(name, m_dataset, m_factory, m_dirname, m_header, points, lines));
+    /// Add an output, returns its ID.
+    std::size_t add_output(const char* name, bool points = true, bool lines = true) {
+        m_outputs.emplace_back(new Output{name, m_dataset, m_factory, m_multiplexer, m_dirname, m_header, points, lines});
+        return m_outputs.size() - 1;
+    }
+
+    /**
+     * Add all outputs from the table. Call this on an empty Outputs object,
+     * then the IDs are the positions in the table.
+     */
+    template <std::size_t N>
+    void add_outputs(const output_definition (&definitions)[N]) {
+        for (const auto& def : definitions) {
+            add_output(def.name, def.points, def.lines);
+        }
     }
 
-    Output& operator[](const char* name) {
-        return m_outputs.at(name);
+    Output& operator[](std::size_t id) noexcept {
+        return *m_outputs[id];
     }
 
     template <typename TFunc>
     void for_all(TFunc&& func) {
         for (auto& out : m_outputs) {
-            std::forward<TFunc>(func)(out.second);
+            std::forward<TFunc>(func)(*out);
+        }
+    }
+
+    /**
+     * Build the index from members to outputs. Call this after all
+     * relations have been added to the outputs and before write_to_all().
+     */
+    void prepare() {
+        for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+            std::size_t count = 0;
+            for (const auto& output : m_outputs) {
+                count += output->num_members(type);
+            }
+
+            std::vector<member_entry> entries;
+            entries.reserve(count);
+            for (std::size_t n = 0; n < m_outputs.size(); ++n) {
+                m_outputs[n]->move_members(type, [&](osmium::unsigned_object_id_type member_id, osmium::unsigned_object_id_type relation_id) {
+                    entries.emplace_back(member_id, n, relation_id);
+                    m_member_ids(type).set(member_id);
+                });
+            }
+
+            std::sort(entries.begin(), entries.end());
+            m_members(type) = MemberIndex{entries};
+        }
+    }
+
+    /// Print size of the member index. Only valid after prepare().
+    void print_index_stats(osmium::util::VerboseOutput& vout) const {
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+            entries += m_members(type).size();
+            bytes += m_members(type).used_memory();
+        }
+        vout << "Member index: " << entries << " entries, " << (bytes / 1024) << " kBytes";
+        if (entries > 0) {
+            vout << " (" << (bytes / entries) << '.' << (bytes * 10 / entries % 10) << " bytes per member)";
+        }
+        vout << '\n';
+    }
+
+    /**
+     * The types of objects that are members of any relation in the index.
+     * Only valid after prepare().
+     */
+    osmium::osm_entity_bits::type entity_bits() const noexcept {
+        osmium::osm_entity_bits::type bits = osmium::osm_entity_bits::nothing;
+        for (const auto type : {osmium::item_type::node, osmium::item_type::way, osmium::item_type::relation}) {
+            if (!m_members(type).empty()) {
+                bits |= osmium::osm_entity_bits::from_item_type(type);
+            }
+        }
+        return bits;
+    }
+
+    /**
+     * Does the object come after the last member in the index if the
+     * input is sorted by type and ID? Only valid after prepare().
+     */
+    bool after_last_member(const osmium::OSMObject& object) const noexcept {
+        for (const auto type : {osmium::item_type::relation, osmium::item_type::way, osmium::item_type::node}) {
+            const auto& members = m_members(type);
+            if (!members.empty()) {
+                return object.type() > type ||
+                       (object.type() == type && object.positive_id() > members.last_member_id());
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Write object to all outputs which have relations it is a member of.
+     */
+    void write_to_all(const osmium::OSMObject& object) {
+        if (!m_member_ids(object.type()).get(object.positive_id())) {
+            return;
+        }
+
+        m_members(object.type()).find(object.positive_id(), m_found);
+
+        const member_entry* it = m_found.data();
+        const member_entry* const end = it + m_found.size();
+        while (it != end) {
+            const auto output = it->output();
+            const member_entry* const output_end = std::find_if(it, end, [output](const member_entry& e){
+                return e.output() != output;
+            });
+            m_outputs[output]->write_object(object, it, output_end);
+            it = output_end;
         }
     }
 
 }; // class Outputs
 
+/**
+ * Read the input file again and write all members of relations in the
+ * outputs to the "all" files and layers. Only object types that are
+ * needed are read and, if the input file is sorted, reading stops after
+ * the last member.
+ *
+ * If locations is set, it is used to add locations to the ways. It is
+ * filled first if it isn't complete yet.
+ */
+inline void write_data_files(const std::string& input_filename, Outputs& outputs, PhaseTimer& timer, LocationIndex* locations = nullptr) {
+    const auto entity_bits = outputs.entity_bits();
+    osmium::io::Reader reader{input_filename, locations ? locations->entity_bits(entity_bits) : entity_bits};
+    osmium::ProgressBar progress_bar{reader.file_size(), display_progress()};
+
+    const bool sorted = reader.header().get("sorting") == "Type_then_ID";
+
+    bool done = false;
+    while (!done) {
+        osmium::memory::Buffer buffer = read_traced(reader);
+        if (!buffer) {
+            break;
+        }
+        trace::Span span{"process_buffer"};
+        progress_bar.update(reader.offset());
+        timer.count(buffer);
+        if (locations) {
+            locations->add_locations(buffer);
+        }
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            if (sorted && outputs.after_last_member(object)) {
+                done = true;
+                break;
+            }
+            outputs.write_to_all(object);
+        }
+    }
+
+    progress_bar.done();
+    reader.close();
+
+    // All nodes come before the first way, so the index is complete if
+    // ways were read, even if reading stopped early.
+    if (locations && (entity_bits & osmium::osm_entity_bits::way)) {
+        locations->finish();
+    }
+
+    outputs.for_all([](Output& output) {
+        output.close_writer_all();
+    });
+}
+
+#endif // OUTPUTS_HPP
@@ -0,0 +1,196 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+/**
+ * Hardware performance counters (cycles, instructions, last level cache
+ * misses, and branch misses) using the Linux perf_event_open() syscall.
+ *
+ * Only the calling thread is measured. All checks run in the main thread,
+ * so this is what we want, the decoding and encoding work done in the
+ * libosmium thread pool is not included.
+ *
+ * If the counters are not available (not on Linux, not allowed by the
+ * perf_event_paranoid setting, no PMU access in a VM, ...) available()
+ * returns false and all counts are 0.
+ */
+class PerfCounters {
+
+public:
+
+    enum counter : std::size_t {
+        cycles        = 0,
+        instructions  = 1,
+        llc_misses    = 2,
+        branch_misses = 3,
+        num_counters  = 4
+    };
+
+    using values_type = std::array<uint64_t, num_counters>;
+
+    static const char* name(std::size_t n) noexcept {
+        static const char* names[num_counters] = {
+            "cycles",
+            "instructions",
+            "llc_misses",
+            "branch_misses"
+        };
+        return names[n];
+    }
+
+private:
+
+    std::array<int, num_counters> m_fds;
+    std::string m_error;
+
+#ifdef __linux__
+    static int open_counter(uint64_t config) noexcept {
+        perf_event_attr attr; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING; // NOLINT(hicpp-signed-bitwise)
+
+        return static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static uint64_t read_counter(int fd) noexcept {
+        // value, time enabled, time running
+        uint64_t data[3] = {0, 0, 0};
+        if (::read(fd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+            return 0;
+        }
+
+        // scale if the kernel had to multiplex the counters
+        if (data[2] != 0 && data[2] < data[1]) {
+            return static_cast<uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]));
+        }
+
+        return data[0];
+    }
+#endif
+
+public:
+
+    PerfCounters() {
+        m_fds.fill(-1);
+
+#ifdef __linux__
+        static const uint64_t configs[num_counters] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (std::size_t n = 0; n < num_counters; ++n) {
+            m_fds[n] = open_counter(configs[n]);
+            if (m_fds[n] < 0) {
+                m_error = std::strerror(errno);
+                close();
+                return;
+            }
+        }
+#else
+        m_error = "only available on Linux";
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    PerfCounters(PerfCounters&&) = delete;
+    PerfCounters& operator=(PerfCounters&&) = delete;
+
+    ~PerfCounters() {
+        close();
+    }
+
+    bool available() const noexcept {
+        return m_fds[0] >= 0;
+    }
+
+    /// The reason why the counters are not available.
+    const std::string& error() const noexcept {
+        return m_error;
+    }
+
+    void start() noexcept {
+#ifdef __linux__
+        for (const int fd : m_fds) {
+            if (fd >= 0) {
+                ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    values_type stop() noexcept {
+        values_type values{};
+
+#ifdef __linux__
+        for (std::size_t n = 0; n < num_counters; ++n) {
+            if (m_fds[n] >= 0) {
+                ::ioctl(m_fds[n], PERF_EVENT_IOC_DISABLE, 0);
+                values[n] = read_counter(m_fds[n]);
+            }
+        }
+#endif
+
+        return values;
+    }
+
+private:
+
+    void close() noexcept {
+        for (int& fd : m_fds) {
+            if (fd >= 0) {
+#ifdef __linux__
+                ::close(fd);
+#endif
+                fd = -1;
+            }
+        }
+    }
+
+}; // class PerfCounters
+
+#endif // PERF_COUNTERS_HPP
@@ -0,0 +1,386 @@
+#ifndef REF_INDEX_HPP
+#define REF_INDEX_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <osmium/index/nwr_array.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include "concurrent_id_set.hpp"
+
+/**
+ * On-disk index of all objects referenced from ways and relations. It is
+ * created by odad-build-ref-index and can be used by other programs
+ * instead of reading the input file to build the index again.
+ *
+ * File layout (all numbers in host byte order):
+ *
+ * - header (see file_header), padded to page_size
+ * - for each of node, way, relation: directory with one 64 bit offset for
+ *   each chunk ID up to the largest allocated chunk (0 = empty chunk)
+ * - padding to page_size
+ * - all allocated chunks, each a bitmap of 2^chunk_bits IDs
+ *
+ * The file is memory mapped when used. The directories are checked when
+ * the file is opened, of the chunks only the parts actually looked at are
+ * read from disk.
+ */
+namespace ref_index {
+
+constexpr const std::size_t page_size = 4096;
+
+// Hash this many bytes from the start of the source file.
+constexpr const std::size_t fingerprint_bytes = 1024 * 1024;
+
+/**
+ * Identifies the OSM file the index was created from. It uses the size,
+ * the modification time, and a hash over the start of the file which
+ * contains the header and (for PBF files) the first data blocks.
+ */
+struct fingerprint {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+};
+
+inline bool operator==(const fingerprint& a, const fingerprint& b) noexcept {
+    return a.size == b.size && a.mtime == b.mtime && a.hash == b.hash;
+}
+
+inline bool operator!=(const fingerprint& a, const fingerprint& b) noexcept {
+    return !(a == b);
+}
+
+struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_bits;
+    fingerprint source;
+    uint64_t num_chunks[3];
+    uint64_t directory_offset[3];
+};
+
+static const char magic[8] = {'O', 'D', 'A', 'D', 'R', 'E', 'F', 'I'};
+
+constexpr const uint32_t format_version = 1;
+
+/// Get fingerprint of the specified file.
+inline fingerprint source_fingerprint(const std::string& filename) {
+    struct stat s{};
+    if (::stat(filename.c_str(), &s) != 0) {
+        throw std::system_error{errno, std::system_category(), std::string{"Can't stat file '"} + filename + "'"};
+    }
+
+    fingerprint fp;
+    fp.size = static_cast<uint64_t>(s.st_size);
+    fp.mtime = static_cast<int64_t>(s.st_mtime);
+
+    std::ifstream file{filename, std::ios::binary};
+    std::vector<char> data(std::min(fingerprint_bytes, static_cast<std::size_t>(fp.size)));
+    if (!file.read(data.data(), static_cast<std::streamsize>(data.size()))) {
+        throw std::runtime_error{std::string{"Can't read file '"} + filename + "'"};
+    }
+
+    // FNV-1a
+    fp.hash = 14695981039346656037ULL;
+    for (const char c : data) {
+        fp.hash ^= static_cast<unsigned char>(c);
+        fp.hash *= 1099511628211ULL;
+    }
+
+    return fp;
+}
+
+namespace detail {
+
+    inline void write_all(int fd, const void* data, std::size_t size, const std::string& filename) {
+        const char* ptr = static_cast<const char*>(data);
+        while (size > 0) {
+            const auto length = ::write(fd, ptr, size);
+            if (length < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(), std::string{"Can't write to file '"} + filename + "'"};
+            }
+            ptr += length;
+            size -= static_cast<std::size_t>(length);
+        }
+    }
+
+    inline void write_padding(int fd, uint64_t& offset, const std::string& filename) {
+        static const char zeros[page_size] = {};
+        const auto padding = (page_size - offset % page_size) % page_size;
+        write_all(fd, zeros, padding, filename);
+        offset += padding;
+    }
+
+} // namespace detail
+
+/**
+ * Write the index to the file. The index must not be changed while this
+ * is running.
+ */
+template <typename T>
+void write(const std::string& filename, const osmium::nwr_array<ConcurrentIdSetDense<T>>& index, const fingerprint& source) {
+    using id_set_type = ConcurrentIdSetDense<T>;
+    constexpr const std::size_t words_per_chunk = (std::size_t(1) << id_set_type::chunk_id_bits()) / 64;
+
+    // Find all allocated chunks and build the directories.
+    std::vector<uint64_t> directories[3];
+    std::vector<const std::atomic<uint64_t>*> chunks;
+
+    file_header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = format_version;
+    header.chunk_bits = static_cast<uint32_t>(id_set_type::chunk_id_bits());
+    header.source = source;
+
+    uint64_t offset = sizeof(file_header);
+    offset += (page_size - offset % page_size) % page_size;
+
+    for (std::size_t n = 0; n < 3; ++n) {
+        index(osmium::nwr_index_to_item_type(static_cast<unsigned int>(n))).for_each_chunk([&](std::size_t cid, const std::atomic<uint64_t>* words) {
+            directories[n].resize(cid + 1, 0);
+            directories[n][cid] = chunks.size() + 1; // replaced by offset below
+            chunks.push_back(words);
+        });
+        header.num_chunks[n] = directories[n].size();
+        header.directory_offset[n] = offset;
+        offset += directories[n].size() * sizeof(uint64_t);
+    }
+
+    offset += (page_size - offset % page_size) % page_size;
+    const uint64_t chunks_offset = offset;
+    for (auto& directory : directories) {
+        for (auto& entry : directory) {
+            if (entry != 0) {
+                entry = chunks_offset + (entry - 1) * words_per_chunk * sizeof(uint64_t);
+            }
+        }
+    }
+
+    // Write into a temporary file which is only renamed to the final name
+    // when it is complete, so an interrupted run never leaves behind a file
+    // that looks like a valid index.
+    const std::string tmp_filename{filename + ".tmp"};
+    const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + tmp_filename + "'"};
+    }
+
+    try {
+        offset = 0;
+        detail::write_all(fd, &header, sizeof(header), tmp_filename);
+        offset += sizeof(header);
+        detail::write_padding(fd, offset, tmp_filename);
+
+        for (const auto& directory : directories) {
+            detail::write_all(fd, directory.data(), directory.size() * sizeof(uint64_t), tmp_filename);
+            offset += directory.size() * sizeof(uint64_t);
+        }
+        detail::write_padding(fd, offset, tmp_filename);
+
+        std::vector<uint64_t> buffer(words_per_chunk);
+        for (const auto* words : chunks) {
+            for (std::size_t i = 0; i < words_per_chunk; ++i) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            detail::write_all(fd, buffer.data(), buffer.size() * sizeof(uint64_t), tmp_filename);
+        }
+
+        if (::fsync(fd) != 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't sync file '"} + tmp_filename + "'"};
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(tmp_filename.c_str());
+        throw;
+    }
+
+    if (::close(fd) != 0) {
+        const int error = errno;
+        ::unlink(tmp_filename.c_str());
+        throw std::system_error{error, std::system_category(), std::string{"Can't close file '"} + tmp_filename + "'"};
+    }
+
+    if (::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        const int error = errno;
+        ::unlink(tmp_filename.c_str());
+        throw std::system_error{error, std::system_category(), std::string{"Can't rename '"} + tmp_filename + "' to '" + filename + "'"};
+    }
+}
+
+/**
+ * Read-only view of one of the ID sets in a memory mapped index file.
+ * Has the same get() interface as the other ID sets.
+ */
+class MappedIdSet {
+
+    const char* m_base = nullptr;
+    const uint64_t* m_directory = nullptr;
+    std::size_t m_num_chunks = 0;
+    std::size_t m_chunk_bits = 0;
+
+public:
+
+    MappedIdSet() = default;
+
+    MappedIdSet(const char* base, const file_header& header, std::size_t n) noexcept :
+        m_base(base),
+        m_directory(reinterpret_cast<const uint64_t*>(base + header.directory_offset[n])),
+        m_num_chunks(header.num_chunks[n]),
+        m_chunk_bits(header.chunk_bits) {
+    }
+
+    /// Is the ID in the set?
+    bool get(osmium::unsigned_object_id_type id) const noexcept {
+        const auto cid = static_cast<std::size_t>(id >> m_chunk_bits);
+        if (cid >= m_num_chunks || m_directory[cid] == 0) {
+            return false;
+        }
+
+        const auto* words = reinterpret_cast<const uint64_t*>(m_base + m_directory[cid]);
+        const auto offset = id & ((osmium::unsigned_object_id_type(1) << m_chunk_bits) - 1);
+        return (words[offset >> 6U] >> (offset & 0x3fU)) & 1U;
+    }
+
+    /// The number of bytes of the file used by this set.
+    std::size_t used_memory() const noexcept {
+        std::size_t size = m_num_chunks * sizeof(uint64_t);
+        for (std::size_t cid = 0; cid < m_num_chunks; ++cid) {
+            if (m_directory[cid] != 0) {
+                size += (std::size_t(1) << m_chunk_bits) / 8;
+            }
+        }
+        return size;
+    }
+
+}; // class MappedIdSet
+
+/**
+ * An index file opened for reading. The file is memory mapped, nothing
+ * is read until it is accessed.
+ */
+class IndexFile {
+
+    std::string m_filename;
+    osmium::util::MemoryMapping m_mapping;
+    osmium::nwr_array<MappedIdSet> m_id_sets;
+
+    static osmium::util::MemoryMapping map_file(const std::string& filename) {
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT(hicpp-signed-bitwise)
+        if (fd < 0) {
+            throw std::system_error{errno, std::system_category(), std::string{"Can't open file '"} + filename + "'"};
+        }
+
+        const auto size = osmium::util::file_size(fd);
+        if (size < sizeof(file_header)) {
+            ::close(fd);
+            throw std::runtime_error{std::string{"Reference index file '"} + filename + "' is too short"};
+        }
+
+        osmium::util::MemoryMapping mapping{size, osmium::util::MemoryMapping::mapping_mode::readonly, fd};
+        ::close(fd);
+        return mapping;
+    }
+
+public:
+
+    explicit IndexFile(const std::string& filename) :
+        m_filename(filename),
+        m_mapping(map_file(filename)) {
+        const auto& h = header();
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error{std::string{"File '"} + filename + "' is not a reference index"};
+        }
+        if (h.version != format_version) {
+            throw std::runtime_error{std::string{"Reference index file '"} + filename + "' has unsupported version " + std::to_string(h.version)};
+        }
+
+        // The chunks are bitmaps of whole 64 bit words.
+        if (h.chunk_bits < 6 || h.chunk_bits > 32) {
+            throw std::runtime_error{std::string{"Reference index file '"} + filename + "' has invalid chunk size"};
+        }
+        const uint64_t chunk_size = (uint64_t(1) << h.chunk_bits) / 8;
+        const uint64_t size = m_mapping.size();
+
+        for (std::size_t n = 0; n < 3; ++n) {
+            if (h.directory_offset[n] % sizeof(uint64_t) != 0 ||
+                h.directory_offset[n] > size ||
+                h.num_chunks[n] > (size - h.directory_offset[n]) / sizeof(uint64_t)) {
+                throw std::runtime_error{std::string{"Reference index file '"} + filename + "' is truncated"};
+            }
+
+            // Check all chunks are inside the file, so get() never reads
+            // beyond the end of the mapping.
+            const auto* directory = reinterpret_cast<const uint64_t*>(m_mapping.get_addr<char>() + h.directory_offset[n]);
+            for (uint64_t cid = 0; cid < h.num_chunks[n]; ++cid) {
+                const auto chunk_offset = directory[cid];
+                if (chunk_offset != 0 && (chunk_offset % sizeof(uint64_t) != 0 || chunk_offset > size || chunk_size > size - chunk_offset)) {
+                    throw std::runtime_error{std::string{"Reference index file '"} + filename + "' is truncated"};
+                }
+            }
+
+            m_id_sets(osmium::nwr_index_to_item_type(static_cast<unsigned int>(n))) = MappedIdSet{m_mapping.get_addr<char>(), h, n};
+        }
+    }
+
+    const file_header& header() const {
+        return *reinterpret_cast<const file_header*>(m_mapping.get_addr<char>());
+    }
+
+    /// Throw an exception if the index was not created from this OSM file.
+    void check_source(const std::string& osm_filename) const {
+        if (header().source != source_fingerprint(osm_filename)) {
+            throw std::runtime_error{std::string{"Reference index file '"} + m_filename + "' was not created from '" + osm_filename + "'"};
+        }
+    }
+
+    osmium::nwr_array<MappedIdSet>& id_sets() noexcept {
+        return m_id_sets;
+    }
+
+}; // class IndexFile
+
+} // namespace ref_index
+
+#endif // REF_INDEX_HPP
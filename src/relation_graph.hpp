@@ -0,0 +1,259 @@
+#ifndef RELATION_GRAPH_HPP
+#define RELATION_GRAPH_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "trace.hpp"
+
+/**
+ * Graph of relations which have relation members. It is used to find
+ * relations which are (directly or indirectly) members of themselves and
+ * to find the nesting depth of relations.
+ *
+ * Only relations with at least one relation member are nodes in the graph,
+ * all other relations can't be in a cycle and have a nesting depth of 0.
+ * Those relations are copied into a buffer, so they can be written out
+ * after the analysis. The edges are stored in compressed sparse row (CSR)
+ * format: the targets of all edges of node n are in
+ * m_targets[m_offsets[n]] to m_targets[m_offsets[n + 1] - 1].
+ *
+ * The strongly connected components (SCCs) are found with an iterative
+ * version of Tarjan's algorithm, so there is no recursion even for very
+ * long chains of relations. Tarjan's algorithm finishes a component only
+ * after all components reachable from it, so the nesting depth of each
+ * component can be calculated at that point in the same run.
+ */
+class RelationGraph {
+
+    using index_type = uint32_t;
+
+    // Marks unvisited nodes and relations not in the graph.
+    constexpr static const index_type invalid = std::numeric_limits<index_type>::max();
+
+    osmium::memory::Buffer m_buffer{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+
+    // ID and offset in the buffer of all relations in the graph, sorted
+    // by ID after analyze() was called.
+    std::vector<std::pair<osmium::unsigned_object_id_type, std::size_t>> m_relations;
+
+    std::vector<index_type> m_offsets;
+    std::vector<index_type> m_targets;
+
+    // Component for each node and nesting depth and cycle flag for each
+    // component.
+    std::vector<index_type> m_component;
+    std::vector<index_type> m_component_depth;
+    std::vector<bool> m_component_is_cycle;
+
+    std::size_t m_cycles = 0;
+    std::size_t m_max_depth = 0;
+
+    index_type find_node(osmium::unsigned_object_id_type id) const noexcept {
+        const auto it = std::lower_bound(m_relations.begin(), m_relations.end(), id, [](const std::pair<osmium::unsigned_object_id_type, std::size_t>& r, osmium::unsigned_object_id_type i) {
+            return r.first < i;
+        });
+        if (it == m_relations.end() || it->first != id) {
+            return invalid;
+        }
+        return static_cast<index_type>(it - m_relations.begin());
+    }
+
+    const osmium::Relation& relation(index_type node) const {
+        return m_buffer.get<osmium::Relation>(m_relations[node].second);
+    }
+
+    void build_edges() {
+        m_offsets.reserve(m_relations.size() + 1);
+        m_offsets.push_back(0);
+        for (index_type node = 0; node < m_relations.size(); ++node) {
+            for (const auto& member : relation(node).members()) {
+                if (member.type() == osmium::item_type::relation) {
+                    const auto target = find_node(member.positive_ref());
+                    if (target != invalid) {
+                        m_targets.push_back(target);
+                    }
+                }
+            }
+            m_offsets.push_back(static_cast<index_type>(m_targets.size()));
+        }
+        m_targets.shrink_to_fit();
+    }
+
+    // The nodes of the component are on the stack from the root upwards.
+    void finish_component(std::vector<index_type>& stack, std::vector<bool>& on_stack, index_type root) {
+        const auto component = static_cast<index_type>(m_component_depth.size());
+
+        // Relations which only have relation members which are not in the
+        // graph have nesting depth 1.
+        index_type depth = 1;
+
+        const auto first = std::find(stack.rbegin(), stack.rend(), root).base() - 1;
+        for (auto member = first; member != stack.end(); ++member) {
+            m_component[*member] = component;
+            on_stack[*member] = false;
+        }
+
+        bool is_cycle = (stack.end() - first) > 1;
+        for (auto member = first; member != stack.end(); ++member) {
+            for (auto e = m_offsets[*member]; e < m_offsets[*member + 1]; ++e) {
+                const auto target = m_targets[e];
+                if (m_component[target] == component) {
+                    is_cycle = is_cycle || target == *member;
+                } else {
+                    depth = std::max(depth, static_cast<index_type>(m_component_depth[m_component[target]] + 1));
+                }
+            }
+        }
+
+        stack.erase(first, stack.end());
+
+        m_component_depth.push_back(depth);
+        m_component_is_cycle.push_back(is_cycle);
+        if (is_cycle) {
+            ++m_cycles;
+        }
+        m_max_depth = std::max(m_max_depth, static_cast<std::size_t>(depth));
+    }
+
+    void find_components() {
+        const auto num_nodes = static_cast<index_type>(m_relations.size());
+
+        std::vector<index_type> index(num_nodes, index_type{invalid});
+        std::vector<index_type> lowlink(num_nodes, 0);
+        std::vector<bool> on_stack(num_nodes, false);
+        std::vector<index_type> stack;
+
+        // Replaces the call stack of the recursive version: the node and
+        // the next edge to look at.
+        std::vector<std::pair<index_type, index_type>> call_stack;
+
+        m_component.assign(num_nodes, index_type{invalid});
+
+        index_type next_index = 0;
+        for (index_type start = 0; start < num_nodes; ++start) {
+            if (index[start] != invalid) {
+                continue;
+            }
+
+            index[start] = lowlink[start] = next_index++;
+            stack.push_back(start);
+            on_stack[start] = true;
+            call_stack.emplace_back(start, m_offsets[start]);
+
+            while (!call_stack.empty()) {
+                const auto node = call_stack.back().first;
+                auto& edge = call_stack.back().second;
+
+                if (edge < m_offsets[node + 1]) {
+                    const auto target = m_targets[edge++];
+                    if (index[target] == invalid) {
+                        index[target] = lowlink[target] = next_index++;
+                        stack.push_back(target);
+                        on_stack[target] = true;
+                        call_stack.emplace_back(target, m_offsets[target]);
+                    } else if (on_stack[target]) {
+                        lowlink[node] = std::min(lowlink[node], index[target]);
+                    }
+                    continue;
+                }
+
+                call_stack.pop_back();
+                if (!call_stack.empty()) {
+                    const auto parent = call_stack.back().first;
+                    lowlink[parent] = std::min(lowlink[parent], lowlink[node]);
+                }
+
+                if (lowlink[node] == index[node]) {
+                    finish_component(stack, on_stack, node);
+                }
+            }
+        }
+    }
+
+public:
+
+    /// Add relation to the graph if it has any relation members.
+    void add(const osmium::Relation& relation) {
+        const bool has_relation_member = std::any_of(relation.members().cbegin(), relation.members().cend(), [](const osmium::RelationMember& member) {
+            return member.type() == osmium::item_type::relation;
+        });
+        if (has_relation_member) {
+            m_relations.emplace_back(relation.positive_id(), m_buffer.committed());
+            m_buffer.add_item(relation);
+            m_buffer.commit();
+        }
+    }
+
+    /// Build the graph and find cycles and nesting depths.
+    void analyze() {
+        trace::Span span{"RelationGraph::analyze"};
+
+        std::sort(m_relations.begin(), m_relations.end());
+        build_edges();
+        find_components();
+
+        std::vector<index_type>{}.swap(m_offsets);
+        std::vector<index_type>{}.swap(m_targets);
+    }
+
+    /// The number of relations in the graph.
+    std::size_t size() const noexcept {
+        return m_relations.size();
+    }
+
+    /// The number of cycles found. Only valid after analyze().
+    std::size_t cycles() const noexcept {
+        return m_cycles;
+    }
+
+    /// The largest nesting depth found. Only valid after analyze().
+    std::size_t max_depth() const noexcept {
+        return m_max_depth;
+    }
+
+    /**
+     * Call func(relation, in_cycle, depth) for all relations in the graph.
+     * Relations in a cycle get the nesting depth of the relations below
+     * the cycle plus 1. Only valid after analyze().
+     */
+    template <typename TFunc>
+    void for_each(TFunc&& func) const {
+        for (index_type node = 0; node < m_relations.size(); ++node) {
+            const auto component = m_component[node];
+            std::forward<TFunc>(func)(relation(node), bool(m_component_is_cycle[component]), static_cast<std::size_t>(m_component_depth[component]));
+        }
+    }
+
+}; // class RelationGraph
+
+#endif // RELATION_GRAPH_HPP
@@ -0,0 +1,379 @@
+#ifndef RELATION_PROBLEMS_HPP
+#define RELATION_PROBLEMS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <osmium/index/id_set.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include "outputs.hpp"
+#include "relation_graph.hpp"
+#include "tag_classifier.hpp"
+#include "utils.hpp"
+
+namespace relation_problems {
+
+static const char* const program_name = "odad-find-relation-problems";
+static const size_t min_members_of_large_relations = 1000;
+static const size_t min_depth_of_deep_nesting = 6;
+
+/// IDs of the outputs, same order as in the output_definitions table.
+enum output_id : std::size_t {
+    relation_no_members,
+    relation_no_tag,
+    relation_only_type_tag,
+    relation_no_type_tag,
+    relation_large,
+    relation_cycle,
+    relation_deep_nesting,
+    multipolygon_node_member,
+    multipolygon_relation_member,
+    multipolygon_unknown_role,
+    multipolygon_empty_role,
+    multipolygon_area_tag,
+    multipolygon_boundary_administrative_tag,
+    multipolygon_boundary_other_tag,
+    multipolygon_old_style,
+    multipolygon_single_way,
+    multipolygon_duplicate_way,
+    boundary_empty_role,
+    boundary_duplicate_way,
+    boundary_area_tag,
+    boundary_no_boundary_tag,
+    num_outputs
+};
+
+static const output_definition output_definitions[] = {
+    {"relation_no_members", false, false},
+    {"relation_no_tag", true, true},
+    {"relation_only_type_tag", true, true},
+    {"relation_no_type_tag", true, true},
+    {"relation_large", true, true},
+    {"relation_cycle", false, false},
+    {"relation_deep_nesting", false, false},
+    {"multipolygon_node_member", true, false},
+    {"multipolygon_relation_member", false, false},
+    {"multipolygon_unknown_role", false, true},
+    {"multipolygon_empty_role", false, true},
+    {"multipolygon_area_tag", false, true},
+    {"multipolygon_boundary_administrative_tag", false, true},
+    {"multipolygon_boundary_other_tag", false, true},
+    {"multipolygon_old_style", false, false},
+    {"multipolygon_single_way", false, true},
+    {"multipolygon_duplicate_way", false, true},
+    {"boundary_empty_role", false, true},
+    {"boundary_duplicate_way", false, true},
+    {"boundary_area_tag", false, true},
+    {"boundary_no_boundary_tag", false, true},
+};
+
+static_assert(sizeof(output_definitions) / sizeof(output_definition) == num_outputs, "output_definitions must have one entry for each output_id");
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    std::size_t output_memory = OutputMultiplexer::default_memory_limit_mb;
+    std::string location_index;
+    Shard shard;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t relation_members = 0;
+    uint64_t relation_cycles = 0;
+    uint64_t relation_max_nesting_depth = 0;
+};
+
+/**
+ * Matches all tags except those with keys that don't say anything about
+ * what an object is. It has no state, so it is cheap to copy.
+ */
+struct MPFilter {
+
+    bool operator()(const osmium::Tag& tag) const noexcept {
+        static const KeyClassifier ignored_keys{"type", "created_by", "source", "note"};
+        return !ignored_keys.contains(tag.key());
+    }
+
+}; // struct MPFilter
+
+class CheckHandler : public osmium::handler::Handler {
+
+    Outputs& m_outputs;
+    options_type m_options;
+    stats_type m_stats;
+    MPFilter m_mp_filter;
+    RelationGraph m_graph;
+
+    static std::vector<osmium::unsigned_object_id_type> find_duplicate_ways(const osmium::Relation& relation) {
+        std::vector<osmium::unsigned_object_id_type> duplicate_ids;
+
+        std::vector<osmium::unsigned_object_id_type> way_ids;
+        way_ids.reserve(relation.members().size());
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::way) {
+                way_ids.push_back(member.positive_ref());
+            }
+        }
+        std::sort(way_ids.begin(), way_ids.end());
+
+        auto it = way_ids.begin();
+        while (it != way_ids.end()) {
+            it = std::adjacent_find(it, way_ids.end());
+            if (it != way_ids.end()) {
+                duplicate_ids.push_back(*it);
+                ++it;
+            }
+        }
+
+        return duplicate_ids;
+    }
+
+    void multipolygon_relation(const osmium::Relation& relation) {
+        if (relation.members().empty()) {
+            return;
+        }
+
+        std::uint64_t node_member = 0;
+        std::uint64_t relation_member = 0;
+        std::uint64_t unknown_role = 0;
+        std::uint64_t empty_role = 0;
+
+        for (const auto& member : relation.members()) {
+            switch (member.type()) {
+                case osmium::item_type::node:
+                    ++node_member;
+                    break;
+                case osmium::item_type::way:
+                    if (member.role()[0] == '\0') {
+                        ++empty_role;
+                    } else if (std::strcmp(member.role(), "inner") &&
+                               std::strcmp(member.role(), "outer")) {
+                        ++unknown_role;
+                    }
+                    break;
+                case osmium::item_type::relation:
+                    ++relation_member;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (node_member != 0U) {
+            m_outputs[multipolygon_node_member].add(relation, node_member);
+        }
+
+        if (relation_member != 0U) {
+            m_outputs[multipolygon_relation_member].add(relation, relation_member);
+        }
+
+        if (unknown_role != 0U) {
+            m_outputs[multipolygon_unknown_role].add(relation, unknown_role);
+        }
+
+        if (empty_role != 0U) {
+            m_outputs[multipolygon_empty_role].add(relation, empty_role);
+        }
+
+        if (relation.members().size() == 1 && relation.members().cbegin()->type() == osmium::item_type::way) {
+            m_outputs[multipolygon_single_way].add(relation);
+        }
+
+        const auto duplicates = find_duplicate_ways(relation);
+        if (!duplicates.empty()) {
+            m_outputs[multipolygon_duplicate_way].add(relation, 1, duplicates);
+        }
+
+        if (relation.tags().size() == 1 || std::none_of(relation.tags().cbegin(), relation.tags().cend(), std::cref(m_mp_filter))) {
+            m_outputs[multipolygon_old_style].add(relation);
+            return;
+        }
+
+        const char* area = relation.tags().get_value_by_key("area");
+        if (area) {
+            m_outputs[multipolygon_area_tag].add(relation);
+        }
+
+        const char* boundary = relation.tags().get_value_by_key("boundary");
+        if (boundary) {
+            if (!std::strcmp(boundary, "administrative")) {
+                m_outputs[multipolygon_boundary_administrative_tag].add(relation);
+            } else {
+                m_outputs[multipolygon_boundary_other_tag].add(relation);
+            }
+        }
+    }
+
+    /**
+     * Find relations which are members of themselves (directly or through
+     * other relations) and relations nested very deeply. This can only be
+     * done after all relations have been seen.
+     */
+    void relation_graph_problems() {
+        m_graph.analyze();
+
+        m_stats.relation_cycles = m_graph.cycles();
+        m_stats.relation_max_nesting_depth = m_graph.max_depth();
+
+        m_graph.for_each([&](const osmium::Relation& relation, bool in_cycle, std::size_t depth) {
+            if (!m_options.shard.contains(relation)) {
+                return;
+            }
+            if (in_cycle) {
+                m_outputs[relation_cycle].add(relation);
+            }
+            if (depth >= min_depth_of_deep_nesting) {
+                m_outputs[relation_deep_nesting].add(relation);
+            }
+        });
+    }
+
+    void boundary_relation(const osmium::Relation& relation) {
+        if (relation.members().empty()) {
+            return;
+        }
+
+        uint64_t empty_role = 0;
+        for (const auto& member : relation.members()) {
+            if (member.role()[0] == '\0') {
+                ++empty_role;
+            }
+        }
+        if (empty_role != 0U) {
+            m_outputs[boundary_empty_role].add(relation, empty_role);
+        }
+
+        const auto duplicates = find_duplicate_ways(relation);
+        if (!duplicates.empty()) {
+            m_outputs[boundary_duplicate_way].add(relation, 1, duplicates);
+        }
+
+        const char* area = relation.tags().get_value_by_key("area");
+        if (area) {
+            m_outputs[boundary_area_tag].add(relation);
+        }
+
+        // is boundary:historic or historic:boundary also okay?
+        const char* boundary = relation.tags().get_value_by_key("boundary");
+        if (!boundary) {
+            m_outputs[boundary_no_boundary_tag].add(relation);
+        }
+    }
+
+public:
+
+    CheckHandler(Outputs& outputs, const options_type& options) :
+        m_outputs(outputs),
+        m_options(options) {
+    }
+
+    void relation(const osmium::Relation& relation) {
+        if (relation.timestamp() >= m_options.before_time) {
+            return;
+        }
+
+        // Cycles and nesting depth need the relations of all shards.
+        m_graph.add(relation);
+
+        if (!m_options.shard.contains(relation)) {
+            return;
+        }
+
+        m_stats.relation_members += relation.members().size();
+
+        if (relation.members().empty()) {
+            m_outputs[relation_no_members].add(relation);
+        }
+
+        if (relation.members().size() >= min_members_of_large_relations) {
+            m_outputs[relation_large].add(relation);
+        }
+
+        if (relation.tags().empty()) {
+            m_outputs[relation_no_tag].add(relation);
+            return;
+        }
+
+        const char* type = relation.tags().get_value_by_key("type");
+        if (!type) {
+            m_outputs[relation_no_type_tag].add(relation);
+            return;
+        }
+
+        if (relation.tags().size() == 1) {
+            m_outputs[relation_only_type_tag].add(relation);
+        }
+
+        if (!std::strcmp(type, "multipolygon")) {
+            multipolygon_relation(relation);
+        } else if (!std::strcmp(type, "boundary")) {
+            boundary_relation(relation);
+        }
+    }
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+    void close() {
+        relation_graph_problems();
+        m_outputs.for_all([](Output& output) {
+            output.close_writer_rel();
+        });
+    }
+
+}; // class CheckHandler
+
+inline void add_outputs(Outputs& outputs) {
+    outputs.add_outputs(output_definitions);
+}
+
+inline void add_stats(const stats_type& stats, Outputs& outputs, std::function<void(const char*, uint64_t)>& add_stat) {
+    add_stat("relation_member_count", stats.relation_members);
+    add_stat("relation_cycle_count", stats.relation_cycles);
+    add_stat("relation_max_nesting_depth", stats.relation_max_nesting_depth);
+    outputs.for_all([&](Output& output){
+        add_stat(output.name(), output.counter());
+    });
+}
+
+} // namespace relation_problems
+
+#endif // RELATION_PROBLEMS_HPP
@@ -0,0 +1,368 @@
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include "ref_index.hpp"
+#include "trace.hpp"
+
+/**
+ * One of N shards of the work, so that a run can be split over several
+ * machines. Each machine reads the whole input file, but only checks and
+ * writes out the objects in its shard. The results are combined with
+ * odad-merge-shards afterwards.
+ *
+ * Objects are assigned to shards by ID. Checks working on node locations
+ * assign nodes by the cell of the location instead, so that nodes at the
+ * same location always end up in the same shard.
+ *
+ * Shards are numbered from 1 to N on the command line ("K/N") and from 0
+ * to N-1 internally.
+ */
+class Shard {
+
+    // Size of the cells used to assign locations to shards in coordinate
+    // units (1/10^7 degrees), this is 0.1 degrees.
+    constexpr static const int32_t cell_size = 1000000;
+
+    uint32_t m_index = 0;
+    uint32_t m_count = 1;
+
+    static uint32_t parse_number(const std::string& str) {
+        char* end = nullptr;
+        const auto value = std::strtoul(str.c_str(), &end, 10);
+        if (str.empty() || !end || *end != '\0' || value == 0 || value > 1024) {
+            return 0;
+        }
+        return static_cast<uint32_t>(value);
+    }
+
+    static uint64_t mix(uint64_t value) noexcept {
+        value ^= value >> 30U;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27U;
+        value *= 0x94d049bb133111ebULL;
+        value ^= value >> 31U;
+        return value;
+    }
+
+public:
+
+    /// The default is one shard containing everything.
+    Shard() = default;
+
+    /// Create from a string of the form "K/N" with 1 <= K <= N.
+    explicit Shard(const std::string& spec) {
+        const auto pos = spec.find('/');
+        const auto k = pos == std::string::npos ? 0 : parse_number(spec.substr(0, pos));
+        const auto n = pos == std::string::npos ? 0 : parse_number(spec.substr(pos + 1));
+        if (k == 0 || n == 0 || k > n) {
+            throw std::runtime_error{"Invalid shard '" + spec + "' (use K/N with 1 <= K <= N <= 1024)"};
+        }
+        m_index = k - 1;
+        m_count = n;
+    }
+
+    /// Is this the only shard, so everything is processed?
+    bool all() const noexcept {
+        return m_count == 1;
+    }
+
+    /// The number of this shard (0 to count() - 1).
+    uint32_t index() const noexcept {
+        return m_index;
+    }
+
+    /// The number of shards.
+    uint32_t count() const noexcept {
+        return m_count;
+    }
+
+    std::string to_string() const {
+        return std::to_string(m_index + 1) + "/" + std::to_string(m_count);
+    }
+
+    bool contains(osmium::unsigned_object_id_type id) const noexcept {
+        return id % m_count == m_index;
+    }
+
+    bool contains(const osmium::OSMObject& object) const noexcept {
+        return contains(object.positive_id());
+    }
+
+    /**
+     * Is the location in this shard? The cells are spread over the shards
+     * using a hash, so that dense areas are split over all shards.
+     */
+    bool contains(const osmium::Location& location) const noexcept {
+        if (m_count == 1) {
+            return true;
+        }
+        const auto x = static_cast<uint64_t>((static_cast<int64_t>(location.x()) + 1800000000) / cell_size);
+        const auto y = static_cast<uint64_t>((static_cast<int64_t>(location.y()) + 900000000) / cell_size);
+        return mix((x << 32U) | y) % m_count == m_index;
+    }
+
+}; // class Shard
+
+namespace shard {
+
+    static const char exchange_magic[8] = {'O', 'D', 'A', 'D', 'S', 'H', 'R', 'D'};
+
+    // ShardExchange checks for missing parts this often.
+    constexpr const unsigned int exchange_poll_interval_ms = 1000;
+
+    // Default for the time ShardExchange waits for the other shards.
+    constexpr const unsigned int default_exchange_timeout_s = 2 * 60 * 60;
+
+    /// Name of the file in the output directory recording the shard.
+    constexpr const char* const info_filename = "shard.txt";
+
+    /**
+     * Write the shard into the output directory, so odad-merge-shards can
+     * check that it has the results of all shards. Nothing is written if
+     * there is only one shard.
+     */
+    inline void write_info(const std::string& output_dirname, const Shard& shard) {
+        if (shard.all()) {
+            return;
+        }
+
+        const std::string filename{output_dirname + "/" + info_filename};
+        std::ofstream file{filename};
+        file << shard.to_string() << '\n';
+        file.close();
+        if (!file) {
+            throw std::runtime_error{"Can't write file '" + filename + "'"};
+        }
+    }
+
+    /// Read the shard from the output directory of a sharded run.
+    inline Shard read_info(const std::string& output_dirname) {
+        const std::string filename{output_dirname + "/" + info_filename};
+        std::ifstream file{filename};
+        std::string spec;
+        if (!(file >> spec)) {
+            throw std::runtime_error{"Can't read file '" + filename + "', is '" + output_dirname + "' the output of a sharded run?"};
+        }
+        return Shard{spec};
+    }
+
+    /**
+     * Most stats are counts of objects in the shard, they are added up
+     * over all shards. Stats that every shard calculates over all the data
+     * (because every shard sees all relations) use the maximum. So do the
+     * wall times of the phases (because the shards run in parallel) and
+     * the objects and bytes read (because every shard reads the whole
+     * input), so they are the same as for a single run.
+     */
+    inline bool merge_with_max(const std::string& key) {
+        static const char* const suffixes[] = {"_wall_ms", "_objects", "_objects_per_sec", "_bytes_read"};
+
+        if (key == "relation_cycle_count" || key == "relation_max_nesting_depth") {
+            return true;
+        }
+
+        if (key.compare(0, 5, "perf_") != 0) {
+            return false;
+        }
+
+        for (const char* suffix : suffixes) {
+            const std::size_t suffix_len = std::strlen(suffix);
+            if (key.size() > suffix_len && key.compare(key.size() - suffix_len, suffix_len, suffix) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+} // namespace shard
+
+/**
+ * Exchange of data between shards through files in a directory all shards
+ * can access, for instance on a network file system. This is needed for
+ * checks where each shard finds part of the data, but all shards need all
+ * of it for the next step.
+ *
+ * Each shard writes its part to NAME-K-of-N.dat and then waits until the
+ * parts of all other shards are there. Parts are written to a temporary
+ * file which is renamed when complete, so a part that is there is always
+ * complete. Each part starts with a header containing the size and a hash
+ * of the input file and a run ID given by the caller, which must be the
+ * same on all shards and depend on all options changing the data that is
+ * exchanged. Parts left over from runs on other input files or with other
+ * options are ignored. (Unlike for the reference index the modification
+ * time is not used, because every machine might have its own copy of the
+ * input file.)
+ *
+ * If a shard is missing after the timeout, collect() throws an exception,
+ * so the other shards don't wait forever if a shard crashed.
+ */
+class ShardExchange {
+
+    struct part_header {
+        char magic[8];
+        uint32_t shard_count;
+        uint32_t shard_index;
+        uint64_t source_size;
+        uint64_t source_hash;
+        uint64_t run_id;
+        uint64_t data_size;
+    };
+
+    std::string m_dirname;
+    Shard m_shard;
+    ref_index::fingerprint m_source;
+    uint64_t m_run_id;
+    unsigned int m_timeout_s;
+
+    std::string part_filename(const char* name, uint32_t index) const {
+        return m_dirname + "/" + name + "-" + std::to_string(index + 1) + "-of-" + std::to_string(m_shard.count()) + ".dat";
+    }
+
+    bool matches(const part_header& header, uint32_t index) const noexcept {
+        return std::memcmp(header.magic, shard::exchange_magic, sizeof(header.magic)) == 0 &&
+               header.shard_count == m_shard.count() &&
+               header.shard_index == index &&
+               header.source_size == m_source.size &&
+               header.source_hash == m_source.hash &&
+               header.run_id == m_run_id;
+    }
+
+    /**
+     * Read part of the specified shard and append its data to out.
+     * Returns false if the part is not there (yet).
+     */
+    template <typename T>
+    bool read_part(const char* name, uint32_t index, std::vector<T>& out) const {
+        const auto filename = part_filename(name, index);
+        std::ifstream file{filename, std::ios::binary};
+
+        part_header header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || !matches(header, index)) {
+            return false;
+        }
+
+        const auto size = out.size();
+        out.resize(size + header.data_size / sizeof(T));
+        if (!file.read(reinterpret_cast<char*>(out.data() + size), static_cast<std::streamsize>(header.data_size))) {
+            throw std::runtime_error{"Can't read file '" + filename + "'"};
+        }
+
+        return true;
+    }
+
+public:
+
+    /**
+     * Create exchange in the directory. Collecting waits at most timeout_s
+     * seconds for the other shards, 0 means forever.
+     */
+    ShardExchange(const std::string& dirname, const Shard& shard, const std::string& input_filename, uint64_t run_id, unsigned int timeout_s = shard::default_exchange_timeout_s) :
+        m_dirname(dirname),
+        m_shard(shard),
+        m_source(ref_index::source_fingerprint(input_filename)),
+        m_run_id(run_id),
+        m_timeout_s(timeout_s) {
+    }
+
+    /// Write the part of this shard.
+    template <typename T>
+    void publish(const char* name, const std::vector<T>& data) const {
+        trace::Span span{"ShardExchange::publish"};
+
+        part_header header{};
+        std::memcpy(header.magic, shard::exchange_magic, sizeof(header.magic));
+        header.shard_count = m_shard.count();
+        header.shard_index = m_shard.index();
+        header.source_size = m_source.size;
+        header.source_hash = m_source.hash;
+        header.run_id = m_run_id;
+        header.data_size = data.size() * sizeof(T);
+
+        const auto filename = part_filename(name, m_shard.index());
+        const std::string tmp_filename{filename + ".tmp"};
+
+        std::ofstream file{tmp_filename, std::ios::binary};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(header.data_size));
+        file.close();
+        if (!file) {
+            throw std::runtime_error{"Can't write file '" + tmp_filename + "'"};
+        }
+
+        if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            throw std::system_error{errno, std::system_category(), "Can't rename '" + tmp_filename + "' to '" + filename + "'"};
+        }
+    }
+
+    /**
+     * Wait until the parts of all shards are there and return all their
+     * data (in the order of the shards). Call publish() first. Throws if
+     * a part is still missing after the timeout.
+     */
+    template <typename T>
+    std::vector<T> collect(const char* name, osmium::util::VerboseOutput& vout) const {
+        trace::Span span{"ShardExchange::collect"};
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{m_timeout_s};
+
+        std::vector<T> data;
+        for (uint32_t index = 0; index < m_shard.count(); ++index) {
+            bool waiting = false;
+            while (!read_part(name, index, data)) {
+                if (m_timeout_s != 0 && std::chrono::steady_clock::now() >= deadline) {
+                    throw std::runtime_error{"Timeout waiting for shard " + std::to_string(index + 1) + '/' + std::to_string(m_shard.count()) + " to write '" + part_filename(name, index) + "'"};
+                }
+                if (!waiting) {
+                    vout << "Waiting for shard " << (index + 1) << '/' << m_shard.count() << " to write '" << part_filename(name, index) << "'...\n";
+                    waiting = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds{shard::exchange_poll_interval_ms});
+            }
+        }
+
+        return data;
+    }
+
+}; // class ShardExchange
+
+#endif // SHARD_HPP
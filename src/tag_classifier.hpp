@@ -0,0 +1,145 @@
+#ifndef TAG_CLASSIFIER_HPP
+#define TAG_CLASSIFIER_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <bitset>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <osmium/osm/tag.hpp>
+
+/**
+ * Set of keys with a fast lookup. This is used instead of an
+ * osmium::TagsFilter for the common case where only keys are compared.
+ *
+ * Keys are put into buckets by length and a key is only compared against
+ * the keys in its bucket. Before that a bitmap of all first characters is
+ * checked, so most keys not in the set are rejected without even looking
+ * at their length.
+ */
+class KeyClassifier {
+
+    std::bitset<256> m_first_chars;
+    std::vector<std::vector<std::string>> m_buckets;
+    std::size_t m_size = 0;
+
+public:
+
+    KeyClassifier() = default;
+
+    KeyClassifier(std::initializer_list<const char*> keys) {
+        for (const char* key : keys) {
+            add_key(key);
+        }
+    }
+
+    void add_key(const std::string& key) {
+        if (key.empty() || contains(key.c_str())) {
+            return;
+        }
+
+        m_first_chars.set(static_cast<unsigned char>(key[0]));
+        if (key.size() >= m_buckets.size()) {
+            m_buckets.resize(key.size() + 1);
+        }
+        m_buckets[key.size()].push_back(key);
+        ++m_size;
+    }
+
+    /**
+     * Add keys from a file with one key per line. Empty lines and lines
+     * starting with '#' are ignored.
+     */
+    void add_keys_from_file(const std::string& filename) {
+        std::ifstream file{filename};
+        if (!file.is_open()) {
+            throw std::runtime_error{"Can't open file '" + filename + "'"};
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                add_key(line);
+            }
+        }
+    }
+
+    /// The number of keys in the set.
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    bool contains(const char* key) const noexcept {
+        if (!m_first_chars.test(static_cast<unsigned char>(key[0]))) {
+            return false;
+        }
+
+        const auto length = std::strlen(key);
+        if (length >= m_buckets.size()) {
+            return false;
+        }
+
+        for (const auto& k : m_buckets[length]) {
+            if (!std::memcmp(k.data(), key, length)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// Is the key of this tag in the set?
+    bool operator()(const osmium::Tag& tag) const noexcept {
+        return contains(tag.key());
+    }
+
+    /**
+     * Are all keys of the tags in the set? Keys in a tag list are unique,
+     * so a tag list with more tags than there are keys in the set can
+     * never match. Returns true for an empty tag list.
+     */
+    bool all_of(const osmium::TagList& tags) const noexcept {
+        if (tags.size() > m_size) {
+            return false;
+        }
+
+        for (const auto& tag : tags) {
+            if (!contains(tag.key())) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+}; // class KeyClassifier
+
+#endif // TAG_CLASSIFIER_HPP
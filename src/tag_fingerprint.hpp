@@ -0,0 +1,117 @@
+#ifndef TAG_FINGERPRINT_HPP
+#define TAG_FINGERPRINT_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <osmium/osm/tag.hpp>
+
+/**
+ * Order-independent 64 bit fingerprints of tag lists.
+ *
+ * Each tag is hashed (FNV-1a over key and value followed by the splitmix64
+ * finalizer) and the hashes of all tags are added up. Keys in a tag list
+ * are unique, so adding up the hashes doesn't lose anything. Two tag lists
+ * with the same tags (in any order) always have the same fingerprint, tag
+ * lists with different fingerprints never have the same tags. If the
+ * fingerprints are the same, the tags must still be compared to be sure.
+ */
+namespace tag_fingerprint {
+
+    namespace detail {
+
+        inline uint64_t fnv1a(uint64_t hash, const char* str) noexcept {
+            for (; *str; ++str) {
+                hash ^= static_cast<unsigned char>(*str);
+                hash *= 0x100000001b3ULL;
+            }
+            return hash;
+        }
+
+        inline uint64_t mix(uint64_t hash) noexcept {
+            hash ^= hash >> 30U;
+            hash *= 0xbf58476d1ce4e5b9ULL;
+            hash ^= hash >> 27U;
+            hash *= 0x94d049bb133111ebULL;
+            hash ^= hash >> 31U;
+            return hash;
+        }
+
+    } // namespace detail
+
+    /// Fingerprint of a single tag.
+    inline uint64_t of(const osmium::Tag& tag) noexcept {
+        uint64_t hash = detail::fnv1a(0xcbf29ce484222325ULL, tag.key());
+        hash ^= 0xffU; // separator, can't be part of a valid UTF-8 string
+        hash *= 0x100000001b3ULL;
+        return detail::mix(detail::fnv1a(hash, tag.value()));
+    }
+
+    /**
+     * Fingerprint of all tags matching the filter. An empty list of tags
+     * has the fingerprint 0.
+     */
+    template <typename TFilter>
+    uint64_t of(const osmium::TagList& tags, const TFilter& filter) noexcept {
+        uint64_t fingerprint = 0;
+        for (const auto& tag : tags) {
+            if (filter(tag)) {
+                fingerprint += of(tag);
+            }
+        }
+        return fingerprint;
+    }
+
+    /**
+     * Do the two tag lists have the same tags matching the filter,
+     * regardless of the order? This is the full comparison that should
+     * only be done if the fingerprints are the same.
+     */
+    template <typename TFilter>
+    bool same_tags(const osmium::TagList& a, const osmium::TagList& b, const TFilter& filter) noexcept {
+        std::size_t count_a = 0;
+        for (const auto& tag : a) {
+            if (filter(tag)) {
+                const char* value = b.get_value_by_key(tag.key());
+                if (!value || std::strcmp(value, tag.value()) != 0) {
+                    return false;
+                }
+                ++count_a;
+            }
+        }
+
+        std::size_t count_b = 0;
+        for (const auto& tag : b) {
+            if (filter(tag)) {
+                ++count_b;
+            }
+        }
+
+        return count_a == count_b;
+    }
+
+} // namespace tag_fingerprint
+
+#endif // TAG_FINGERPRINT_HPP
@@ -0,0 +1,227 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+/**
+ * Low-overhead tracing of scoped spans. The trace can be written out in the
+ * Chrome trace event format which can be viewed in chrome://tracing or in
+ * Perfetto (https://ui.perfetto.dev/).
+ *
+ * Each thread records its spans into its own ring buffer, so no locking is
+ * needed while recording. If there are more spans than fit into the ring
+ * buffer, the oldest are overwritten. When tracing is disabled, a span only
+ * costs one relaxed atomic load.
+ *
+ * Span names must be string literals (or otherwise live until the trace is
+ * written) and must not contain characters that need escaping in JSON.
+ */
+namespace trace {
+
+    struct event {
+        const char* name;
+        uint64_t start_us;
+        uint64_t duration_us;
+    };
+
+    class ThreadBuffer {
+
+        // number of events kept per thread
+        constexpr static const std::size_t capacity = 1U << 18U;
+
+        std::vector<event> m_events;
+        std::size_t m_next = 0;
+        uint32_t m_tid;
+
+    public:
+
+        explicit ThreadBuffer(uint32_t tid) :
+            m_tid(tid) {
+            m_events.reserve(capacity);
+        }
+
+        uint32_t tid() const noexcept {
+            return m_tid;
+        }
+
+        void add(const char* name, uint64_t start_us, uint64_t duration_us) {
+            if (m_events.size() < capacity) {
+                m_events.push_back(event{name, start_us, duration_us});
+            } else {
+                m_events[m_next] = event{name, start_us, duration_us};
+                m_next = (m_next + 1) % capacity;
+            }
+        }
+
+        template <typename TFunc>
+        void for_each(TFunc&& func) const {
+            for (std::size_t i = 0; i < m_events.size(); ++i) {
+                std::forward<TFunc>(func)(m_events[(m_next + i) % m_events.size()]);
+            }
+        }
+
+    }; // class ThreadBuffer
+
+    class Tracer {
+
+        std::atomic<bool> m_enabled{false};
+        std::chrono::steady_clock::time_point m_start{std::chrono::steady_clock::now()};
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+
+        ThreadBuffer& thread_buffer() {
+            static thread_local ThreadBuffer* buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard<std::mutex> lock{m_mutex};
+                m_buffers.emplace_back(new ThreadBuffer{static_cast<uint32_t>(m_buffers.size() + 1)});
+                buffer = m_buffers.back().get();
+            }
+            return *buffer;
+        }
+
+    public:
+
+        static Tracer& instance() {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        bool enabled() const noexcept {
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+
+        /// Enable tracing. Must be called from the main thread.
+        void enable() {
+            thread_buffer(); // makes sure the main thread gets tid 1
+            m_start = std::chrono::steady_clock::now();
+            m_enabled.store(true);
+        }
+
+        uint64_t now_us() const noexcept {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+        }
+
+        void add(const char* name, uint64_t start_us, uint64_t end_us) {
+            thread_buffer().add(name, start_us, end_us - start_us);
+        }
+
+        /**
+         * Write all recorded spans to the file in Chrome trace event
+         * format. Call this only after all traced work is done.
+         */
+        void write(const std::string& filename) {
+            std::unique_ptr<std::FILE, decltype(&std::fclose)> file{std::fopen(filename.c_str(), "w"), &std::fclose};
+            if (!file) {
+                throw std::system_error{errno, std::system_category(), std::string{"Can't open trace file '"} + filename + "'"};
+            }
+
+            std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file.get());
+
+            std::lock_guard<std::mutex> lock{m_mutex};
+            bool first = true;
+            for (const auto& buffer : m_buffers) {
+                std::fprintf(file.get(), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                             first ? "" : ",\n", buffer->tid(), buffer->tid() == 1 ? "main" : "worker");
+                first = false;
+                buffer->for_each([&](const event& e) {
+                    std::fprintf(file.get(), ",\n{\"name\":\"%s\",\"cat\":\"odad\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu}",
+                                 e.name, buffer->tid(),
+                                 static_cast<unsigned long long>(e.start_us), // NOLINT(google-runtime-int)
+                                 static_cast<unsigned long long>(e.duration_us)); // NOLINT(google-runtime-int)
+                });
+            }
+
+            std::fputs("\n]}\n", file.get());
+
+            if (std::ferror(file.get())) {
+                throw std::system_error{errno, std::system_category(), std::string{"Error writing trace file '"} + filename + "'"};
+            }
+        }
+
+    }; // class Tracer
+
+    /**
+     * Records the time from construction to destruction as a span.
+     */
+    class Span {
+
+        const char* m_name;
+        uint64_t m_start = 0;
+        bool m_active;
+
+    public:
+
+        explicit Span(const char* name) noexcept :
+            m_name(name),
+            m_active(Tracer::instance().enabled()) {
+            if (m_active) {
+                m_start = Tracer::instance().now_us();
+            }
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        Span(Span&&) = delete;
+        Span& operator=(Span&&) = delete;
+
+        ~Span() {
+            if (m_active) {
+                try {
+                    Tracer::instance().add(m_name, m_start, Tracer::instance().now_us());
+                } catch (...) {
+                    // ignore exceptions
+                }
+            }
+        }
+
+    }; // class Span
+
+    /// Enable tracing if a filename is set.
+    inline void start(const std::string& filename) {
+        if (!filename.empty()) {
+            Tracer::instance().enable();
+        }
+    }
+
+    /// Write out trace if a filename is set.
+    inline void finish(const std::string& filename) {
+        if (!filename.empty()) {
+            Tracer::instance().write(filename);
+        }
+    }
+
+} // namespace trace
+
+#endif // TRACE_HPP
@@ -0,0 +1,287 @@
+#ifndef UNUSUAL_TAGS_HPP
+#define UNUSUAL_TAGS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include "output_multiplexer.hpp"
+#include "utils.hpp"
+
+namespace unusual_tags {
+
+static const char* const program_name = "odad-find-unusual-tags";
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    std::size_t output_memory = OutputMultiplexer::default_memory_limit_mb;
+    Shard shard;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t nodes = 0;
+    uint64_t ways = 0;
+    uint64_t relations = 0;
+    uint64_t nwr_key_empty = 0;
+    uint64_t nwr_key_short = 0;
+    uint64_t nwr_key_long = 0;
+    uint64_t nwr_key_role = 0;
+    uint64_t nwr_key_bad_chars = 0;
+    uint64_t nwr_key_unusual_chars = 0;
+    uint64_t nwr_value_empty = 0;
+    uint64_t nwr_value_whitespace = 0;
+    uint64_t n_tag_type_multipolygon = 0;
+    uint64_t w_tag_type_multipolygon = 0;
+    uint64_t n_tag_type_boundary = 0;
+    uint64_t w_tag_type_boundary = 0;
+    uint64_t n_tag_natural_coastline = 0;
+    uint64_t r_tag_natural_coastline = 0;
+    uint64_t r_tag_boundary_multipolygon = 0;
+};
+
+static const char* const bad_characters = "=/&<>;'\"?%#@\\,";
+static const char* const usual_characters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_:";
+
+class CheckHandler : public osmium::handler::Handler {
+
+    options_type m_options;
+    stats_type m_stats;
+
+    MultiplexedWriter m_writer_nwr_key_empty;
+    MultiplexedWriter m_writer_nwr_key_short;
+    MultiplexedWriter m_writer_nwr_key_long;
+    MultiplexedWriter m_writer_nwr_key_role;
+    MultiplexedWriter m_writer_nwr_key_bad_chars;
+    MultiplexedWriter m_writer_nwr_key_unusual_chars;
+
+    MultiplexedWriter m_writer_nwr_value_empty;
+    MultiplexedWriter m_writer_nwr_value_whitespace;
+
+    MultiplexedWriter m_writer_nw_tag_type_multipolygon;
+    MultiplexedWriter m_writer_nw_tag_type_boundary;
+
+    MultiplexedWriter m_writer_nr_tag_natural_coastline;
+
+    MultiplexedWriter m_writer_r_tag_boundary_multipolygon;
+
+public:
+
+    CheckHandler(OutputMultiplexer& multiplexer, const std::string& directory, const options_type& options, const osmium::io::Header& header) :
+        m_options(options),
+        m_writer_nwr_key_empty(multiplexer, osmium::io::File{directory + "/nwr-key-empty.osm.pbf"}, header),
+        m_writer_nwr_key_short(multiplexer, osmium::io::File{directory + "/nwr-key-short.osm.pbf"}, header),
+        m_writer_nwr_key_long(multiplexer, osmium::io::File{directory + "/nwr-key-long.osm.pbf"}, header),
+        m_writer_nwr_key_role(multiplexer, osmium::io::File{directory + "/nwr-key-role.osm.pbf"}, header),
+        m_writer_nwr_key_bad_chars(multiplexer, osmium::io::File{directory + "/nwr-key-bad-chars.osm.pbf"}, header),
+        m_writer_nwr_key_unusual_chars(multiplexer, osmium::io::File{directory + "/nwr-key-unusual-chars.osm.pbf"}, header),
+        m_writer_nwr_value_empty(multiplexer, osmium::io::File{directory + "/nwr-value-empty.osm.pbf"}, header),
+        m_writer_nwr_value_whitespace(multiplexer, osmium::io::File{directory + "/nwr-value-whitespace.osm.pbf"}, header),
+        m_writer_nw_tag_type_multipolygon(multiplexer, osmium::io::File{directory + "/nw-tag-type-multipolygon.osm.pbf"}, header),
+        m_writer_nw_tag_type_boundary(multiplexer, osmium::io::File{directory + "/nw-tag-type-boundary.osm.pbf"}, header),
+        m_writer_nr_tag_natural_coastline(multiplexer, osmium::io::File{directory + "/nr-tag-natural-coastline.osm.pbf"}, header),
+        m_writer_r_tag_boundary_multipolygon(multiplexer, osmium::io::File{directory + "/r-tag-boundary-multipolygon.osm.pbf"}, header) {
+    }
+
+    void osm_object(const osmium::OSMObject& object) {
+        if (object.timestamp() >= m_options.before_time || !m_options.shard.contains(object)) {
+            return;
+        }
+
+        for (const auto& tag : object.tags()) {
+            const auto key_len = std::strlen(tag.key());
+            if (key_len == 0) {
+                ++m_stats.nwr_key_empty;
+                m_writer_nwr_key_empty(object);
+            } else if (key_len == 1) {
+                ++m_stats.nwr_key_short;
+                m_writer_nwr_key_short(object);
+            } else if (key_len > 80) {
+                ++m_stats.nwr_key_long;
+                m_writer_nwr_key_long(object);
+            } else if (!std::strcmp(tag.key(), "role")) {
+                ++m_stats.nwr_key_role;
+                m_writer_nwr_key_role(object);
+            }
+
+            const auto key_len_bad_chars = std::strcspn(tag.key(), bad_characters);
+            if (key_len != key_len_bad_chars) {
+                ++m_stats.nwr_key_bad_chars;
+                m_writer_nwr_key_bad_chars(object);
+            } else {
+                const auto key_len_common_chars = std::strspn(tag.key(), usual_characters);
+                if (key_len != key_len_common_chars) {
+                    ++m_stats.nwr_key_unusual_chars;
+                    m_writer_nwr_key_unusual_chars(object);
+                }
+            }
+
+            if (tag.value()[0] == '\0') {
+                ++m_stats.nwr_value_empty;
+                m_writer_nwr_value_empty(object);
+                continue;
+            }
+
+            const auto value_len = std::strlen(tag.value());
+            if (isspace(tag.value()[0]) || isspace(tag.value()[value_len - 1])) {
+                ++m_stats.nwr_value_whitespace;
+                m_writer_nwr_value_whitespace(object);
+            }
+        }
+    }
+
+    void node(const osmium::Node& node) {
+        if (node.timestamp() >= m_options.before_time || !m_options.shard.contains(node)) {
+            return;
+        }
+
+        ++m_stats.nodes;
+
+        const char* type = node.tags().get_value_by_key("type");
+        if (type) {
+            if (!std::strcmp(type, "multipolygon")) {
+                ++m_stats.n_tag_type_multipolygon;
+                m_writer_nw_tag_type_multipolygon(node);
+            }
+            if (!std::strcmp(type, "boundary")) {
+                ++m_stats.n_tag_type_boundary;
+                m_writer_nw_tag_type_boundary(node);
+            }
+        }
+
+        const char* natural = node.tags().get_value_by_key("natural");
+        if (natural && !std::strcmp(natural, "coastline")) {
+            ++m_stats.n_tag_natural_coastline;
+            m_writer_nr_tag_natural_coastline(node);
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (way.timestamp() >= m_options.before_time || !m_options.shard.contains(way)) {
+            return;
+        }
+
+        ++m_stats.ways;
+
+        const char* type = way.tags().get_value_by_key("type");
+        if (type) {
+            if (!std::strcmp(type, "multipolygon")) {
+                ++m_stats.w_tag_type_multipolygon;
+                m_writer_nw_tag_type_multipolygon(way);
+            }
+            if (!std::strcmp(type, "boundary")) {
+                ++m_stats.w_tag_type_boundary;
+                m_writer_nw_tag_type_boundary(way);
+            }
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        if (relation.timestamp() >= m_options.before_time || !m_options.shard.contains(relation)) {
+            return;
+        }
+
+        ++m_stats.relations;
+
+        const char* natural = relation.tags().get_value_by_key("natural");
+        if (natural && !std::strcmp(natural, "coastline")) {
+            ++m_stats.r_tag_natural_coastline;
+            m_writer_nr_tag_natural_coastline(relation);
+        }
+
+        const char* type = relation.tags().get_value_by_key("type");
+        if (type && !std::strcmp(type, "multipolygon")) {
+            const char* boundary = relation.tags().get_value_by_key("boundary");
+            if (boundary && !std::strcmp(boundary, "administrative")) {
+                ++m_stats.r_tag_boundary_multipolygon;
+                m_writer_r_tag_boundary_multipolygon(relation);
+            }
+        }
+    }
+
+    void close() {
+        m_writer_nwr_key_empty.close();
+        m_writer_nwr_key_short.close();
+        m_writer_nwr_key_long.close();
+        m_writer_nwr_key_role.close();
+        m_writer_nwr_key_bad_chars.close();
+        m_writer_nwr_key_unusual_chars.close();
+
+        m_writer_nwr_value_empty.close();
+        m_writer_nwr_value_whitespace.close();
+
+        m_writer_nw_tag_type_multipolygon.close();
+        m_writer_nw_tag_type_boundary.close();
+
+        m_writer_nr_tag_natural_coastline.close();
+
+        m_writer_r_tag_boundary_multipolygon.close();
+    }
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class CheckHandler
+
+inline void add_stats(const stats_type& stats, std::function<void(const char*, uint64_t)>& add) {
+    add("nodes", stats.nodes);
+    add("ways", stats.ways);
+    add("relations", stats.relations);
+    add("nwr_key_empty", stats.nwr_key_empty);
+    add("nwr_key_short", stats.nwr_key_short);
+    add("nwr_key_long", stats.nwr_key_long);
+    add("nwr_key_role", stats.nwr_key_role);
+    add("nwr_key_bad_chars", stats.nwr_key_bad_chars);
+    add("nwr_key_unusual_chars", stats.nwr_key_unusual_chars);
+    add("nwr_value_empty", stats.nwr_value_empty);
+    add("nwr_value_whitespace", stats.nwr_value_whitespace);
+    add("n_tag_type_multipolygon", stats.n_tag_type_multipolygon);
+    add("w_tag_type_multipolygon", stats.w_tag_type_multipolygon);
+    add("n_tag_type_boundary", stats.n_tag_type_boundary);
+    add("w_tag_type_boundary", stats.w_tag_type_boundary);
+    add("n_tag_natural_coastline", stats.n_tag_natural_coastline);
+    add("r_tag_natural_coastline", stats.r_tag_natural_coastline);
+    add("r_tag_boundary_multipolygon", stats.r_tag_boundary_multipolygon);
+}
+
+} // namespace unusual_tags
+
+#endif // UNUSUAL_TAGS_HPP
@@ -22,23 +22,55 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 */
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <osmium/geom/ogr.hpp>
 #include <osmium/handler.hpp>
 #include <osmium/io/header.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/object.hpp>
 #include <osmium/osm/timestamp.hpp>
 #include <osmium/util/file.hpp>
+#include <osmium/util/verbose_output.hpp>
 
 #include <gdalcpp.hpp>
 #include <sqlite.hpp>
 
+#include "input_mapping.hpp"
+#include "perf_counters.hpp"
+#include "shard.hpp"
+#include "trace.hpp"
+
 bool display_progress() noexcept {
     return osmium::util::isatty(2);
 }
 
+/**
+ * Read the next buffer from the reader recording the wait in the trace.
+ * Moves the read-ahead window forward if input_mapping is used.
+ */
+inline osmium::memory::Buffer read_traced(osmium::io::Reader& reader) {
+    input_mapping::advance(reader.file_size(), reader.offset());
+    trace::Span span{"Reader::read"};
+    return reader.read();
+}
+
+/// Add feature to its layer recording the GDAL insert in the trace.
+inline void add_to_layer(gdalcpp::Feature& feature) {
+    trace::Span span{"gdal_insert"};
+    feature.add_to_layer();
+}
+
 class HandlerWithDB : public osmium::handler::Handler {
 
 protected:
@@ -100,6 +132,164 @@ void write_stats(const std::string& database_name, const osmium::Timestamp& time
     std::forward<TFunc>(func)(add);
 }
 
+/**
+ * Measures wall time, CPU time, number of objects processed, and bytes
+ * read and written for each phase of a program. Bytes are taken from the
+ * rchar/wchar counters in /proc/self/io, they stay at 0 on systems that
+ * don't have it. CPU time is the time used by all threads of the process.
+ *
+ * Optionally hardware performance counters are measured for each phase,
+ * see the PerfCounters class for details.
+ */
+class PhaseTimer {
+
+    struct io_counters {
+        uint64_t read = 0;
+        uint64_t written = 0;
+    };
+
+    struct phase {
+        std::string name;
+        std::chrono::steady_clock::time_point start_wall;
+        std::clock_t start_cpu = 0;
+        io_counters start_io;
+        uint64_t wall_ms = 0;
+        uint64_t cpu_ms = 0;
+        uint64_t objects = 0;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        PerfCounters::values_type counters{};
+        bool running = true;
+
+        uint64_t objects_per_sec() const noexcept {
+            return wall_ms == 0 ? 0 : objects * 1000 / wall_ms;
+        }
+    };
+
+    std::vector<phase> m_phases;
+    std::unique_ptr<PerfCounters> m_perf_counters;
+
+    static io_counters get_io_counters() {
+        io_counters counters;
+
+        std::ifstream file{"/proc/self/io"};
+        std::string key;
+        uint64_t value = 0;
+        while (file >> key >> value) {
+            if (key == "rchar:") {
+                counters.read = value;
+            } else if (key == "wchar:") {
+                counters.written = value;
+            }
+        }
+
+        return counters;
+    }
+
+public:
+
+    explicit PhaseTimer(bool use_perf_counters = false) {
+        if (use_perf_counters) {
+            m_perf_counters.reset(new PerfCounters{});
+            if (!m_perf_counters->available()) {
+                std::cerr << "Warning: Hardware performance counters not available: " << m_perf_counters->error() << '\n';
+                m_perf_counters.reset();
+            }
+        }
+    }
+
+    /// Start a new phase, stopping the current one if there is one.
+    void start(const char* name) {
+        stop();
+        m_phases.emplace_back();
+        auto& p = m_phases.back();
+        p.name = name;
+        p.start_io = get_io_counters();
+        p.start_cpu = std::clock();
+        p.start_wall = std::chrono::steady_clock::now();
+        if (m_perf_counters) {
+            m_perf_counters->start();
+        }
+    }
+
+    /// Stop the current phase (if there is one).
+    void stop() {
+        if (m_phases.empty() || !m_phases.back().running) {
+            return;
+        }
+
+        auto& p = m_phases.back();
+        if (m_perf_counters) {
+            p.counters = m_perf_counters->stop();
+        }
+        const auto wall = std::chrono::steady_clock::now() - p.start_wall;
+        p.wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wall).count();
+        p.cpu_ms = static_cast<uint64_t>(std::clock() - p.start_cpu) * 1000 / CLOCKS_PER_SEC;
+        const auto io = get_io_counters();
+        p.bytes_read = io.read - p.start_io.read;
+        p.bytes_written = io.written - p.start_io.written;
+        p.running = false;
+    }
+
+    /// Add to the number of objects processed in the current phase.
+    void add_objects(uint64_t count) noexcept {
+        if (!m_phases.empty()) {
+            m_phases.back().objects += count;
+        }
+    }
+
+    /// Add the number of OSM objects in the buffer to the current phase.
+    void count(const osmium::memory::Buffer& buffer) noexcept {
+        uint64_t num = 0;
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            (void)object;
+            ++num;
+        }
+        add_objects(num);
+    }
+
+    void print(osmium::util::VerboseOutput& vout) {
+        stop();
+        for (const auto& p : m_phases) {
+            vout << "Phase " << p.name << ": "
+                 << p.wall_ms << " ms wall time, "
+                 << p.cpu_ms << " ms CPU time, "
+                 << p.objects << " objects (" << p.objects_per_sec() << "/s), "
+                 << (p.bytes_read / (1024 * 1024)) << " MBytes read, "
+                 << (p.bytes_written / (1024 * 1024)) << " MBytes written\n";
+            if (m_perf_counters) {
+                vout << "  ";
+                for (std::size_t n = 0; n < PerfCounters::num_counters; ++n) {
+                    vout << ' ' << PerfCounters::name(n) << '=' << p.counters[n];
+                }
+                if (p.counters[PerfCounters::cycles] != 0) {
+                    vout << " (IPC " << static_cast<double>(p.counters[PerfCounters::instructions]) / static_cast<double>(p.counters[PerfCounters::cycles]) << ')';
+                }
+                vout << '\n';
+            }
+        }
+    }
+
+    void add_stats(std::function<void(const char*, uint64_t)>& add) {
+        stop();
+        for (const auto& p : m_phases) {
+            const std::string prefix{"perf_" + p.name + "_"};
+            add((prefix + "wall_ms").c_str(), p.wall_ms);
+            add((prefix + "cpu_ms").c_str(), p.cpu_ms);
+            add((prefix + "objects").c_str(), p.objects);
+            add((prefix + "objects_per_sec").c_str(), p.objects_per_sec());
+            add((prefix + "bytes_read").c_str(), p.bytes_read);
+            add((prefix + "bytes_written").c_str(), p.bytes_written);
+            if (m_perf_counters) {
+                for (std::size_t n = 0; n < PerfCounters::num_counters; ++n) {
+                    add((prefix + PerfCounters::name(n)).c_str(), p.counters[n]);
+                }
+            }
+        }
+    }
+
+}; // class PhaseTimer
+
 inline bool has_locations_on_ways(const osmium::io::Header& header) {
     for (const auto& option : header) {
         if (option.second == "LocationsOnWays") {
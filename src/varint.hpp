@@ -0,0 +1,62 @@
+#ifndef VARINT_HPP
+#define VARINT_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <vector>
+
+/// Helper functions for the varint encoding also used in the PBF format.
+namespace varint {
+
+    inline void append(std::vector<unsigned char>& data, uint64_t value) {
+        while (value >= 0x80U) {
+            data.push_back(static_cast<unsigned char>((value & 0x7fU) | 0x80U));
+            value >>= 7U;
+        }
+        data.push_back(static_cast<unsigned char>(value));
+    }
+
+    inline uint64_t decode(const unsigned char** data) noexcept {
+        uint64_t value = 0;
+        unsigned int shift = 0;
+        while (**data & 0x80U) {
+            value |= static_cast<uint64_t>(**data & 0x7fU) << shift;
+            shift += 7;
+            ++*data;
+        }
+        value |= static_cast<uint64_t>(**data) << shift;
+        ++*data;
+        return value;
+    }
+
+    inline uint64_t zigzag(int64_t value) noexcept {
+        return (static_cast<uint64_t>(value) << 1U) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t value) noexcept {
+        return static_cast<int64_t>(value >> 1U) ^ -static_cast<int64_t>(value & 1U);
+    }
+
+} // namespace varint
+
+#endif // VARINT_HPP
@@ -0,0 +1,578 @@
+#ifndef WAY_PROBLEMS_HPP
+#define WAY_PROBLEMS_HPP
+
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/geom/ogr.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/osm/undirected_segment.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/util/progress_bar.hpp>
+#include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
+
+#include <gdalcpp.hpp>
+
+#include "output_multiplexer.hpp"
+#include "utils.hpp"
+
+namespace way_problems {
+
+static const char* const program_name = "odad-find-way-problems";
+
+struct options_type {
+    osmium::Timestamp before_time{osmium::end_of_time()};
+    bool verbose = true;
+    size_t max_nodes = 1800;
+    double max_angle = 0.03;
+    std::size_t output_memory = OutputMultiplexer::default_memory_limit_mb;
+    std::string location_index;
+    Shard shard;
+    bool mmap_input = false;
+    bool perf_counters = false;
+    std::string trace_filename;
+};
+
+struct stats_type {
+    uint64_t way_nodes = 0;
+    uint64_t self_intersection = 0;
+    uint64_t spike = 0;
+    uint64_t acute_angle = 0;
+    uint64_t duplicate_segment = 0;
+    uint64_t no_node = 0;
+    uint64_t single_node = 0;
+    uint64_t same_node = 0;
+    uint64_t duplicate_node = 0;
+    uint64_t close_nodes = 0;
+    uint64_t many_nodes = 0;
+};
+
+static osmium::Location intersection(const osmium::Segment& s1, const osmium::Segment&s2) {
+    if (s1.first()  == s2.first()  ||
+        s1.first()  == s2.second() ||
+        s1.second() == s2.first()  ||
+        s1.second() == s2.second()) {
+        return osmium::Location{};
+    }
+
+    const double denom = ((s2.second().lat() - s2.first().lat())*(s1.second().lon() - s1.first().lon())) -
+                         ((s2.second().lon() - s2.first().lon())*(s1.second().lat() - s1.first().lat()));
+
+    if (denom != 0) {
+        const double nume_a = ((s2.second().lon() - s2.first().lon())*(s1.first().lat() - s2.first().lat())) -
+                              ((s2.second().lat() - s2.first().lat())*(s1.first().lon() - s2.first().lon()));
+
+        const double nume_b = ((s1.second().lon() - s1.first().lon())*(s1.first().lat() - s2.first().lat())) -
+                              ((s1.second().lat() - s1.first().lat())*(s1.first().lon() - s2.first().lon()));
+
+        if ((denom > 0 && nume_a >= 0 && nume_a <= denom && nume_b >= 0 && nume_b <= denom) ||
+            (denom < 0 && nume_a <= 0 && nume_a >= denom && nume_b <= 0 && nume_b >= denom)) {
+            const double ua = nume_a / denom;
+            const double ix = s1.first().lon() + ua*(s1.second().lon() - s1.first().lon());
+            const double iy = s1.first().lat() + ua*(s1.second().lat() - s1.first().lat());
+            return osmium::Location{ix, iy};
+        }
+    }
+
+    return osmium::Location{};
+}
+
+static bool outside_x_range(const osmium::UndirectedSegment& s1, const osmium::UndirectedSegment& s2) noexcept {
+    return s1.first().x() > s2.second().x();
+}
+
+static bool y_range_overlap(const osmium::UndirectedSegment& s1, const osmium::UndirectedSegment& s2) noexcept {
+    const int tmin = s1.first().y() < s1.second().y() ? s1.first().y( ) : s1.second().y();
+    const int tmax = s1.first().y() < s1.second().y() ? s1.second().y() : s1.first().y();
+    const int omin = s2.first().y() < s2.second().y() ? s2.first().y()  : s2.second().y();
+    const int omax = s2.first().y() < s2.second().y() ? s2.second().y() : s2.first().y();
+    return !(tmin > omax || omin > tmax);
+}
+
+static MultiplexedWriter make_writer(OutputMultiplexer& multiplexer, const std::string& dir, const std::string& name) {
+    osmium::io::File file{dir + "/" + name + ".osm.pbf"};
+    file.set("locations_on_ways");
+
+    osmium::io::Header header;
+    header.set("generator", program_name);
+
+    return MultiplexedWriter{multiplexer, file, header};
+}
+
+static bool all_same_nodes(const osmium::WayNodeList& wnl) noexcept {
+    const osmium::object_id_type ref = wnl[0].ref();
+
+    for (const auto& wn : wnl) {
+        if (ref != wn.ref()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool duplicate_nodes(const osmium::WayNodeList& wnl) noexcept {
+    osmium::object_id_type prev_ref = 0;
+
+    for (const auto& wn : wnl) {
+        if (prev_ref == wn.ref()) {
+            return true;
+        }
+        prev_ref = wn.ref();
+    }
+
+    return false;
+}
+
+static std::vector<osmium::UndirectedSegment> create_segment_list(const osmium::WayNodeList& wnl) {
+    assert(!wnl.empty());
+
+    std::vector<osmium::UndirectedSegment> segments;
+    segments.reserve(wnl.size() - 1);
+
+    for (auto it1 = wnl.cbegin(), it2 = std::next(it1); it2 != wnl.cend(); ++it1, ++it2) {
+        const auto loc1 = it1->location();
+        const auto loc2 = it2->location();
+        if (loc1 != loc2) {
+            segments.emplace_back(loc1, loc2);
+        }
+    }
+
+    return segments;
+}
+
+static constexpr const int min_diff_for_close_nodes = 10;
+
+static bool has_close_nodes(const osmium::WayNodeList& wnl) {
+    if (wnl.size() < 2) {
+        return false;
+    }
+
+    osmium::Location location;
+
+    for (const auto& wn : wnl) {
+        auto dx = std::abs(location.x() - wn.location().x());
+        auto dy = std::abs(location.y() - wn.location().y());
+        if (dx < min_diff_for_close_nodes && dy < min_diff_for_close_nodes) {
+            return true;
+        }
+        location = wn.location();
+    }
+
+    return false;
+}
+
+class CheckHandler : public HandlerWithDB {
+
+    options_type m_options;
+    stats_type m_stats;
+
+    gdalcpp::Layer m_layer_way_one_node;
+    gdalcpp::Layer m_layer_way_duplicate_nodes;
+    gdalcpp::Layer m_layer_way_intersection_points;
+    gdalcpp::Layer m_layer_way_intersection_lines;
+    gdalcpp::Layer m_layer_way_spike_points;
+    gdalcpp::Layer m_layer_way_spike_lines;
+    gdalcpp::Layer m_layer_way_acute_angle_points;
+    gdalcpp::Layer m_layer_way_acute_angle_lines;
+    gdalcpp::Layer m_layer_way_duplicate_segments;
+    gdalcpp::Layer m_layer_way_many_nodes;
+
+    MultiplexedWriter m_writer_self_intersection;
+    MultiplexedWriter m_writer_spike;
+    MultiplexedWriter m_writer_acute_angle;
+    MultiplexedWriter m_writer_duplicate_segment;
+    MultiplexedWriter m_writer_no_node;
+    MultiplexedWriter m_writer_single_node;
+    MultiplexedWriter m_writer_same_node;
+    MultiplexedWriter m_writer_duplicate_node;
+    MultiplexedWriter m_writer_close_nodes;
+    MultiplexedWriter m_writer_many_nodes;
+
+    bool detect_spikes(const osmium::Way& way) {
+        if (way.nodes().size() < 3) {
+            return false;
+        }
+
+        const auto first = way.nodes().cbegin();
+        const auto last = way.nodes().cend();
+
+        auto prev = first;
+        auto curr = prev + 1;
+        auto next = curr + 1;
+
+        for (; next != last; ++prev, ++curr, ++next) {
+            if (prev->location() == next->location() && prev->location() != curr->location()) {
+                // found spike
+                const auto ts = way.timestamp().to_iso();
+                {
+                    gdalcpp::Feature feature{m_layer_way_spike_points, m_factory.create_point(curr->location())};
+                    feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                    feature.set_field("timestamp", ts.c_str());
+                    feature.set_field("closed", way.is_closed());
+                    add_to_layer(feature);
+                }
+
+                if (prev != first) {
+                    auto p = prev - 1;
+                    auto n = next + 1;
+                    while (p != first && n != last && p->location() == n->location()) {
+                        prev = p;
+                        next = n;
+                        --p;
+                        ++n;
+                    }
+                }
+
+                {
+                    std::unique_ptr<OGRLineString> linestring{new OGRLineString};
+                    for (; prev != next; ++prev) {
+                        linestring->addPoint(prev->location().lon(), prev->location().lat());
+                    }
+                    gdalcpp::Feature feature{m_layer_way_spike_lines, std::move(linestring)};
+                    feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                    feature.set_field("timestamp", ts.c_str());
+                    feature.set_field("closed", way.is_closed());
+                    add_to_layer(feature);
+                }
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static double calc_angle(const osmium::Location& a, const osmium::Location& m, const osmium::Location& b) {
+        const int64_t dax = a.x() - m.x();
+        const int64_t day = a.y() - m.y();
+        const int64_t dbx = b.x() - m.x();
+        const int64_t dby = b.y() - m.y();
+        const double dp = static_cast<double>(dax * dbx + day * dby);
+        const double m1 = std::sqrt(static_cast<double>(dax * dax + day * day));
+        const double m2 = std::sqrt(static_cast<double>(dbx * dbx + dby * dby));
+
+        if (m1 == 0 || m2 == 0) {
+            return 0;
+        }
+
+        const double cphi = dp / (m1 * m2);
+        return std::acos(cphi);
+    }
+
+    bool detect_acute_angles(const osmium::Way& way) {
+        if (way.nodes().size() < 3) {
+            return false;
+        }
+
+        auto prev = way.nodes().cbegin();
+        auto curr = prev + 1;
+        auto next = curr + 1;
+
+        bool result = false;
+
+        for (; next != way.nodes().end(); ++prev, ++curr, ++next) {
+            const auto angle = calc_angle(prev->location(), curr->location(), next->location());
+            if (angle < m_options.max_angle) {
+                result = true;
+                const auto ts = way.timestamp().to_iso();
+                {
+                    gdalcpp::Feature feature{m_layer_way_acute_angle_points, m_factory.create_point(curr->location())};
+                    feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                    feature.set_field("timestamp", ts.c_str());
+                    feature.set_field("closed", way.is_closed());
+                    feature.set_field("angle", angle);
+                    add_to_layer(feature);
+                }
+                auto ogr_linestring = std::unique_ptr<OGRLineString>{new OGRLineString{}};
+                ogr_linestring->addPoint(prev->location().lon(), prev->location().lat());
+                ogr_linestring->addPoint(curr->location().lon(), curr->location().lat());
+                ogr_linestring->addPoint(next->location().lon(), next->location().lat());
+
+                gdalcpp::Feature feature{m_layer_way_acute_angle_lines, std::move(ogr_linestring)};
+                feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                feature.set_field("timestamp", ts.c_str());
+                feature.set_field("closed", way.is_closed());
+                feature.set_field("angle", angle);
+                add_to_layer(feature);
+            }
+        }
+
+        return result;
+    }
+
+public:
+
+    CheckHandler(OutputMultiplexer& multiplexer, const std::string& output_dirname, const options_type& options) :
+        HandlerWithDB(output_dirname + "/geoms-way-problems.db"),
+        m_options(options),
+        m_layer_way_one_node(m_dataset, "way_one_node", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_duplicate_nodes(m_dataset, "way_duplicate_nodes", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_intersection_points(m_dataset, "way_intersection_points", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_intersection_lines(m_dataset, "way_intersection_lines", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_spike_points(m_dataset, "way_spike_points", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_spike_lines(m_dataset, "way_spike_lines", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_acute_angle_points(m_dataset, "way_acute_angle_points", wkbPoint, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_acute_angle_lines(m_dataset, "way_acute_angle_lines", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_duplicate_segments(m_dataset, "way_duplicate_segments", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_layer_way_many_nodes(m_dataset, "way_many_nodes", wkbLineString, {"SPATIAL_INDEX=NO"}),
+        m_writer_self_intersection(make_writer(multiplexer, output_dirname, "way-self-intersection")),
+        m_writer_spike(make_writer(multiplexer, output_dirname, "way-spike")),
+        m_writer_acute_angle(make_writer(multiplexer, output_dirname, "way-acute-angle")),
+        m_writer_duplicate_segment(make_writer(multiplexer, output_dirname, "way-duplicate-segment")),
+        m_writer_no_node(make_writer(multiplexer, output_dirname, "way-no-node")),
+        m_writer_single_node(make_writer(multiplexer, output_dirname, "way-single-node")),
+        m_writer_same_node(make_writer(multiplexer, output_dirname, "way-same-node")),
+        m_writer_duplicate_node(make_writer(multiplexer, output_dirname, "way-duplicate-node")),
+        m_writer_close_nodes(make_writer(multiplexer, output_dirname, "way-close-nodes")),
+        m_writer_many_nodes(make_writer(multiplexer, output_dirname, "way-many-nodes")) {
+
+        m_layer_way_one_node.add_field("way_id", OFTInteger, 10);
+        m_layer_way_one_node.add_field("timestamp", OFTString, 20);
+        m_layer_way_one_node.add_field("node_id", OFTReal, 12);
+        m_layer_way_one_node.add_field("num_nodes", OFTInteger, 3);
+
+        m_layer_way_duplicate_nodes.add_field("way_id", OFTInteger, 10);
+        m_layer_way_duplicate_nodes.add_field("timestamp", OFTString, 20);
+        m_layer_way_duplicate_nodes.add_field("node_id", OFTReal, 12);
+        m_layer_way_duplicate_nodes.add_field("closed", OFTInteger, 1);
+
+        m_layer_way_intersection_points.add_field("way_id", OFTInteger, 10);
+        m_layer_way_intersection_points.add_field("timestamp", OFTString, 20);
+        m_layer_way_intersection_points.add_field("closed", OFTInteger, 1);
+        m_layer_way_intersection_lines.add_field("way_id", OFTInteger, 10);
+        m_layer_way_intersection_lines.add_field("timestamp", OFTString, 20);
+        m_layer_way_intersection_lines.add_field("closed", OFTInteger, 1);
+
+        m_layer_way_spike_points.add_field("way_id", OFTInteger, 10);
+        m_layer_way_spike_points.add_field("timestamp", OFTString, 20);
+        m_layer_way_spike_points.add_field("closed", OFTInteger, 1);
+        m_layer_way_spike_lines.add_field("way_id", OFTInteger, 10);
+        m_layer_way_spike_lines.add_field("timestamp", OFTString, 20);
+        m_layer_way_spike_lines.add_field("closed", OFTInteger, 1);
+
+        m_layer_way_acute_angle_points.add_field("way_id", OFTInteger, 10);
+        m_layer_way_acute_angle_points.add_field("timestamp", OFTString, 20);
+        m_layer_way_acute_angle_points.add_field("closed", OFTInteger, 1);
+        m_layer_way_acute_angle_points.add_field("angle", OFTReal, 20);
+        m_layer_way_acute_angle_lines.add_field("way_id", OFTInteger, 10);
+        m_layer_way_acute_angle_lines.add_field("timestamp", OFTString, 20);
+        m_layer_way_acute_angle_lines.add_field("closed", OFTInteger, 1);
+        m_layer_way_acute_angle_lines.add_field("angle", OFTReal, 20);
+
+        m_layer_way_duplicate_segments.add_field("way_id", OFTInteger, 10);
+        m_layer_way_duplicate_segments.add_field("timestamp", OFTString, 20);
+        m_layer_way_duplicate_segments.add_field("closed", OFTInteger, 1);
+
+        m_layer_way_many_nodes.add_field("way_id", OFTInteger, 10);
+        m_layer_way_many_nodes.add_field("timestamp", OFTString, 20);
+        m_layer_way_many_nodes.add_field("num_nodes", OFTInteger, 4);
+        m_layer_way_many_nodes.add_field("closed", OFTInteger, 1);
+    }
+
+    void way(const osmium::Way& way) {
+        if (way.timestamp() >= m_options.before_time || !m_options.shard.contains(way)) {
+            return;
+        }
+
+        if (way.nodes().empty()) {
+            ++m_stats.no_node;
+            m_writer_no_node(way);
+            return;
+        }
+
+        m_stats.way_nodes += way.nodes().size();
+
+        const auto ts = way.timestamp().to_iso();
+
+        if (way.nodes().size() == 1) {
+            ++m_stats.single_node;
+            m_writer_single_node(way);
+            gdalcpp::Feature feature{m_layer_way_one_node, m_factory.create_point(way.nodes()[0])};
+            feature.set_field("way_id", static_cast<int32_t>(way.id()));
+            feature.set_field("node_id", static_cast<double>(way.nodes()[0].ref()));
+            feature.set_field("num_nodes", 1);
+            feature.set_field("timestamp", ts.c_str());
+            add_to_layer(feature);
+            return;
+        }
+
+        if (all_same_nodes(way.nodes())) {
+            ++m_stats.same_node;
+            m_writer_same_node(way);
+            gdalcpp::Feature feature{m_layer_way_one_node, m_factory.create_point(way.nodes()[0])};
+            feature.set_field("way_id", static_cast<int32_t>(way.id()));
+            feature.set_field("node_id", static_cast<double>(way.nodes()[0].ref()));
+            feature.set_field("num_nodes", static_cast<int32_t>(way.nodes().size()));
+            feature.set_field("timestamp", ts.c_str());
+            add_to_layer(feature);
+            return;
+        }
+
+        if (duplicate_nodes(way.nodes())) {
+            ++m_stats.duplicate_node;
+            m_writer_duplicate_node(way);
+            gdalcpp::Feature feature{m_layer_way_duplicate_nodes, m_factory.create_point(way.nodes()[0])};
+            feature.set_field("way_id", static_cast<int32_t>(way.id()));
+            feature.set_field("node_id", static_cast<double>(way.nodes()[0].ref()));
+            feature.set_field("timestamp", ts.c_str());
+            feature.set_field("closed", way.is_closed());
+            add_to_layer(feature);
+        }
+
+        auto segments = create_segment_list(way.nodes());
+
+        if (segments.size() < 2) {
+            return;
+        }
+
+        if (detect_spikes(way)) {
+            ++m_stats.spike;
+            m_writer_spike(way);
+            return;
+        }
+
+        if (detect_acute_angles(way)) {
+            ++m_stats.acute_angle;
+            m_writer_acute_angle(way);
+        }
+
+        std::sort(segments.begin(), segments.end());
+
+        std::vector<osmium::Location> intersections;
+        for (auto it1 = segments.cbegin(); it1 != segments.cend() - 1; ++it1) {
+            const osmium::UndirectedSegment& s1 = *it1;
+            for (auto it2 = it1 + 1; it2 != segments.cend(); ++it2) {
+                const osmium::UndirectedSegment& s2 = *it2;
+                if (s1 == s2) {
+                    ++m_stats.duplicate_segment;
+                    m_writer_duplicate_segment(way);
+                    std::unique_ptr<OGRLineString> linestring{new OGRLineString{}};
+                    linestring->addPoint(s1.first().lon(), s1.first().lat());
+                    linestring->addPoint(s1.second().lon(), s1.second().lat());
+                    gdalcpp::Feature feature{m_layer_way_duplicate_segments, std::move(linestring)};
+                    feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                    feature.set_field("timestamp", ts.c_str());
+                    feature.set_field("closed", way.is_closed());
+                    add_to_layer(feature);
+                } else {
+                    if (outside_x_range(s2, s1)) {
+                        break;
+                    }
+                    if (y_range_overlap(s1, s2)) {
+                        osmium::Location i = intersection(s1, s2);
+                        if (i) {
+                            intersections.push_back(i);
+                        }
+                    }
+                }
+            }
+        }
+        if (!intersections.empty()) {
+            ++m_stats.self_intersection;
+            m_writer_self_intersection(way);
+
+            for (const auto& location : intersections) {
+                gdalcpp::Feature feature{m_layer_way_intersection_points, m_factory.create_point(location)};
+                feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                feature.set_field("timestamp", ts.c_str());
+                feature.set_field("closed", way.is_closed());
+                add_to_layer(feature);
+            }
+
+            {
+                gdalcpp::Feature feature{m_layer_way_intersection_lines, m_factory.create_linestring(way)};
+                feature.set_field("way_id", static_cast<int32_t>(way.id()));
+                feature.set_field("timestamp", ts.c_str());
+                feature.set_field("closed", way.is_closed());
+                add_to_layer(feature);
+            }
+        }
+
+        if (has_close_nodes(way.nodes())) {
+            ++m_stats.close_nodes;
+            m_writer_close_nodes(way);
+        }
+
+        if (way.nodes().size() > m_options.max_nodes) {
+            ++m_stats.many_nodes;
+            m_writer_many_nodes(way);
+            gdalcpp::Feature feature{m_layer_way_many_nodes, m_factory.create_linestring(way)};
+            feature.set_field("way_id", static_cast<int32_t>(way.id()));
+            feature.set_field("timestamp", ts.c_str());
+            feature.set_field("num_nodes", static_cast<int32_t>(way.nodes().size()));
+            feature.set_field("closed", way.is_closed());
+            add_to_layer(feature);
+        }
+    }
+
+    void close() {
+        m_writer_self_intersection.close();
+        m_writer_spike.close();
+        m_writer_acute_angle.close();
+        m_writer_duplicate_segment.close();
+        m_writer_no_node.close();
+        m_writer_single_node.close();
+        m_writer_same_node.close();
+        m_writer_duplicate_node.close();
+        m_writer_close_nodes.close();
+        m_writer_many_nodes.close();
+    }
+
+    const stats_type& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class CheckHandler
+
+inline void add_stats(const stats_type& stats, std::function<void(const char*, uint64_t)>& add) {
+    add("way_nodes", stats.way_nodes);
+    add("way_self_intersection", stats.self_intersection);
+    add("way_spike", stats.spike);
+    add("way_acute_angle", stats.acute_angle);
+    add("way_duplicate_segment", stats.duplicate_segment);
+    add("way_no_node", stats.no_node);
+    add("way_single_node", stats.single_node);
+    add("way_same_node", stats.same_node);
+    add("way_duplicate_node", stats.duplicate_node);
+    add("way_close_nodes", stats.close_nodes);
+    add("way_many_nodes", stats.many_nodes);
+}
+
+} // namespace way_problems
+
+#endif // WAY_PROBLEMS_HPP
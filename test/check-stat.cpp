@@ -0,0 +1,62 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Used by the tests: Check that the stat KEY in the stats database DB
+ * written by one of the programs has the value EXPECTED.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <sqlite.hpp>
+
+int main(int argc, char* argv[]) try {
+    if (argc != 4) {
+        std::cerr << "Usage: check-stat DB KEY EXPECTED\n";
+        return 2;
+    }
+
+    const std::string key{argv[2]};
+    const int64_t expected = std::atoll(argv[3]);
+
+    Sqlite::Database db{argv[1], SQLITE_OPEN_READONLY};
+    Sqlite::Statement statement{db, "SELECT value FROM stats WHERE key = ?;"};
+    statement.bind_text(key);
+
+    if (!statement.read()) {
+        std::cerr << "Stat '" << key << "' not found in '" << argv[1] << "'\n";
+        return 1;
+    }
+
+    const int64_t value = statement.get_int64(0);
+    if (value != expected) {
+        std::cerr << "Stat '" << key << "' is " << value << ", expected " << expected << '\n';
+        return 1;
+    }
+
+    return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    std::exit(1);
+}
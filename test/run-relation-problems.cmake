@@ -0,0 +1,28 @@
+#-----------------------------------------------------------------------------
+#
+#  Run odad-find-relation-problems on INPUT and check the stats it writes
+#  against the EXPECTED_* variables.
+#
+#-----------------------------------------------------------------------------
+
+file(REMOVE_RECURSE ${OUTPUT_DIR})
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+execute_process(
+    COMMAND ${TOOL} --quiet ${INPUT} ${OUTPUT_DIR}
+    RESULT_VARIABLE _result
+)
+if(_result)
+    message(FATAL_ERROR "Running ${TOOL} on ${INPUT} failed: ${_result}")
+endif()
+
+foreach(_stat relation_cycle relation_cycle_count relation_deep_nesting relation_max_nesting_depth)
+    string(TOUPPER ${_stat} _var)
+    execute_process(
+        COMMAND ${CHECK_STAT} ${OUTPUT_DIR}/stats-relation-problems.db ${_stat} ${EXPECTED_${_var}}
+        RESULT_VARIABLE _result
+    )
+    if(_result)
+        message(FATAL_ERROR "Wrong value for stat ${_stat} on ${INPUT}")
+    endif()
+endforeach()
@@ -0,0 +1,186 @@
+/*
+
+https://github.com/osmcode/osm-data-anomaly-detection
+
+Copyright (C) 2019-2022  Jochen Topf <jochen@topf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Round-trip tests for the MemberIndex and MemberList encodings: Build
+ * them from random data and check that exactly the same data comes out.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "member_index.hpp"
+
+using id_type = osmium::unsigned_object_id_type;
+
+static int errors = 0;
+
+static void check(bool condition, const char* what, id_type id) {
+    if (!condition) {
+        std::cerr << "Error: " << what << " (member " << id << ")\n";
+        ++errors;
+    }
+}
+
+static bool same(const member_entry& a, const member_entry& b) noexcept {
+    return a.member_id() == b.member_id() &&
+           a.output() == b.output() &&
+           a.relation_id() == b.relation_id();
+}
+
+/**
+ * Create random sorted entries. Some members have only one entry, others
+ * have many more than fit into one block of the index, with several
+ * outputs and relations each. Relation IDs are small or large, so the
+ * deltas need one or many bytes.
+ */
+static std::vector<member_entry> random_entries(std::mt19937_64& gen) {
+    std::uniform_int_distribution<int> kind{0, 9};
+    std::uniform_int_distribution<id_type> small_gap{1, 3};
+    std::uniform_int_distribution<id_type> large_gap{1, id_type(1) << 36U};
+    std::uniform_int_distribution<std::size_t> few{1, 5};
+    std::uniform_int_distribution<std::size_t> many{60, 300};
+    std::uniform_int_distribution<std::size_t> output{0, 40};
+    std::uniform_int_distribution<id_type> relation{1, (id_type(1) << 40U) - 1};
+    std::uniform_int_distribution<id_type> nearby_relation{1, 1000};
+
+    std::vector<member_entry> entries;
+
+    id_type member_id = 0;
+    for (int i = 0; i < 5000; ++i) {
+        const int k = kind(gen);
+        member_id += (k == 0) ? large_gap(gen) : small_gap(gen);
+
+        const std::size_t count = (k == 1) ? many(gen) : few(gen);
+        const id_type base = relation(gen);
+        for (std::size_t n = 0; n < count; ++n) {
+            const id_type rid = (n % 3 == 0) ? relation(gen) : base + nearby_relation(gen);
+            entries.emplace_back(member_id, output(gen), rid);
+            if (n % 7 == 0) {
+                // the same entry twice
+                entries.push_back(entries.back());
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+static void test_member_index(std::mt19937_64& gen) {
+    const auto entries = random_entries(gen);
+    const MemberIndex index{entries};
+
+    check(index.size() == entries.size(), "wrong size", 0);
+    check(index.last_member_id() == entries.back().member_id(), "wrong last member id", 0);
+
+    std::vector<member_entry> found;
+
+    // IDs before the first member and after the last have no entries
+    index.find(0, found);
+    check(found.empty(), "found entries for ID 0", 0);
+    index.find(entries.back().member_id() + 1, found);
+    check(found.empty(), "found entries after last member", entries.back().member_id() + 1);
+
+    auto it = entries.begin();
+    while (it != entries.end()) {
+        const id_type member_id = it->member_id();
+        const auto end = std::find_if(it, entries.end(), [&](const member_entry& e) {
+            return e.member_id() != member_id;
+        });
+
+        index.find(member_id, found);
+        check(static_cast<std::size_t>(end - it) == found.size(), "wrong number of entries", member_id);
+        check(std::equal(found.begin(), found.end(), it, same), "wrong entries", member_id);
+
+        // the ID right before this member is only in the index if it is
+        // the previous member
+        if (it == entries.begin() || std::prev(it)->member_id() != member_id - 1) {
+            index.find(member_id - 1, found);
+            check(found.empty(), "found entries for missing member", member_id - 1);
+        }
+
+        it = end;
+    }
+}
+
+static void test_empty_member_index() {
+    const MemberIndex index{std::vector<member_entry>{}};
+    check(index.empty(), "index not empty", 0);
+
+    std::vector<member_entry> found{member_entry{1, 2, 3}};
+    index.find(1, found);
+    check(found.empty(), "found entries in empty index", 1);
+}
+
+static void test_member_list(std::mt19937_64& gen) {
+    std::uniform_int_distribution<id_type> id{1, (id_type(1) << 40U) - 1};
+    std::uniform_int_distribution<int> same_relation{0, 3};
+
+    std::vector<std::pair<id_type, id_type>> pairs;
+    MemberList list;
+
+    id_type relation_id = id(gen);
+    for (int i = 0; i < 100000; ++i) {
+        if (same_relation(gen) == 0) {
+            relation_id = id(gen);
+        }
+        pairs.emplace_back(id(gen), relation_id);
+        list.add(pairs.back().first, pairs.back().second);
+    }
+
+    check(list.size() == pairs.size(), "wrong member list size", 0);
+
+    std::size_t n = 0;
+    list.for_each([&](id_type member_id, id_type rid) {
+        check(n < pairs.size() && pairs[n].first == member_id && pairs[n].second == rid, "wrong member list entry", member_id);
+        ++n;
+    });
+    check(n == pairs.size(), "wrong number of member list entries", 0);
+
+    list.clear();
+    list.for_each([&](id_type member_id, id_type /*relation_id*/) {
+        check(false, "member list not empty after clear", member_id);
+    });
+}
+
+int main() {
+    std::mt19937_64 gen{42};
+
+    test_empty_member_index();
+    for (int round = 0; round < 10; ++round) {
+        test_member_index(gen);
+    }
+    test_member_list(gen);
+
+    if (errors != 0) {
+        std::cerr << errors << " errors\n";
+        return 1;
+    }
+
+    return 0;
+}